@@ -0,0 +1,177 @@
+#include "AssetPack.h"
+#include "Hash.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+static const uint32_t PackMagic = 0x4b415041; // "APAK"
+static const uint32_t PackVersion = 1;
+
+// Bytes per block and block width, 1 for uncompressed formats
+static bool GetFormatBlock(vk::Format format, uint32_t &bytes, uint32_t &dim)
+{
+    dim = 1;
+    switch (format)
+    {
+    case vk::Format::eR8Unorm:
+        bytes = 1;
+        return true;
+    case vk::Format::eR8G8Unorm:
+    case vk::Format::eR16Sfloat:
+        bytes = 2;
+        return true;
+    case vk::Format::eR8G8B8A8Unorm:
+    case vk::Format::eR8G8B8A8Srgb:
+    case vk::Format::eB8G8R8A8Unorm:
+    case vk::Format::eB8G8R8A8Srgb:
+    case vk::Format::eR16G16Sfloat:
+    case vk::Format::eR32Sfloat:
+        bytes = 4;
+        return true;
+    case vk::Format::eR16G16B16A16Sfloat:
+        bytes = 8;
+        return true;
+    case vk::Format::eR32G32B32A32Sfloat:
+        bytes = 16;
+        return true;
+    case vk::Format::eBc1RgbaUnormBlock:
+    case vk::Format::eBc1RgbaSrgbBlock:
+    case vk::Format::eBc4UnormBlock:
+        bytes = 8;
+        dim = 4;
+        return true;
+    case vk::Format::eBc3UnormBlock:
+    case vk::Format::eBc3SrgbBlock:
+    case vk::Format::eBc5UnormBlock:
+    case vk::Format::eBc7UnormBlock:
+    case vk::Format::eBc7SrgbBlock:
+        bytes = 16;
+        dim = 4;
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool AssetPack::Open(const std::string &path)
+{
+    return index.Open(path, "Asset pack", PackMagic, PackVersion, Alignment, &AssetPack::IsValid);
+}
+
+void AssetPack::Close()
+{
+    index.Close();
+}
+
+bool AssetPack::IsOpen() const
+{
+    return index.IsOpen();
+}
+
+const AssetPackEntry *AssetPack::Find(const std::string &name) const
+{
+    return index.Find(name);
+}
+
+const uint8_t *AssetPack::GetData(const AssetPackEntry &entry) const
+{
+    return index.GetData(entry);
+}
+
+uint32_t AssetPack::GetAssetCount() const
+{
+    return index.GetCount();
+}
+
+vk::DeviceSize AssetPack::GetIndexOffset(const AssetPackEntry &entry)
+{
+    auto vertexBytes = (vk::DeviceSize)entry.params[0] * entry.params[1];
+    return (vertexBytes + 3) / 4 * 4;
+}
+
+TextureLayout AssetPack::GetTextureLayout(vk::Format format, uint32_t width, uint32_t height, uint32_t mipCount)
+{
+    uint32_t blockBytes, blockDim;
+    if (!GetFormatBlock(format, blockBytes, blockDim))
+        throw std::runtime_error{ "Asset packs don't support texture format " + std::to_string((int)format) };
+
+    TextureLayout layout;
+    layout.totalSize = 0;
+    for (uint32_t level = 0; level < mipCount; ++level)
+    {
+        auto levelWidth = std::max(width >> level, 1u);
+        auto levelHeight = std::max(height >> level, 1u);
+        auto blocksWide = (levelWidth + blockDim - 1) / blockDim;
+        auto blocksHigh = (levelHeight + blockDim - 1) / blockDim;
+
+        layout.totalSize = (layout.totalSize + 15) / 16 * 16;
+        layout.offsets.push_back(layout.totalSize);
+        layout.sizes.push_back((vk::DeviceSize)blocksWide * blocksHigh * blockBytes);
+        layout.totalSize += layout.sizes.back();
+    }
+    return layout;
+}
+
+bool AssetPack::Pack(const std::string &path, const std::vector<AssetSource> &assets)
+{
+    std::vector<AssetPackEntry> entries;
+    for (auto &asset : assets)
+    {
+        AssetPackEntry entry;
+        entry.nameHash = HashBytes(asset.name.data(), asset.name.size());
+        entry.offset = 0;
+        entry.size = asset.data.size();
+        entry.type = asset.type;
+        memcpy(entry.params, asset.params, sizeof(entry.params));
+        entry.reserved = 0;
+        if (!IsValid(entry))
+            throw std::runtime_error{ "Asset " + asset.name + " doesn't match its description" };
+        entries.push_back(entry);
+    }
+
+    // Data goes in the original order, so assets that are loaded together stay together
+    auto dataStart = IndexedFile<AssetPackEntry>::GetIndexEnd(entries.size());
+    dataStart = (dataStart + Alignment - 1) / Alignment * Alignment;
+    std::vector<uint8_t> data((size_t)dataStart);
+    for (size_t i = 0; i < assets.size(); ++i)
+    {
+        entries[i].offset = data.size();
+        data.insert(data.end(), assets[i].data.begin(), assets[i].data.end());
+        data.resize((data.size() + Alignment - 1) / Alignment * Alignment);
+    }
+
+    return IndexedFile<AssetPackEntry>::Write(path, "Asset pack", PackMagic, PackVersion, std::move(entries), data);
+}
+
+bool AssetPack::IsValid(const AssetPackEntry &entry)
+{
+    // An empty asset has nothing to upload
+    if (entry.size == 0)
+        return false;
+
+    if (entry.type == AssetType::Mesh)
+    {
+        auto indexSize = entry.params[3];
+        if (entry.params[1] == 0 || (indexSize != 2 && indexSize != 4))
+            return false;
+        return GetIndexOffset(entry) + (uint64_t)entry.params[2] * indexSize <= entry.size;
+    }
+
+    if (entry.type == AssetType::Texture)
+    {
+        uint32_t blockBytes, blockDim;
+        auto format = (vk::Format)entry.params[3];
+        if (entry.params[0] == 0 || entry.params[1] == 0 || !GetFormatBlock(format, blockBytes, blockDim))
+            return false;
+
+        // No more levels than it takes to get down to 1x1
+        uint32_t maxMips = 1;
+        for (auto size = std::max(entry.params[0], entry.params[1]); size > 1; size /= 2)
+            ++maxMips;
+        if (entry.params[2] == 0 || entry.params[2] > maxMips)
+            return false;
+        return GetTextureLayout(format, entry.params[0], entry.params[1], entry.params[2]).totalSize <= entry.size;
+    }
+
+    return false;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "IndexedFile.h"
+#include <vulkan/vk_cpp.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+enum class AssetType : uint32_t
+{
+    Mesh,
+    Texture,
+};
+
+// On disk a pack is an IndexedFile of these. Every asset starts on a page
+// boundary so reading one only touches its own pages of the mapping.
+//
+// Mesh data is the vertices followed by the indices, which start on a 4 byte
+// boundary. Texture data is each mip level in turn, largest first, every level
+// starting on a 16 byte boundary.
+struct AssetPackEntry
+{
+    uint64_t nameHash;
+    // From the start of the file
+    uint64_t offset;
+    uint64_t size;
+    AssetType type;
+    // Mesh: vertex count, vertex stride, index count, index size (2 or 4)
+    // Texture: width, height, mip count, vk::Format
+    uint32_t params[4];
+    uint32_t reserved;
+};
+
+struct AssetSource
+{
+    std::string name;
+    AssetType type;
+    uint32_t params[4];
+    std::vector<uint8_t> data;
+};
+
+// Where each mip level of a packed texture lives, relative to the asset
+struct TextureLayout
+{
+    std::vector<vk::DeviceSize> offsets;
+    std::vector<vk::DeviceSize> sizes;
+    vk::DeviceSize totalSize;
+};
+
+// A memory mapped asset pack. The index is checked once when it's opened,
+// after that lookups are read only and safe from any thread.
+class AssetPack
+{
+public:
+    static const uint64_t Alignment = 4096;
+
+    // Returns false if the file is missing or malformed
+    bool Open(const std::string &path);
+    void Close();
+
+    bool IsOpen() const;
+    // Null if the pack has nothing by that name
+    const AssetPackEntry *Find(const std::string &name) const;
+    const uint8_t *GetData(const AssetPackEntry &entry) const;
+    uint32_t GetAssetCount() const;
+
+    // Offset of the indices within a mesh
+    static vk::DeviceSize GetIndexOffset(const AssetPackEntry &entry);
+    // Throws for formats the pack doesn't know the block size of
+    static TextureLayout GetTextureLayout(vk::Format format, uint32_t width, uint32_t height, uint32_t mipCount);
+
+    // Build a pack out of loose assets, e.g. from a build step
+    static bool Pack(const std::string &path, const std::vector<AssetSource> &assets);
+
+private:
+    static bool IsValid(const AssetPackEntry &entry);
+
+    IndexedFile<AssetPackEntry> index;
+};
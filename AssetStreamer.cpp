@@ -0,0 +1,424 @@
+#include "AssetStreamer.h"
+#include "Log.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+AssetStreamer::AssetStreamer()
+    : allocator(nullptr), transfers(nullptr), stagingSize(0), frameBudget(0), bytesThisFrame(0), readyCount(0),
+    ioQuit(false)
+{
+}
+
+AssetStreamer::~AssetStreamer()
+{
+    Destroy();
+}
+
+void AssetStreamer::Init(
+    vk::Device device,
+    MemoryAllocator *allocator,
+    UploadContext *transfers,
+    vk::DeviceSize stagingSize,
+    vk::DeviceSize frameBudget,
+    uint32_t ioThreads)
+{
+    this->device = device;
+    this->allocator = allocator;
+    this->transfers = transfers;
+    this->stagingSize = stagingSize;
+    this->frameBudget = frameBudget;
+
+    // The ring is the only staging memory, so streaming never grows past it
+    auto bufferInfo = vk::BufferCreateInfo()
+        .setSize(stagingSize)
+        .setUsage(vk::BufferUsageFlagBits::eTransferSrc)
+        .setSharingMode(vk::SharingMode::eExclusive);
+    stagingBuffer = device.createBuffer(bufferInfo);
+    stagingMem = allocator->AllocateBuffer(
+        stagingBuffer,
+        vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent
+    );
+
+    ioQuit = false;
+    for (uint32_t i = 0; i < std::max(ioThreads, 1u); ++i)
+        this->ioThreads.emplace_back(&AssetStreamer::IoMain, this);
+}
+
+void AssetStreamer::Destroy()
+{
+    if (!stagingBuffer)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock{ ioMutex };
+        ioQuit = true;
+    }
+    ioWake.notify_all();
+    for (auto &thread : ioThreads)
+        thread.join();
+    ioThreads.clear();
+    reads.clear();
+    readsDone.clear();
+
+    // The copies read from the ring and write the assets
+    std::lock_guard<std::mutex> lock{ mutex };
+    if (!uploading.empty())
+        transfers->Wait(transfers->Flush());
+    uploading.clear();
+
+    for (auto &asset : assets)
+        FreeAsset(asset);
+    assets.clear();
+    names.clear();
+    requests.clear();
+    staging.clear();
+    readyCount = 0;
+
+    device.destroyBuffer(stagingBuffer);
+    allocator->Free(stagingMem);
+    stagingBuffer = nullptr;
+    pack.Close();
+}
+
+bool AssetStreamer::Open(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock{ mutex };
+    if (!assets.empty())
+        throw std::runtime_error{ "Asset pack can't change once assets have been requested" };
+    return pack.Open(path);
+}
+
+bool AssetStreamer::HasPack() const
+{
+    return pack.IsOpen();
+}
+
+uint32_t AssetStreamer::GetAssetCount() const
+{
+    return pack.GetAssetCount();
+}
+
+AssetHandle AssetStreamer::Request(const std::string &name)
+{
+    std::lock_guard<std::mutex> lock{ mutex };
+    auto found = names.find(name);
+    if (found != names.end())
+        return found->second;
+
+    Asset asset = {};
+    asset.entry = pack.IsOpen() ? pack.Find(name) : nullptr;
+    asset.state = asset.entry ? AssetState::Queued : AssetState::Failed;
+    if (!asset.entry)
+        Log("Asset " + name + " isn't in the asset pack");
+
+    auto handle = (AssetHandle)assets.size();
+    assets.push_back(asset);
+    names[name] = handle;
+    if (asset.entry)
+        requests.push_back(handle);
+    return handle;
+}
+
+AssetState AssetStreamer::GetState(AssetHandle handle)
+{
+    std::lock_guard<std::mutex> lock{ mutex };
+    if (handle >= assets.size())
+        throw std::runtime_error{ "Invalid asset handle" };
+    return assets[handle].state;
+}
+
+const StreamedMesh *AssetStreamer::GetMesh(AssetHandle handle)
+{
+    std::lock_guard<std::mutex> lock{ mutex };
+    if (handle >= assets.size())
+        throw std::runtime_error{ "Invalid asset handle" };
+
+    auto &asset = assets[handle];
+    bool ready = asset.state == AssetState::Ready && asset.entry->type == AssetType::Mesh;
+    return ready ? &asset.mesh : nullptr;
+}
+
+const StreamedTexture *AssetStreamer::GetTexture(AssetHandle handle)
+{
+    std::lock_guard<std::mutex> lock{ mutex };
+    if (handle >= assets.size())
+        throw std::runtime_error{ "Invalid asset handle" };
+
+    auto &asset = assets[handle];
+    bool ready = asset.state == AssetState::Ready && asset.entry->type == AssetType::Texture;
+    return ready ? &asset.texture : nullptr;
+}
+
+void AssetStreamer::Update()
+{
+    if (!stagingBuffer)
+        return;
+
+    std::lock_guard<std::mutex> lock{ mutex };
+    bytesThisFrame = 0;
+
+    // Copies that completed are usable, the graphics queue acquired them when they were flushed
+    uploading.erase(
+        std::remove_if(uploading.begin(), uploading.end(), [this](AssetHandle handle)
+        {
+            auto &asset = assets[handle];
+            if (!transfers->IsComplete(asset.ticket))
+                return false;
+            asset.state = AssetState::Ready;
+            ++readyCount;
+            return true;
+        }),
+        uploading.end()
+    );
+
+    // The ring is freed in the order it was handed out
+    while (!staging.empty() && assets[staging.front().handle].state == AssetState::Ready)
+        staging.pop_front();
+
+    // Reads that finished get their copies recorded into the pending transfer batch
+    std::vector<AssetHandle> done;
+    {
+        std::lock_guard<std::mutex> ioLock{ ioMutex };
+        done.swap(readsDone);
+    }
+    for (auto handle : done)
+    {
+        RecordCopy(assets[handle]);
+        uploading.push_back(handle);
+    }
+
+    // Start reading the oldest requests that fit in the ring and this frame's budget.
+    // The first one always goes so an asset bigger than the budget still loads.
+    std::vector<ReadJob> jobs;
+    while (!requests.empty())
+    {
+        auto handle = requests.front();
+        auto &asset = assets[handle];
+        auto size = asset.entry->size;
+        if (size > stagingSize)
+        {
+            Log("Asset is bigger than the streaming staging ring");
+            asset.state = AssetState::Failed;
+            requests.pop_front();
+            continue;
+        }
+
+        vk::DeviceSize offset;
+        if (bytesThisFrame > 0 && bytesThisFrame + size > frameBudget)
+            break;
+        if (!AllocateStaging(size, handle, offset))
+            break;
+
+        CreateResource(asset);
+        asset.state = AssetState::Reading;
+        asset.stagingOffset = offset;
+        jobs.push_back(ReadJob{ handle, pack.GetData(*asset.entry), stagingMem.mapped + offset, (size_t)size });
+        bytesThisFrame += size;
+        requests.pop_front();
+    }
+
+    if (!jobs.empty())
+    {
+        {
+            std::lock_guard<std::mutex> ioLock{ ioMutex };
+            reads.insert(reads.end(), jobs.begin(), jobs.end());
+        }
+        ioWake.notify_all();
+    }
+}
+
+AssetStreamerStats AssetStreamer::GetStats()
+{
+    std::lock_guard<std::mutex> lock{ mutex };
+    AssetStreamerStats stats;
+    stats.queued = (uint32_t)requests.size();
+    stats.ready = readyCount;
+    for (auto &asset : assets)
+    {
+        if (asset.state == AssetState::Reading || asset.state == AssetState::Uploading)
+            ++stats.inFlight;
+    }
+    for (auto &region : staging)
+        stats.stagingUsed += region.end - region.begin;
+    stats.bytesThisFrame = bytesThisFrame;
+    return stats;
+}
+
+void AssetStreamer::IoMain()
+{
+    while (true)
+    {
+        ReadJob job;
+        {
+            std::unique_lock<std::mutex> lock{ ioMutex };
+            ioWake.wait(lock, [this]() { return ioQuit || !reads.empty(); });
+            if (ioQuit)
+                return;
+            job = reads.front();
+            reads.pop_front();
+        }
+
+        // Page faults on the mapping are taken here instead of on the frame loop
+        memcpy(job.dst, job.src, job.size);
+
+        std::lock_guard<std::mutex> lock{ ioMutex };
+        readsDone.push_back(job.handle);
+    }
+}
+
+bool AssetStreamer::AllocateStaging(vk::DeviceSize size, AssetHandle handle, vk::DeviceSize &offset)
+{
+    // Copies out of the ring are 16 byte aligned, which covers texel blocks too
+    if (staging.empty())
+    {
+        offset = 0;
+    }
+    else
+    {
+        auto tail = staging.front().begin;
+        auto head = (staging.back().end + 15) / 16 * 16;
+        if (staging.back().begin >= tail)
+        {
+            // Free space is after the head and before the tail, wrap if the end is too small
+            if (head + size <= stagingSize)
+                offset = head;
+            else if (size <= tail)
+                offset = 0;
+            else
+                return false;
+        }
+        else if (head + size <= tail)
+        {
+            offset = head;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    staging.push_back(StagingRegion{ offset, offset + size, handle });
+    return true;
+}
+
+void AssetStreamer::CreateResource(Asset &asset)
+{
+    auto &entry = *asset.entry;
+    if (entry.type == AssetType::Mesh)
+    {
+        auto bufferInfo = vk::BufferCreateInfo()
+            .setSize(entry.size)
+            .setUsage(
+                vk::BufferUsageFlagBits::eVertexBuffer |
+                vk::BufferUsageFlagBits::eIndexBuffer |
+                vk::BufferUsageFlagBits::eStorageBuffer |
+                vk::BufferUsageFlagBits::eTransferDst
+            )
+            .setSharingMode(vk::SharingMode::eExclusive);
+
+        auto &mesh = asset.mesh;
+        mesh.buffer = device.createBuffer(bufferInfo);
+        asset.mem = allocator->AllocateBuffer(mesh.buffer, vk::MemoryPropertyFlagBits::eDeviceLocal);
+        mesh.vertexCount = entry.params[0];
+        mesh.vertexStride = entry.params[1];
+        mesh.indexCount = entry.params[2];
+        mesh.indexType = entry.params[3] == 2 ? vk::IndexType::eUint16 : vk::IndexType::eUint32;
+        mesh.indexOffset = AssetPack::GetIndexOffset(entry);
+        return;
+    }
+
+    auto &texture = asset.texture;
+    texture.format = (vk::Format)entry.params[3];
+    texture.extent = vk::Extent2D(entry.params[0], entry.params[1]);
+    texture.mipCount = entry.params[2];
+
+    auto imageInfo = vk::ImageCreateInfo()
+        .setImageType(vk::ImageType::e2D)
+        .setFormat(texture.format)
+        .setExtent({ texture.extent.width, texture.extent.height, 1 })
+        .setMipLevels(texture.mipCount)
+        .setArrayLayers(1)
+        .setSamples(vk::SampleCountFlagBits::e1)
+        .setTiling(vk::ImageTiling::eOptimal)
+        .setUsage(vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst);
+    texture.image = device.createImage(imageInfo);
+    asset.mem = allocator->AllocateImage(texture.image, vk::MemoryPropertyFlagBits::eDeviceLocal);
+
+    auto viewInfo = vk::ImageViewCreateInfo()
+        .setViewType(vk::ImageViewType::e2D)
+        .setFormat(texture.format)
+        .setSubresourceRange(vk::ImageSubresourceRange()
+            .setAspectMask(vk::ImageAspectFlagBits::eColor)
+            .setLevelCount(texture.mipCount)
+            .setLayerCount(1))
+        .setImage(texture.image);
+    texture.view = device.createImageView(viewInfo);
+}
+
+void AssetStreamer::RecordCopy(Asset &asset)
+{
+    auto &entry = *asset.entry;
+    if (entry.type == AssetType::Mesh)
+    {
+        transfers->CopyBuffer(
+            stagingBuffer,
+            asset.stagingOffset,
+            asset.mesh.buffer,
+            0,
+            entry.size,
+            vk::PipelineStageFlagBits::eVertexInput | vk::PipelineStageFlagBits::eVertexShader | vk::PipelineStageFlagBits::eComputeShader,
+            vk::AccessFlagBits::eVertexAttributeRead | vk::AccessFlagBits::eIndexRead | vk::AccessFlagBits::eShaderRead
+        );
+    }
+    else
+    {
+        auto &texture = asset.texture;
+        auto layout = AssetPack::GetTextureLayout(texture.format, texture.extent.width, texture.extent.height, texture.mipCount);
+
+        std::vector<vk::BufferImageCopy> regions;
+        for (uint32_t level = 0; level < texture.mipCount; ++level)
+        {
+            regions.push_back(vk::BufferImageCopy()
+                .setBufferOffset(asset.stagingOffset + layout.offsets[level])
+                .setImageSubresource(vk::ImageSubresourceLayers()
+                    .setAspectMask(vk::ImageAspectFlagBits::eColor)
+                    .setMipLevel(level)
+                    .setLayerCount(1))
+                .setImageExtent({
+                    std::max(texture.extent.width >> level, 1u),
+                    std::max(texture.extent.height >> level, 1u),
+                    1
+                }));
+        }
+
+        transfers->CopyImage(
+            stagingBuffer,
+            texture.image,
+            vk::ImageAspectFlagBits::eColor,
+            texture.mipCount,
+            regions,
+            ImageState::ShaderRead(vk::PipelineStageFlagBits::eFragmentShader | vk::PipelineStageFlagBits::eComputeShader)
+        );
+    }
+
+    asset.state = AssetState::Uploading;
+    asset.ticket = transfers->GetPendingTicket();
+}
+
+void AssetStreamer::FreeAsset(Asset &asset)
+{
+    if (!asset.mem.memory)
+        return;
+
+    if (asset.entry->type == AssetType::Mesh)
+    {
+        device.destroyBuffer(asset.mesh.buffer);
+    }
+    else
+    {
+        device.destroyImageView(asset.texture.view);
+        device.destroyImage(asset.texture.image);
+    }
+    allocator->Free(asset.mem);
+}
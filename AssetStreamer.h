@@ -0,0 +1,160 @@
+#pragma once
+
+#include "AssetPack.h"
+#include "MemoryAllocator.h"
+#include "UploadContext.h"
+#include <vulkan/vk_cpp.h>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+typedef uint32_t AssetHandle;
+
+static const AssetHandle InvalidAsset = UINT32_MAX;
+
+enum class AssetState
+{
+    // Waiting for room in the staging ring or the frame budget
+    Queued,
+    // Being read into the staging ring
+    Reading,
+    // Copy recorded on the transfer queue
+    Uploading,
+    Ready,
+    Failed,
+};
+
+struct StreamedMesh
+{
+    vk::Buffer buffer;
+    vk::DeviceSize indexOffset;
+    uint32_t vertexCount;
+    uint32_t vertexStride;
+    uint32_t indexCount;
+    vk::IndexType indexType;
+};
+
+struct StreamedTexture
+{
+    vk::Image image;
+    vk::ImageView view;
+    vk::Format format;
+    vk::Extent2D extent;
+    uint32_t mipCount;
+};
+
+struct AssetStreamerStats
+{
+    uint32_t queued = 0;
+    uint32_t inFlight = 0;
+    uint32_t ready = 0;
+    vk::DeviceSize stagingUsed = 0;
+    vk::DeviceSize bytesThisFrame = 0;
+};
+
+// Streams meshes and textures out of an asset pack while frames are rendered.
+// I/O threads read assets out of the mapping into a fixed size staging ring,
+// and Update records the copies into device local memory on the transfer
+// queue. Assets start loading in the order they were requested, limited to a
+// budget of bytes per frame, and nothing ever waits on the GPU or the disk.
+class AssetStreamer
+{
+public:
+    AssetStreamer();
+    ~AssetStreamer();
+
+    void Init(
+        vk::Device device,
+        MemoryAllocator *allocator,
+        UploadContext *transfers,
+        vk::DeviceSize stagingSize,
+        vk::DeviceSize frameBudget,
+        uint32_t ioThreads = 1
+    );
+    // Waits for uploads in flight, then frees every asset
+    void Destroy();
+
+    // Returns false if the pack is missing or malformed
+    bool Open(const std::string &path);
+    bool HasPack() const;
+    uint32_t GetAssetCount() const;
+
+    // Queue an asset, asking again for the same name returns the same handle.
+    // Safe from any thread.
+    AssetHandle Request(const std::string &name);
+    AssetState GetState(AssetHandle handle);
+    // Null until the asset is ready or if it isn't that type
+    const StreamedMesh *GetMesh(AssetHandle handle);
+    const StreamedTexture *GetTexture(AssetHandle handle);
+
+    // Call once per frame, before the transfer queue's batch is flushed
+    void Update();
+
+    AssetStreamerStats GetStats();
+
+private:
+    struct Asset
+    {
+        const AssetPackEntry *entry;
+        AssetState state;
+        Allocation mem;
+        StreamedMesh mesh;
+        StreamedTexture texture;
+        vk::DeviceSize stagingOffset;
+        UploadTicket ticket;
+    };
+
+    struct ReadJob
+    {
+        AssetHandle handle;
+        const uint8_t *src;
+        uint8_t *dst;
+        size_t size;
+    };
+
+    // A piece of the staging ring, released in order once its asset's copy completes
+    struct StagingRegion
+    {
+        vk::DeviceSize begin;
+        vk::DeviceSize end;
+        AssetHandle handle;
+    };
+
+    void IoMain();
+    bool AllocateStaging(vk::DeviceSize size, AssetHandle handle, vk::DeviceSize &offset);
+    void CreateResource(Asset &asset);
+    void RecordCopy(Asset &asset);
+    void FreeAsset(Asset &asset);
+
+    vk::Device device;
+    MemoryAllocator *allocator;
+    UploadContext *transfers;
+    AssetPack pack;
+
+    vk::Buffer stagingBuffer;
+    Allocation stagingMem;
+    vk::DeviceSize stagingSize;
+    std::deque<StagingRegion> staging;
+    vk::DeviceSize frameBudget;
+    vk::DeviceSize bytesThisFrame;
+
+    // Guards everything below. A deque so pointers handed out stay valid as assets are added.
+    std::mutex mutex;
+    std::deque<Asset> assets;
+    std::unordered_map<std::string, AssetHandle> names;
+    std::deque<AssetHandle> requests;
+    std::vector<AssetHandle> uploading;
+    uint32_t readyCount;
+
+    std::vector<std::thread> ioThreads;
+    std::mutex ioMutex;
+    std::condition_variable ioWake;
+    std::deque<ReadJob> reads;
+    std::vector<AssetHandle> readsDone;
+    bool ioQuit;
+};
@@ -0,0 +1,126 @@
+#include "VkApp.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Constructs and destroys a headless VkApp over and over and reports startup
+// time percentiles as JSON on stdout. Usage: vulkan-bench [iterations]
+//
+// Each iteration starts once with no pipeline cache and once more with the
+// cache the first start saved, so cold and warm starts are reported apart.
+// The cache lives in a throwaway file so the app's own cache is never touched.
+
+static const char *BenchCachePath = "vulkan-bench-cache.bin";
+
+struct Samples
+{
+    std::vector<double> totals;
+    std::vector<double> completes;
+    std::vector<double> teardowns;
+    std::vector<std::string> stageOrder;
+    std::map<std::string, std::vector<double>> stages;
+};
+
+struct Percentiles
+{
+    double min;
+    double median;
+    double p99;
+};
+
+static Percentiles GetPercentiles(std::vector<double> samples)
+{
+    std::sort(samples.begin(), samples.end());
+    auto at = [&samples](double p)
+    {
+        auto index = (size_t)(p * (samples.size() - 1) + 0.5);
+        return samples[index];
+    };
+    return Percentiles{ samples.front(), at(0.5), at(0.99) };
+}
+
+static void WritePercentiles(std::ostream &out, const std::vector<double> &samples)
+{
+    auto p = GetPercentiles(samples);
+    out << "{\"min_ms\":" << p.min << ",\"median_ms\":" << p.median << ",\"p99_ms\":" << p.p99 << "}";
+}
+
+static void RunOnce(const VkAppConfig &config, Samples &samples)
+{
+    auto start = std::chrono::steady_clock::now();
+    auto app = std::make_unique<VkApp>(config);
+    auto constructed = std::chrono::steady_clock::now();
+
+    // Background stages are part of the stage breakdown but not the startup time
+    app->WaitForStartup();
+    auto settled = std::chrono::steady_clock::now();
+
+    for (auto &timing : app->GetStartupTimer().GetTimings())
+    {
+        if (samples.stages.find(timing.name) == samples.stages.end())
+            samples.stageOrder.push_back(timing.name);
+        samples.stages[timing.name].push_back(timing.durationMs);
+    }
+
+    // Saves the pipeline cache the next start reads
+    app.reset();
+    auto destroyed = std::chrono::steady_clock::now();
+
+    samples.totals.push_back(std::chrono::duration<double, std::milli>(constructed - start).count());
+    samples.completes.push_back(std::chrono::duration<double, std::milli>(settled - start).count());
+    samples.teardowns.push_back(std::chrono::duration<double, std::milli>(destroyed - settled).count());
+}
+
+static void WriteSamples(std::ostream &out, Samples &samples)
+{
+    out << "{\"startup\":";
+    WritePercentiles(out, samples.totals);
+    out << ",\"startup_complete\":";
+    WritePercentiles(out, samples.completes);
+    out << ",\"teardown\":";
+    WritePercentiles(out, samples.teardowns);
+    out << ",\"stages\":{";
+    for (size_t i = 0; i < samples.stageOrder.size(); ++i)
+    {
+        if (i > 0)
+            out << ",";
+        out << "\"" << samples.stageOrder[i] << "\":";
+        WritePercentiles(out, samples.stages[samples.stageOrder[i]]);
+    }
+    out << "}}";
+}
+
+int main(int argc, char **argv)
+{
+    auto iterations = argc > 1 ? std::max(1, atoi(argv[1])) : 20;
+
+    VkAppConfig config;
+    config.headless = true;
+    config.pipelineCachePath = BenchCachePath;
+
+    Samples cold;
+    Samples warm;
+    for (int i = 0; i < iterations; ++i)
+    {
+        std::remove(BenchCachePath);
+        RunOnce(config, cold);
+        RunOnce(config, warm);
+    }
+    std::remove(BenchCachePath);
+
+    std::ostringstream json;
+    json << "{\"iterations\":" << iterations << ",\"cold\":";
+    WriteSamples(json, cold);
+    json << ",\"warm\":";
+    WriteSamples(json, warm);
+    json << "}";
+
+    std::cout << json.str() << std::endl;
+    return 0;
+}
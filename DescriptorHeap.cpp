@@ -0,0 +1,399 @@
+#include "DescriptorHeap.h"
+#include <algorithm>
+#include <stdexcept>
+
+DescriptorHeap::DescriptorHeap()
+    : bindless(false), frameCount(0), frame(0), hasDefaults(false)
+{
+}
+
+DescriptorHeap::~DescriptorHeap()
+{
+    Destroy();
+}
+
+void DescriptorHeap::Init(vk::Device device, const DescriptorHeapLimits &limits, uint32_t frameCount, uint32_t textureCount, uint32_t bufferCount)
+{
+    this->device = device;
+    this->frameCount = frameCount;
+    bindless = limits.updateAfterBind;
+    frame = 0;
+
+    textures.type = vk::DescriptorType::eCombinedImageSampler;
+    textures.binding = TextureBinding;
+    textures.capacity = std::max(std::min(textureCount, limits.maxTextures), 1u);
+    textures.next = 0;
+    textures.retired.resize(frameCount);
+
+    buffers.type = vk::DescriptorType::eStorageBuffer;
+    buffers.binding = BufferBinding;
+    buffers.capacity = std::max(std::min(bufferCount, limits.maxBuffers), 1u);
+    buffers.next = 0;
+    buffers.retired.resize(frameCount);
+
+    CreateLayout(bindless);
+    CreateSets(bindless);
+
+    transientPools.resize(frameCount);
+    transientPoolIndex.assign(frameCount, 0);
+}
+
+void DescriptorHeap::Destroy()
+{
+    if (!layout)
+        return;
+
+    for (auto &framePools : transientPools)
+    {
+        for (auto transientPool : framePools)
+            device.destroyDescriptorPool(transientPool);
+    }
+    transientPools.clear();
+
+    // Sets go away with their pool
+    device.destroyDescriptorPool(pool);
+    device.destroyDescriptorSetLayout(layout);
+    sets.clear();
+    pending.clear();
+    layout = nullptr;
+    pool = nullptr;
+}
+
+void DescriptorHeap::SetDefaults(const vk::DescriptorImageInfo &texture, const vk::DescriptorBufferInfo &buffer)
+{
+    std::lock_guard<std::mutex> lock{ mutex };
+    defaultTexture = texture;
+    defaultBuffer = buffer;
+    hasDefaults = true;
+
+    // Everything that isn't in use yet, including slots never handed out
+    std::vector<bool> used(textures.capacity, false);
+    for (uint32_t slot = 0; slot < textures.next; ++slot)
+        used[slot] = true;
+    for (auto slot : textures.free)
+        used[slot] = false;
+    for (uint32_t slot = 0; slot < textures.capacity; ++slot)
+    {
+        if (!used[slot])
+            WriteDefault(TextureBinding, slot);
+    }
+
+    used.assign(buffers.capacity, false);
+    for (uint32_t slot = 0; slot < buffers.next; ++slot)
+        used[slot] = true;
+    for (auto slot : buffers.free)
+        used[slot] = false;
+    for (uint32_t slot = 0; slot < buffers.capacity; ++slot)
+    {
+        if (!used[slot])
+            WriteDefault(BufferBinding, slot);
+    }
+}
+
+DescriptorHandle DescriptorHeap::AddTexture(const vk::DescriptorImageInfo &info)
+{
+    std::lock_guard<std::mutex> lock{ mutex };
+    auto handle = Allocate(textures);
+    Write(TextureBinding, handle, &info, nullptr);
+    return handle;
+}
+
+DescriptorHandle DescriptorHeap::AddBuffer(const vk::DescriptorBufferInfo &info)
+{
+    std::lock_guard<std::mutex> lock{ mutex };
+    auto handle = Allocate(buffers);
+    Write(BufferBinding, handle, nullptr, &info);
+    return handle;
+}
+
+void DescriptorHeap::UpdateTexture(DescriptorHandle handle, const vk::DescriptorImageInfo &info)
+{
+    std::lock_guard<std::mutex> lock{ mutex };
+    Write(TextureBinding, handle, &info, nullptr);
+}
+
+void DescriptorHeap::UpdateBuffer(DescriptorHandle handle, const vk::DescriptorBufferInfo &info)
+{
+    std::lock_guard<std::mutex> lock{ mutex };
+    Write(BufferBinding, handle, nullptr, &info);
+}
+
+void DescriptorHeap::FreeTexture(DescriptorHandle handle)
+{
+    std::lock_guard<std::mutex> lock{ mutex };
+    Free(textures, handle);
+}
+
+void DescriptorHeap::FreeBuffer(DescriptorHandle handle)
+{
+    std::lock_guard<std::mutex> lock{ mutex };
+    Free(buffers, handle);
+}
+
+void DescriptorHeap::BeginFrame(uint32_t frame)
+{
+    std::lock_guard<std::mutex> lock{ mutex };
+    this->frame = frame;
+
+    // Slots freed the last time this frame was recorded can't be read any more
+    for (auto slots : { &textures, &buffers })
+    {
+        auto &retired = slots->retired[frame];
+        for (auto slot : retired)
+        {
+            if (hasDefaults)
+                WriteDefault(slots->binding, slot);
+            slots->free.push_back(slot);
+        }
+        retired.clear();
+    }
+
+    // Classic sets are only written once their frame is done with them
+    if (!bindless && !pending.empty())
+    {
+        std::vector<vk::WriteDescriptorSet> writes;
+        for (auto &write : pending)
+        {
+            if (!(write.frameMask & (1 << frame)))
+                continue;
+
+            bool image = write.binding == TextureBinding;
+            writes.push_back(vk::WriteDescriptorSet()
+                .setDstSet(sets[frame])
+                .setDstBinding(write.binding)
+                .setDstArrayElement(write.slot)
+                .setDescriptorCount(1)
+                .setDescriptorType(image ? textures.type : buffers.type)
+                .setPImageInfo(image ? &write.image : nullptr)
+                .setPBufferInfo(image ? nullptr : &write.buffer));
+            write.frameMask &= ~(1 << frame);
+        }
+        if (!writes.empty())
+            device.updateDescriptorSets(writes, nullptr);
+
+        pending.erase(
+            std::remove_if(pending.begin(), pending.end(), [](const PendingWrite &write) { return write.frameMask == 0; }),
+            pending.end()
+        );
+    }
+
+    for (auto framePool : transientPools[frame])
+        device.resetDescriptorPool(framePool, vk::DescriptorPoolResetFlags());
+    transientPoolIndex[frame] = 0;
+}
+
+bool DescriptorHeap::IsBindless() const
+{
+    return bindless;
+}
+
+vk::DescriptorSetLayout DescriptorHeap::GetLayout() const
+{
+    return layout;
+}
+
+vk::DescriptorSet DescriptorHeap::GetSet() const
+{
+    return sets[bindless ? 0 : frame];
+}
+
+vk::DescriptorSet DescriptorHeap::AllocateTransient(vk::DescriptorSetLayout setLayout)
+{
+    std::lock_guard<std::mutex> lock{ mutex };
+
+    // Move on to the next pool when one is full
+    auto &framePools = transientPools[frame];
+    auto &index = transientPoolIndex[frame];
+    while (true)
+    {
+        if (index == framePools.size())
+            framePools.push_back(CreateTransientPool());
+
+        auto allocateInfo = vk::DescriptorSetAllocateInfo()
+            .setDescriptorPool(framePools[index])
+            .setDescriptorSetCount(1)
+            .setPSetLayouts(&setLayout);
+
+        vk::DescriptorSet set;
+        auto result = device.allocateDescriptorSets(&allocateInfo, &set);
+        if (result == vk::Result::eSuccess)
+            return set;
+        if (result != vk::Result::eErrorOutOfPoolMemory && result != vk::Result::eErrorFragmentedPool)
+            throw std::runtime_error{ "Failed to allocate a transient descriptor set" };
+        ++index;
+    }
+}
+
+void DescriptorHeap::CreateLayout(bool updateAfterBind)
+{
+    vk::DescriptorSetLayoutBinding bindings[2] =
+    {
+        vk::DescriptorSetLayoutBinding()
+            .setBinding(TextureBinding)
+            .setDescriptorType(textures.type)
+            .setDescriptorCount(textures.capacity)
+            .setStageFlags(vk::ShaderStageFlagBits::eAll),
+        vk::DescriptorSetLayoutBinding()
+            .setBinding(BufferBinding)
+            .setDescriptorType(buffers.type)
+            .setDescriptorCount(buffers.capacity)
+            .setStageFlags(vk::ShaderStageFlagBits::eAll),
+    };
+
+    auto layoutInfo = vk::DescriptorSetLayoutCreateInfo()
+        .setBindingCount(2)
+        .setPBindings(bindings);
+
+#ifdef VK_EXT_descriptor_indexing
+    if (updateAfterBind)
+    {
+        // Slots nothing uses yet may be left empty, and slots may be written while the set is bound
+        VkDescriptorBindingFlagsEXT bindingFlags[2] =
+        {
+            VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT,
+            VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT,
+        };
+        VkDescriptorSetLayoutBindingFlagsCreateInfoEXT flagsInfo = {};
+        flagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+        flagsInfo.bindingCount = 2;
+        flagsInfo.pBindingFlags = bindingFlags;
+
+        VkDescriptorSetLayoutCreateInfo createInfo = layoutInfo;
+        createInfo.pNext = &flagsInfo;
+        createInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT;
+
+        VkDescriptorSetLayout createdLayout;
+        if (vkCreateDescriptorSetLayout((VkDevice)device, &createInfo, nullptr, &createdLayout) != VK_SUCCESS)
+            throw std::runtime_error{ "Failed to create the bindless descriptor set layout" };
+        layout = vk::DescriptorSetLayout(createdLayout);
+        return;
+    }
+#endif
+
+    layout = device.createDescriptorSetLayout(layoutInfo);
+}
+
+void DescriptorHeap::CreateSets(bool updateAfterBind)
+{
+    auto setCount = updateAfterBind ? 1 : frameCount;
+    vk::DescriptorPoolSize poolSizes[2] =
+    {
+        vk::DescriptorPoolSize(textures.type, textures.capacity * setCount),
+        vk::DescriptorPoolSize(buffers.type, buffers.capacity * setCount),
+    };
+
+    auto poolInfo = vk::DescriptorPoolCreateInfo()
+        .setMaxSets(setCount)
+        .setPoolSizeCount(2)
+        .setPPoolSizes(poolSizes);
+
+#ifdef VK_EXT_descriptor_indexing
+    if (updateAfterBind)
+    {
+        VkDescriptorPoolCreateInfo createInfo = poolInfo;
+        createInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT;
+
+        VkDescriptorPool createdPool;
+        if (vkCreateDescriptorPool((VkDevice)device, &createInfo, nullptr, &createdPool) != VK_SUCCESS)
+            throw std::runtime_error{ "Failed to create the bindless descriptor pool" };
+        pool = vk::DescriptorPool(createdPool);
+    }
+    else
+#endif
+    {
+        pool = device.createDescriptorPool(poolInfo);
+    }
+
+    std::vector<vk::DescriptorSetLayout> layouts(setCount, layout);
+    sets = device.allocateDescriptorSets(vk::DescriptorSetAllocateInfo()
+        .setDescriptorPool(pool)
+        .setDescriptorSetCount(setCount)
+        .setPSetLayouts(layouts.data()));
+}
+
+DescriptorHandle DescriptorHeap::Allocate(SlotArray &slots)
+{
+    // Reuse freed slots first so the arrays stay dense
+    if (!slots.free.empty())
+    {
+        auto slot = slots.free.back();
+        slots.free.pop_back();
+        return slot;
+    }
+
+    if (slots.next == slots.capacity)
+        throw std::runtime_error{ "Descriptor heap is full" };
+    return slots.next++;
+}
+
+void DescriptorHeap::Free(SlotArray &slots, DescriptorHandle handle)
+{
+    if (handle >= slots.next)
+        throw std::runtime_error{ "Invalid descriptor handle" };
+    slots.retired[frame].push_back(handle);
+}
+
+void DescriptorHeap::Write(uint32_t binding, uint32_t slot, const vk::DescriptorImageInfo *image, const vk::DescriptorBufferInfo *buffer)
+{
+    if (bindless)
+    {
+        // Update-after-bind, the slot isn't in use by anything in flight
+        auto write = vk::WriteDescriptorSet()
+            .setDstSet(sets[0])
+            .setDstBinding(binding)
+            .setDstArrayElement(slot)
+            .setDescriptorCount(1)
+            .setDescriptorType(image ? textures.type : buffers.type)
+            .setPImageInfo(image)
+            .setPBufferInfo(buffer);
+        device.updateDescriptorSets(write, nullptr);
+        return;
+    }
+
+    // A later write to the same slot replaces an earlier one that hasn't been applied everywhere
+    pending.erase(
+        std::remove_if(pending.begin(), pending.end(), [binding, slot](const PendingWrite &write)
+        {
+            return write.binding == binding && write.slot == slot;
+        }),
+        pending.end()
+    );
+
+    PendingWrite write;
+    write.binding = binding;
+    write.slot = slot;
+    if (image)
+        write.image = *image;
+    if (buffer)
+        write.buffer = *buffer;
+    write.frameMask = (1u << frameCount) - 1;
+    pending.push_back(write);
+}
+
+void DescriptorHeap::WriteDefault(uint32_t binding, uint32_t slot)
+{
+    if (binding == TextureBinding)
+        Write(binding, slot, &defaultTexture, nullptr);
+    else
+        Write(binding, slot, nullptr, &defaultBuffer);
+}
+
+vk::DescriptorPool DescriptorHeap::CreateTransientPool()
+{
+    // A mix that covers the usual small per-draw or per-pass sets
+    vk::DescriptorPoolSize poolSizes[] =
+    {
+        vk::DescriptorPoolSize(vk::DescriptorType::eUniformBuffer, 256),
+        vk::DescriptorPoolSize(vk::DescriptorType::eUniformBufferDynamic, 256),
+        vk::DescriptorPoolSize(vk::DescriptorType::eStorageBuffer, 256),
+        vk::DescriptorPoolSize(vk::DescriptorType::eStorageBufferDynamic, 256),
+        vk::DescriptorPoolSize(vk::DescriptorType::eCombinedImageSampler, 512),
+        vk::DescriptorPoolSize(vk::DescriptorType::eStorageImage, 128),
+    };
+
+    auto poolInfo = vk::DescriptorPoolCreateInfo()
+        .setMaxSets(256)
+        .setPoolSizeCount((uint32_t)(sizeof(poolSizes) / sizeof(poolSizes[0])))
+        .setPPoolSizes(poolSizes);
+    return device.createDescriptorPool(poolInfo);
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <vulkan/vk_cpp.h>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+typedef uint32_t DescriptorHandle;
+
+static const DescriptorHandle InvalidDescriptor = UINT32_MAX;
+
+// What the device allows, worked out when the device is created
+struct DescriptorHeapLimits
+{
+    // VK_EXT_descriptor_indexing with update-after-bind and partially bound arrays
+    bool updateAfterBind;
+    uint32_t maxTextures;
+    uint32_t maxBuffers;
+};
+
+// One big descriptor set with an array of textures and an array of storage
+// buffers. Shaders index the arrays with handles, so draws only bind the set
+// once instead of updating and binding sets per draw.
+//
+// With update-after-bind there is a single set and writes go straight in.
+// Without it each frame in flight gets its own copy of the set and writes are
+// applied to each copy when its frame comes around, so new descriptors show up
+// from the next frame on.
+class DescriptorHeap
+{
+public:
+    static const uint32_t TextureBinding = 0;
+    static const uint32_t BufferBinding = 1;
+
+    DescriptorHeap();
+    ~DescriptorHeap();
+
+    void Init(vk::Device device, const DescriptorHeapLimits &limits, uint32_t frameCount, uint32_t textureCount, uint32_t bufferCount);
+    void Destroy();
+
+    // Written to every unused slot. Without update-after-bind every slot a shader
+    // can index has to be valid, so set these before drawing with classic sets.
+    void SetDefaults(const vk::DescriptorImageInfo &texture, const vk::DescriptorBufferInfo &buffer);
+
+    DescriptorHandle AddTexture(const vk::DescriptorImageInfo &info);
+    DescriptorHandle AddBuffer(const vk::DescriptorBufferInfo &info);
+    void UpdateTexture(DescriptorHandle handle, const vk::DescriptorImageInfo &info);
+    void UpdateBuffer(DescriptorHandle handle, const vk::DescriptorBufferInfo &info);
+    // The slot is reused once the frames that might still read it complete
+    void FreeTexture(DescriptorHandle handle);
+    void FreeBuffer(DescriptorHandle handle);
+
+    // Call once the frame's fence has signaled, before recording it
+    void BeginFrame(uint32_t frame);
+
+    bool IsBindless() const;
+    vk::DescriptorSetLayout GetLayout() const;
+    // The set for the frame being recorded
+    vk::DescriptorSet GetSet() const;
+
+    // Short lived set for the frame being recorded, freed when the frame comes around again
+    vk::DescriptorSet AllocateTransient(vk::DescriptorSetLayout layout);
+
+private:
+    struct SlotArray
+    {
+        vk::DescriptorType type;
+        uint32_t binding;
+        uint32_t capacity;
+        uint32_t next;
+        std::vector<uint32_t> free;
+        // Per frame in flight, slots freed while that frame was recorded
+        std::vector<std::vector<uint32_t>> retired;
+    };
+
+    struct PendingWrite
+    {
+        uint32_t binding;
+        uint32_t slot;
+        vk::DescriptorImageInfo image;
+        vk::DescriptorBufferInfo buffer;
+        // Frames whose set still needs it
+        uint32_t frameMask;
+    };
+
+    void CreateLayout(bool updateAfterBind);
+    void CreateSets(bool updateAfterBind);
+    DescriptorHandle Allocate(SlotArray &slots);
+    void Free(SlotArray &slots, DescriptorHandle handle);
+    void Write(uint32_t binding, uint32_t slot, const vk::DescriptorImageInfo *image, const vk::DescriptorBufferInfo *buffer);
+    void WriteDefault(uint32_t binding, uint32_t slot);
+    vk::DescriptorPool CreateTransientPool();
+
+    vk::Device device;
+    bool bindless;
+    uint32_t frameCount;
+    uint32_t frame;
+    vk::DescriptorSetLayout layout;
+    vk::DescriptorPool pool;
+    // One set with update-after-bind, otherwise one per frame
+    std::vector<vk::DescriptorSet> sets;
+    SlotArray textures;
+    SlotArray buffers;
+    bool hasDefaults;
+    vk::DescriptorImageInfo defaultTexture;
+    vk::DescriptorBufferInfo defaultBuffer;
+    std::vector<PendingWrite> pending;
+
+    // Per frame, more pools are added when one runs out
+    std::vector<std::vector<vk::DescriptorPool>> transientPools;
+    std::vector<uint32_t> transientPoolIndex;
+
+    std::mutex mutex;
+};
@@ -0,0 +1,245 @@
+#include "DeviceSelector.h"
+#include "Log.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+static const char *DeviceTypeName(vk::PhysicalDeviceType type)
+{
+    switch (type)
+    {
+        case vk::PhysicalDeviceType::eDiscreteGpu: return "discrete";
+        case vk::PhysicalDeviceType::eIntegratedGpu: return "integrated";
+        case vk::PhysicalDeviceType::eVirtualGpu: return "virtual";
+        case vk::PhysicalDeviceType::eCpu: return "cpu";
+        default: return "other";
+    }
+}
+
+static std::string GetEnvironment(const char *name)
+{
+#ifdef _WIN32
+    char *value = nullptr;
+    size_t size = 0;
+    if (_dupenv_s(&value, &size, name) != 0 || !value)
+        return std::string();
+    std::string result{ value };
+    free(value);
+    return result;
+#else
+    auto value = getenv(name);
+    return value ? std::string{ value } : std::string();
+#endif
+}
+
+static std::string ToLower(std::string str)
+{
+    std::transform(str.begin(), str.end(), str.begin(), [](char c) { return (char)tolower((unsigned char)c); });
+    return str;
+}
+
+DeviceSelector::DeviceSelector(vk::Instance instance, vk::SurfaceKHR surface)
+    : surface(surface), selected(-1)
+{
+    for (auto device : instance.enumeratePhysicalDevices())
+    {
+        DeviceCandidate candidate;
+        candidate.device = device;
+        Evaluate(candidate);
+        candidates.push_back(candidate);
+    }
+}
+
+vk::PhysicalDevice DeviceSelector::Select(const std::string &override)
+{
+    auto wanted = GetEnvironment("VKAPP_DEVICE");
+    if (wanted.empty())
+        wanted = override;
+
+    selected = -1;
+    if (!wanted.empty())
+    {
+        selected = FindOverride(wanted);
+        if (selected < 0)
+            Log("device override \"" + wanted + "\" doesn't match a usable device, selecting automatically");
+    }
+
+    if (selected < 0)
+    {
+        for (int i = 0; i < (int)candidates.size(); ++i)
+        {
+            if (candidates[i].suitable && (selected < 0 || candidates[i].score > candidates[selected].score))
+                selected = i;
+        }
+    }
+
+    for (auto &line : GetReport())
+        Log(line);
+
+    if (selected < 0)
+        throw std::runtime_error{ "No physical device can run the renderer" };
+    return candidates[selected].device;
+}
+
+const std::vector<DeviceCandidate> &DeviceSelector::GetCandidates() const
+{
+    return candidates;
+}
+
+std::vector<std::string> DeviceSelector::GetReport() const
+{
+    std::vector<std::string> report;
+    for (size_t i = 0; i < candidates.size(); ++i)
+    {
+        auto &candidate = candidates[i];
+        auto &props = candidate.props;
+
+        std::ostringstream line;
+        line << "device index=" << i
+            << " name=\"" << props.deviceName << "\""
+            << " type=" << DeviceTypeName(props.deviceType)
+            << " vendor=0x" << std::hex << props.vendorID
+            << " id=0x" << props.deviceID << std::dec
+            << " api=" << VK_VERSION_MAJOR(props.apiVersion) << "." << VK_VERSION_MINOR(props.apiVersion) << "." << VK_VERSION_PATCH(props.apiVersion)
+            << " driver=" << props.driverVersion
+            << " local_mb=" << candidate.deviceLocalBytes / (1024 * 1024)
+            << " dedicated_compute=" << candidate.dedicatedCompute
+            << " dedicated_transfer=" << candidate.dedicatedTransfer
+            << " max_image_2d=" << props.limits.maxImageDimension2D
+            << " suitable=" << candidate.suitable
+            << " score=" << candidate.score
+            << " selected=" << ((int)i == selected);
+        for (auto &note : candidate.notes)
+            line << " [" << note << "]";
+        report.push_back(line.str());
+    }
+    return report;
+}
+
+const std::vector<vk::Format> &DeviceSelector::GetDepthFormats()
+{
+    static const std::vector<vk::Format> depthFormats =
+    {
+        vk::Format::eD32SfloatS8Uint,
+        //vk::Format::eD32Sfloat,
+        vk::Format::eD24UnormS8Uint,
+        vk::Format::eD16UnormS8Uint,
+        //vk::Format::eD16Unorm,
+    };
+    return depthFormats;
+}
+
+void DeviceSelector::Evaluate(DeviceCandidate &candidate)
+{
+    auto device = candidate.device;
+    candidate.props = device.getProperties();
+    candidate.features = device.getFeatures();
+    candidate.deviceLocalBytes = 0;
+    candidate.dedicatedCompute = false;
+    candidate.dedicatedTransfer = false;
+    candidate.suitable = true;
+    candidate.score = 0;
+
+    // Hard requirements first
+    bool graphics = false;
+    auto queueProperties = device.getQueueFamilyProperties();
+    for (uint32_t i = 0; i < queueProperties.size(); ++i)
+    {
+        auto flags = queueProperties[i].queueFlags;
+        if ((flags & vk::QueueFlagBits::eGraphics) && (!surface || device.getSurfaceSupportKHR(i, surface)))
+            graphics = true;
+        if ((flags & vk::QueueFlagBits::eCompute) && !(flags & vk::QueueFlagBits::eGraphics))
+            candidate.dedicatedCompute = true;
+        if ((flags & vk::QueueFlagBits::eTransfer) && !(flags & (vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute)))
+            candidate.dedicatedTransfer = true;
+    }
+    if (!graphics)
+    {
+        candidate.suitable = false;
+        candidate.notes.push_back(surface ? "no graphics queue that can present" : "no graphics queue");
+    }
+
+    if (surface)
+    {
+        bool swapchain = false;
+        for (auto &extension : device.enumerateDeviceExtensionProperties())
+            swapchain = swapchain || strcmp(extension.extensionName, VK_KHR_SWAPCHAIN_EXTENSION_NAME) == 0;
+        if (!swapchain)
+        {
+            candidate.suitable = false;
+            candidate.notes.push_back("no swapchain support");
+        }
+    }
+
+    bool depth = false;
+    for (auto format : GetDepthFormats())
+    {
+        auto formatProps = device.getFormatProperties(format);
+        depth = depth || (bool)(formatProps.optimalTilingFeatures & vk::FormatFeatureFlagBits::eDepthStencilAttachment);
+    }
+    if (!depth)
+    {
+        candidate.suitable = false;
+        candidate.notes.push_back("no depth-stencil format");
+    }
+
+    // Then score what's left, the device type dominates
+    switch (candidate.props.deviceType)
+    {
+        case vk::PhysicalDeviceType::eDiscreteGpu: candidate.score += 10000; break;
+        case vk::PhysicalDeviceType::eIntegratedGpu: candidate.score += 5000; break;
+        case vk::PhysicalDeviceType::eVirtualGpu: candidate.score += 2000; break;
+        case vk::PhysicalDeviceType::eCpu: candidate.score += 100; break;
+        default: break;
+    }
+
+    // Device local memory, 100 points per GiB
+    auto memProps = device.getMemoryProperties();
+    for (uint32_t i = 0; i < memProps.memoryHeapCount; ++i)
+    {
+        if (memProps.memoryHeaps[i].flags & vk::MemoryHeapFlagBits::eDeviceLocal)
+            candidate.deviceLocalBytes += memProps.memoryHeaps[i].size;
+    }
+    candidate.score += (int64_t)(candidate.deviceLocalBytes / (1024 * 1024 * 1024)) * 100;
+
+    // Queues that let uploads and compute overlap graphics
+    if (candidate.dedicatedCompute)
+        candidate.score += 200;
+    if (candidate.dedicatedTransfer)
+        candidate.score += 200;
+
+    // Features later passes make use of
+    if (candidate.features.multiDrawIndirect)
+        candidate.score += 100;
+    if (candidate.features.samplerAnisotropy)
+        candidate.score += 50;
+    if (candidate.features.textureCompressionBC)
+        candidate.score += 50;
+    candidate.score += candidate.props.limits.maxImageDimension2D / 1024;
+}
+
+int DeviceSelector::FindOverride(const std::string &override) const
+{
+    // A plain number is an index
+    char *end;
+    auto index = strtol(override.c_str(), &end, 10);
+    if (*end == '\0')
+    {
+        if (index >= 0 && index < (long)candidates.size() && candidates[index].suitable)
+            return (int)index;
+        return -1;
+    }
+
+    // Otherwise it's part of the name
+    auto wanted = ToLower(override);
+    for (int i = 0; i < (int)candidates.size(); ++i)
+    {
+        auto name = ToLower(candidates[i].props.deviceName);
+        if (candidates[i].suitable && name.find(wanted) != std::string::npos)
+            return i;
+    }
+    return -1;
+}
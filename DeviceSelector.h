@@ -0,0 +1,47 @@
+#pragma once
+
+#include <vulkan/vk_cpp.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct DeviceCandidate
+{
+    vk::PhysicalDevice device;
+    vk::PhysicalDeviceProperties props;
+    vk::PhysicalDeviceFeatures features;
+    vk::DeviceSize deviceLocalBytes;
+    bool dedicatedCompute;
+    bool dedicatedTransfer;
+    bool suitable;
+    int64_t score;
+    // Why the device was rejected or what it was scored on
+    std::vector<std::string> notes;
+};
+
+// Scores every physical device and picks the best one that can run the renderer
+class DeviceSelector
+{
+public:
+    // Without a surface, presenting support isn't required
+    DeviceSelector(vk::Instance instance, vk::SurfaceKHR surface);
+
+    // The override is a device index or part of a device name. The VKAPP_DEVICE
+    // environment variable takes precedence over it.
+    vk::PhysicalDevice Select(const std::string &override);
+
+    const std::vector<DeviceCandidate> &GetCandidates() const;
+    // One line per device in key=value form
+    std::vector<std::string> GetReport() const;
+
+    // Depth formats the renderer can use, best first
+    static const std::vector<vk::Format> &GetDepthFormats();
+
+private:
+    void Evaluate(DeviceCandidate &candidate);
+    int FindOverride(const std::string &override) const;
+
+    vk::SurfaceKHR surface;
+    std::vector<DeviceCandidate> candidates;
+    int selected;
+};
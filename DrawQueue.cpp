@@ -0,0 +1,244 @@
+#include "DrawQueue.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+static const uint32_t RadixBits = 8;
+static const uint32_t RadixSize = 1 << RadixBits;
+// Fewer items than this per chunk and the sort isn't worth splitting up
+static const uint32_t MinChunkSize = 4096;
+
+// The top bits of a positive float sort the same way the float does
+static uint64_t QuantizeDepth(float depth)
+{
+    uint32_t bits;
+    depth = std::max(depth, 0.0f);
+    memcpy(&bits, &depth, sizeof(bits));
+    return bits >> (32 - DrawQueue::DepthBits);
+}
+
+static uint64_t Field(uint32_t value, uint32_t bits)
+{
+    if (value >= (1u << bits))
+        throw std::runtime_error{ "Draw state id doesn't fit in its sort key bits" };
+    return value;
+}
+
+DrawQueue::DrawQueue()
+    : count(0), sorted(0), stateChanges(0)
+{
+}
+
+void DrawQueue::Reserve(uint32_t capacity)
+{
+    keys.resize(capacity);
+    passes.resize(capacity);
+    pipelines.resize(capacity);
+    materials.resize(capacity);
+    meshes.resize(capacity);
+    instances.resize(capacity);
+    for (auto i = 0; i < 2; ++i)
+    {
+        sortKeys[i].resize(capacity);
+        sortItems[i].resize(capacity);
+    }
+    batchInstances.reserve(capacity);
+}
+
+void DrawQueue::Clear()
+{
+    count = 0;
+    batches.clear();
+    batchInstances.clear();
+    stateChanges = 0;
+}
+
+void DrawQueue::Add(uint32_t pass, uint32_t pipeline, uint32_t material, uint32_t mesh, float depth, uint32_t instance)
+{
+    Push(MakeKey(pass, pipeline, material, mesh, depth), pass, pipeline, material, mesh, instance);
+}
+
+void DrawQueue::AddTranslucent(uint32_t pass, uint32_t pipeline, uint32_t material, uint32_t mesh, float depth, uint32_t instance)
+{
+    Push(MakeTranslucentKey(pass, pipeline, material, mesh, depth), pass, pipeline, material, mesh, instance);
+}
+
+uint32_t DrawQueue::GetCount() const
+{
+    return std::min(count.load(), (uint32_t)keys.size());
+}
+
+void DrawQueue::Sort(JobSystem &jobs)
+{
+    auto itemCount = GetCount();
+    RadixSort(jobs, itemCount);
+    BuildBatches(itemCount);
+}
+
+const std::vector<DrawBatch> &DrawQueue::GetBatches() const
+{
+    return batches;
+}
+
+const std::vector<uint32_t> &DrawQueue::GetInstances() const
+{
+    return batchInstances;
+}
+
+uint32_t DrawQueue::GetStateChanges() const
+{
+    return stateChanges;
+}
+
+void DrawQueue::Record(vk::CommandBuffer commandBuffer, uint32_t chunk, uint32_t chunkCount, const BatchRecorder &recorder) const
+{
+    auto batchCount = (uint32_t)batches.size();
+    auto begin = (uint32_t)((uint64_t)batchCount * chunk / chunkCount);
+    auto end = (uint32_t)((uint64_t)batchCount * (chunk + 1) / chunkCount);
+    for (auto i = begin; i < end; ++i)
+    {
+        auto &batch = batches[i];
+        bool first = i == begin;
+        bool bindPipeline = first || batch.pipeline != batches[i - 1].pipeline || batch.pass != batches[i - 1].pass;
+        bool bindMaterial = bindPipeline || batch.material != batches[i - 1].material;
+        recorder(commandBuffer, batch, bindPipeline, bindMaterial);
+    }
+}
+
+DrawKey DrawQueue::MakeKey(uint32_t pass, uint32_t pipeline, uint32_t material, uint32_t mesh, float depth)
+{
+    return Field(pass, PassBits) << (PipelineBits + MaterialBits + MeshBits + DepthBits) |
+        Field(pipeline, PipelineBits) << (MaterialBits + MeshBits + DepthBits) |
+        Field(material, MaterialBits) << (MeshBits + DepthBits) |
+        Field(mesh, MeshBits) << DepthBits |
+        QuantizeDepth(depth);
+}
+
+DrawKey DrawQueue::MakeTranslucentKey(uint32_t pass, uint32_t pipeline, uint32_t material, uint32_t mesh, float depth)
+{
+    // Farthest first, state only breaks ties
+    auto farFirst = ((1ull << DepthBits) - 1) - QuantizeDepth(depth);
+    return Field(pass, PassBits) << (DepthBits + PipelineBits + MaterialBits + MeshBits) |
+        farFirst << (PipelineBits + MaterialBits + MeshBits) |
+        Field(pipeline, PipelineBits) << (MaterialBits + MeshBits) |
+        Field(material, MaterialBits) << MeshBits |
+        Field(mesh, MeshBits);
+}
+
+void DrawQueue::Push(DrawKey key, uint32_t pass, uint32_t pipeline, uint32_t material, uint32_t mesh, uint32_t instance)
+{
+    // Every slot belongs to exactly one caller, so filling it in needs no lock
+    auto index = count.fetch_add(1, std::memory_order_relaxed);
+    if (index >= keys.size())
+        throw std::runtime_error{ "Draw queue is full" };
+
+    keys[index] = key;
+    passes[index] = (uint8_t)pass;
+    pipelines[index] = (uint16_t)pipeline;
+    materials[index] = (uint16_t)material;
+    meshes[index] = (uint16_t)mesh;
+    instances[index] = instance;
+}
+
+void DrawQueue::RadixSort(JobSystem &jobs, uint32_t count)
+{
+    // Least significant digit first, each pass is stable so earlier digits stay in order
+    auto chunkCount = std::max(std::min(jobs.GetThreadCount(), count / MinChunkSize), 1u);
+    auto chunkSize = (count + chunkCount - 1) / std::max(chunkCount, 1u);
+    histograms.assign(chunkCount * RadixSize, 0);
+
+    std::copy(keys.begin(), keys.begin() + count, sortKeys[0].begin());
+    for (uint32_t i = 0; i < count; ++i)
+        sortItems[0][i] = i;
+    sorted = 0;
+
+    for (uint32_t shift = 0; shift < 64; shift += RadixBits)
+    {
+        auto &srcKeys = sortKeys[sorted];
+        auto &srcItems = sortItems[sorted];
+        auto &dstKeys = sortKeys[sorted ^ 1];
+        auto &dstItems = sortItems[sorted ^ 1];
+
+        std::fill(histograms.begin(), histograms.end(), 0);
+        jobs.ParallelFor(chunkCount, [&](uint32_t chunk, uint32_t)
+        {
+            auto histogram = &histograms[chunk * RadixSize];
+            auto end = std::min((chunk + 1) * chunkSize, count);
+            for (auto i = chunk * chunkSize; i < end; ++i)
+                ++histogram[(srcKeys[i] >> shift) & (RadixSize - 1)];
+        });
+
+        // Turn the counts into where each chunk starts writing each digit.
+        // A digit every key shares would leave the order as it is, so skip it.
+        uint32_t offset = 0;
+        bool skip = false;
+        for (uint32_t digit = 0; digit < RadixSize; ++digit)
+        {
+            uint32_t digitCount = 0;
+            for (uint32_t chunk = 0; chunk < chunkCount; ++chunk)
+            {
+                auto &slot = histograms[chunk * RadixSize + digit];
+                auto chunkDigits = slot;
+                slot = offset;
+                offset += chunkDigits;
+                digitCount += chunkDigits;
+            }
+            skip = skip || digitCount == count;
+        }
+        if (skip)
+            continue;
+
+        jobs.ParallelFor(chunkCount, [&](uint32_t chunk, uint32_t)
+        {
+            auto offsets = &histograms[chunk * RadixSize];
+            auto end = std::min((chunk + 1) * chunkSize, count);
+            for (auto i = chunk * chunkSize; i < end; ++i)
+            {
+                auto dst = offsets[(srcKeys[i] >> shift) & (RadixSize - 1)]++;
+                dstKeys[dst] = srcKeys[i];
+                dstItems[dst] = srcItems[i];
+            }
+        });
+        sorted ^= 1;
+    }
+}
+
+void DrawQueue::BuildBatches(uint32_t count)
+{
+    batches.clear();
+    batchInstances.resize(count);
+    stateChanges = 0;
+
+    auto &order = sortItems[sorted];
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        auto item = order[i];
+        batchInstances[i] = instances[item];
+
+        // Same state as the last item, so it joins that batch as another instance
+        if (!batches.empty())
+        {
+            auto &last = batches.back();
+            if (last.pass == passes[item] && last.pipeline == pipelines[item] &&
+                last.material == materials[item] && last.mesh == meshes[item])
+            {
+                ++last.instanceCount;
+                continue;
+            }
+        }
+
+        DrawBatch batch;
+        batch.pass = passes[item];
+        batch.pipeline = pipelines[item];
+        batch.material = materials[item];
+        batch.mesh = meshes[item];
+        batch.firstInstance = i;
+        batch.instanceCount = 1;
+
+        if (batches.empty() || batches.back().pass != batch.pass || batches.back().pipeline != batch.pipeline)
+            stateChanges += 2;
+        else if (batches.back().material != batch.material)
+            ++stateChanges;
+        batches.push_back(batch);
+    }
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "JobSystem.h"
+#include <vulkan/vk_cpp.h>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+typedef uint64_t DrawKey;
+
+// Consecutive items with the same state, drawn as one instanced draw
+struct DrawBatch
+{
+    uint32_t pass;
+    uint32_t pipeline;
+    uint32_t material;
+    uint32_t mesh;
+    // Range of DrawQueue::GetInstances
+    uint32_t firstInstance;
+    uint32_t instanceCount;
+};
+
+// Collects the frame's draws in flat arrays, sorts them by a 64-bit key and
+// merges runs with the same state into instanced batches, so the draw recorder
+// only changes pipelines and materials when it has to.
+//
+// Opaque keys are, from the top bit down: pass, pipeline, material, mesh and
+// depth, so state changes are rare and each batch runs front to back.
+// Translucent keys put depth right after the pass, back to front.
+class DrawQueue
+{
+public:
+    static const uint32_t PassBits = 4;
+    static const uint32_t PipelineBits = 12;
+    static const uint32_t MaterialBits = 16;
+    static const uint32_t MeshBits = 16;
+    static const uint32_t DepthBits = 16;
+
+    // Whether to bind the batch's pipeline and material before drawing it
+    typedef std::function<void(vk::CommandBuffer commandBuffer, const DrawBatch &batch, bool bindPipeline, bool bindMaterial)> BatchRecorder;
+
+    DrawQueue();
+
+    // Add throws once this many items are queued
+    void Reserve(uint32_t capacity);
+    void Clear();
+
+    // Safe from several threads at once. Ids have to fit in their bits, the
+    // instance is handed back in GetInstances for the shader to look up.
+    void Add(uint32_t pass, uint32_t pipeline, uint32_t material, uint32_t mesh, float depth, uint32_t instance);
+    void AddTranslucent(uint32_t pass, uint32_t pipeline, uint32_t material, uint32_t mesh, float depth, uint32_t instance);
+    uint32_t GetCount() const;
+
+    // Sort everything added so far and build the batches
+    void Sort(JobSystem &jobs);
+
+    const std::vector<DrawBatch> &GetBatches() const;
+    // Every item's instance in sorted order
+    const std::vector<uint32_t> &GetInstances() const;
+    // Pipeline and material binds the batches need in total
+    uint32_t GetStateChanges() const;
+
+    // Record one of chunkCount even shares of the batches, the first batch of
+    // each chunk binds everything since chunks go into separate command buffers
+    void Record(vk::CommandBuffer commandBuffer, uint32_t chunk, uint32_t chunkCount, const BatchRecorder &recorder) const;
+
+    static DrawKey MakeKey(uint32_t pass, uint32_t pipeline, uint32_t material, uint32_t mesh, float depth);
+    static DrawKey MakeTranslucentKey(uint32_t pass, uint32_t pipeline, uint32_t material, uint32_t mesh, float depth);
+
+private:
+    void Push(DrawKey key, uint32_t pass, uint32_t pipeline, uint32_t material, uint32_t mesh, uint32_t instance);
+    void RadixSort(JobSystem &jobs, uint32_t count);
+    void BuildBatches(uint32_t count);
+
+    // One entry per item, indexed by the order they were added
+    std::vector<DrawKey> keys;
+    std::vector<uint8_t> passes;
+    std::vector<uint16_t> pipelines;
+    std::vector<uint16_t> materials;
+    std::vector<uint16_t> meshes;
+    std::vector<uint32_t> instances;
+    std::atomic<uint32_t> count;
+
+    // Radix sort ping-pongs keys and item indices between these
+    std::vector<DrawKey> sortKeys[2];
+    std::vector<uint32_t> sortItems[2];
+    // Per chunk, one count per digit value
+    std::vector<uint32_t> histograms;
+    uint32_t sorted;
+
+    std::vector<DrawBatch> batches;
+    std::vector<uint32_t> batchInstances;
+    uint32_t stateChanges;
+};
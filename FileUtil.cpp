@@ -0,0 +1,53 @@
+#include "FileUtil.h"
+#include <cstdio>
+#include <fstream>
+
+#ifdef _WIN32
+#include <Windows.h>
+#endif
+
+bool ReadFileBytes(const std::string &path, std::vector<uint8_t> &data)
+{
+    std::ifstream file{ path, std::ios::binary | std::ios::ate };
+    if (!file)
+        return false;
+
+    auto size = (size_t)file.tellg();
+    file.seekg(0);
+
+    data.resize(size);
+    return (bool)file.read((char *)data.data(), size);
+}
+
+bool WriteFileAtomic(const std::string &path, const void *data, size_t size)
+{
+    // Write everything to a temporary next to the target first
+    auto tempPath = path + ".tmp";
+    {
+        std::ofstream file{ tempPath, std::ios::binary | std::ios::trunc };
+        if (!file)
+            return false;
+
+        file.write((const char *)data, size);
+        file.flush();
+        if (!file)
+        {
+            file.close();
+            std::remove(tempPath.c_str());
+            return false;
+        }
+    }
+
+    // Then swap it into place, renames within a volume are atomic
+#ifdef _WIN32
+    if (!MoveFileExA(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+#else
+    if (std::rename(tempPath.c_str(), path.c_str()) != 0)
+#endif
+    {
+        std::remove(tempPath.c_str());
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Read a whole file, returns false if it doesn't exist or can't be read
+bool ReadFileBytes(const std::string &path, std::vector<uint8_t> &data);
+
+// Write a file so that readers see either the old or the new contents, never a partial write
+bool WriteFileAtomic(const std::string &path, const void *data, size_t size);
@@ -0,0 +1,484 @@
+#include "FrameCapture.h"
+#include "FileUtil.h"
+#include "Log.h"
+#include <algorithm>
+#include <array>
+#include <cstdio>
+
+static bool IsBgra(vk::Format format)
+{
+    return format == vk::Format::eB8G8R8A8Unorm || format == vk::Format::eB8G8R8A8Srgb;
+}
+
+static bool IsRgba(vk::Format format)
+{
+    return format == vk::Format::eR8G8B8A8Unorm || format == vk::Format::eR8G8B8A8Srgb;
+}
+
+static uint32_t Crc32(const uint8_t *data, size_t size, uint32_t crc = 0)
+{
+    static const auto table = []()
+    {
+        std::array<uint32_t, 256> table;
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+            auto c = i;
+            for (int bit = 0; bit < 8; ++bit)
+                c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+        return table;
+    }();
+
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i)
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+static uint32_t Adler32(const uint8_t *data, size_t size)
+{
+    uint32_t a = 1, b = 0;
+    while (size > 0)
+    {
+        // Largest run that can't overflow before taking the modulus
+        auto run = std::min<size_t>(size, 5552);
+        for (size_t i = 0; i < run; ++i)
+        {
+            a += data[i];
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+        data += run;
+        size -= run;
+    }
+    return (b << 16) | a;
+}
+
+static void PutBigEndian(std::vector<uint8_t> &out, uint32_t value)
+{
+    out.push_back((uint8_t)(value >> 24));
+    out.push_back((uint8_t)(value >> 16));
+    out.push_back((uint8_t)(value >> 8));
+    out.push_back((uint8_t)value);
+}
+
+static void PutChunk(std::vector<uint8_t> &out, const char *type, const uint8_t *data, size_t size)
+{
+    PutBigEndian(out, (uint32_t)size);
+    auto start = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data, data + size);
+    PutBigEndian(out, Crc32(&out[start], out.size() - start));
+}
+
+// Filtered scanlines into a PNG. The deflate stream only has stored blocks,
+// which costs file size but keeps compression off the writer thread's budget.
+static void EncodePng(uint32_t width, uint32_t height, const std::vector<uint8_t> &scanlines, std::vector<uint8_t> &out)
+{
+    static const uint8_t signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    out.assign(signature, signature + sizeof(signature));
+
+    std::vector<uint8_t> header;
+    PutBigEndian(header, width);
+    PutBigEndian(header, height);
+    // 8-bit RGB, default compression, filtering and no interlacing
+    header.insert(header.end(), { 8, 2, 0, 0, 0 });
+    PutChunk(out, "IHDR", header.data(), header.size());
+
+    std::vector<uint8_t> zlib = { 0x78, 0x01 };
+    zlib.reserve(scanlines.size() + scanlines.size() / 65535 * 5 + 16);
+    size_t offset = 0;
+    do
+    {
+        auto size = std::min<size_t>(scanlines.size() - offset, 65535);
+        bool last = offset + size == scanlines.size();
+        zlib.push_back(last ? 1 : 0);
+        zlib.push_back((uint8_t)size);
+        zlib.push_back((uint8_t)(size >> 8));
+        zlib.push_back((uint8_t)~size);
+        zlib.push_back((uint8_t)(~size >> 8));
+        zlib.insert(zlib.end(), scanlines.begin() + offset, scanlines.begin() + offset + size);
+        offset += size;
+    } while (offset < scanlines.size());
+    PutBigEndian(zlib, Adler32(scanlines.data(), scanlines.size()));
+    PutChunk(out, "IDAT", zlib.data(), zlib.size());
+
+    PutChunk(out, "IEND", nullptr, 0);
+}
+
+FrameCapture::FrameCapture()
+    : allocator(nullptr), atomSize(1), format(CaptureFormat::Png), requested(0), writerQuit(false), recorded(0), written(0), dropped(0), skipLogged(false)
+{
+}
+
+FrameCapture::~FrameCapture()
+{
+    Destroy();
+}
+
+void FrameCapture::Init(
+    vk::Device device,
+    MemoryAllocator &allocator,
+    vk::DeviceSize nonCoherentAtomSize,
+    uint32_t bufferCount,
+    const std::string &pathPrefix,
+    CaptureFormat format)
+{
+    this->device = device;
+    this->allocator = &allocator;
+    this->atomSize = std::max<vk::DeviceSize>(nonCoherentAtomSize, 1);
+    this->pathPrefix = pathPrefix;
+    this->format = format;
+
+    // Buffers are made the first time they're used, at the image's size
+    slots.resize(std::max(bufferCount, 1u));
+    for (auto &slot : slots)
+    {
+        slot.capacity = 0;
+        slot.state = SlotState::Free;
+    }
+
+    writerQuit = false;
+    writer = std::thread{ &FrameCapture::WriterMain, this };
+}
+
+void FrameCapture::Destroy()
+{
+    if (!writer.joinable())
+        return;
+
+    // The device is idle, so every recorded copy has landed
+    {
+        std::lock_guard<std::mutex> lock{ mutex };
+        for (uint32_t i = 0; i < slots.size(); ++i)
+        {
+            if (slots[i].state == SlotState::Recorded)
+            {
+                slots[i].state = SlotState::Writing;
+                writes.push_back(i);
+            }
+        }
+        writerQuit = true;
+    }
+    writerWake.notify_all();
+    writer.join();
+
+    if (stream.is_open())
+        stream.close();
+    for (auto &slot : slots)
+        Free(slot);
+    slots.clear();
+}
+
+void FrameCapture::Request(uint32_t count)
+{
+    requested += count;
+}
+
+bool FrameCapture::IsRequested() const
+{
+    return requested.load(std::memory_order_relaxed) > 0;
+}
+
+bool FrameCapture::Record(
+    vk::CommandBuffer commandBuffer,
+    LayoutTracker &layouts,
+    vk::Image image,
+    vk::Format format,
+    vk::Extent2D extent,
+    uint32_t frame,
+    uint64_t frameNumber)
+{
+    // Never worth stopping the frame for, and waiting won't make the format work
+    if (!IsBgra(format) && !IsRgba(format))
+    {
+        Skip("only 8-bit RGBA and BGRA images are supported, not format " + std::to_string((int)format));
+        return false;
+    }
+
+    // Skip the frame rather than wait for the writer to free a buffer
+    Slot *slot = nullptr;
+    {
+        std::lock_guard<std::mutex> lock{ mutex };
+        for (auto &candidate : slots)
+        {
+            if (candidate.state == SlotState::Free)
+            {
+                slot = &candidate;
+                break;
+            }
+        }
+        if (!slot)
+        {
+            ++dropped;
+            return false;
+        }
+        slot->state = SlotState::Recorded;
+    }
+
+    vk::DeviceSize size = (vk::DeviceSize)extent.width * extent.height * 4;
+    if (slot->capacity < size)
+        Allocate(*slot, size);
+    slot->frame = frame;
+    slot->frameNumber = frameNumber;
+    slot->format = format;
+    slot->extent = extent;
+
+    layouts.Transition(image, ImageState::TransferSrc());
+    layouts.Flush(commandBuffer);
+
+    auto region = vk::BufferImageCopy()
+        .setImageSubresource(vk::ImageSubresourceLayers()
+            .setAspectMask(vk::ImageAspectFlagBits::eColor)
+            .setLayerCount(1))
+        .setImageExtent({ extent.width, extent.height, 1 });
+    commandBuffer.copyImageToBuffer(image, vk::ImageLayout::eTransferSrcOptimal, slot->buffer, region);
+
+    // Make the copy visible to the host once the frame's fence signals
+    auto barrier = vk::BufferMemoryBarrier()
+        .setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+        .setDstAccessMask(vk::AccessFlagBits::eHostRead)
+        .setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+        .setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+        .setBuffer(slot->buffer)
+        .setOffset(0)
+        .setSize(size);
+    commandBuffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eTransfer,
+        vk::PipelineStageFlagBits::eHost,
+        vk::DependencyFlags(),
+        nullptr,
+        barrier,
+        nullptr
+    );
+
+    TakeRequest();
+    ++recorded;
+    return true;
+}
+
+void FrameCapture::Skip(const std::string &reason)
+{
+    if (!skipLogged.exchange(true))
+        Log("Frame capture skipped a frame, " + reason);
+    ++dropped;
+    TakeRequest();
+}
+
+void FrameCapture::TakeRequest()
+{
+    // Another thread may have requested more in the meantime, only take one
+    auto pending = requested.load(std::memory_order_relaxed);
+    while (pending > 0 && !requested.compare_exchange_weak(pending, pending - 1, std::memory_order_relaxed))
+    {
+    }
+}
+
+void FrameCapture::FrameComplete(uint32_t frame)
+{
+    bool queued = false;
+    {
+        std::lock_guard<std::mutex> lock{ mutex };
+        for (uint32_t i = 0; i < slots.size(); ++i)
+        {
+            auto &slot = slots[i];
+            if (slot.state != SlotState::Recorded || slot.frame != frame)
+                continue;
+
+            auto &memoryType = allocator->GetProperties().memoryTypes[slot.mem.memoryType];
+            if (!(memoryType.propertyFlags & vk::MemoryPropertyFlagBits::eHostCoherent))
+            {
+                auto range = vk::MappedMemoryRange()
+                    .setMemory(slot.mem.memory)
+                    .setOffset(slot.mem.offset)
+                    .setSize(slot.capacity);
+                device.invalidateMappedMemoryRanges(range);
+            }
+
+            slot.state = SlotState::Writing;
+            writes.push_back(i);
+            queued = true;
+        }
+    }
+
+    if (queued)
+        writerWake.notify_one();
+}
+
+CaptureStats FrameCapture::GetStats() const
+{
+    CaptureStats stats;
+    stats.recorded = recorded;
+    stats.written = written;
+    stats.dropped = dropped;
+    return stats;
+}
+
+void FrameCapture::Allocate(Slot &slot, vk::DeviceSize size)
+{
+    // Nothing uses a free slot's buffer, so it can go right away
+    Free(slot);
+
+    auto bufferInfo = vk::BufferCreateInfo()
+        .setSize(size)
+        .setUsage(vk::BufferUsageFlagBits::eTransferDst)
+        .setSharingMode(vk::SharingMode::eExclusive);
+    slot.buffer = device.createBuffer(bufferInfo);
+
+    // Cached memory keeps the writer's reads fast, coherent saves invalidating
+    auto memReqs = device.getBufferMemoryRequirements(slot.buffer);
+    memReqs.alignment = std::max(memReqs.alignment, atomSize);
+    memReqs.size = AlignUp(memReqs.size, atomSize);
+    auto visible = vk::MemoryPropertyFlags(vk::MemoryPropertyFlagBits::eHostVisible);
+    auto cached = vk::MemoryPropertyFlags(vk::MemoryPropertyFlagBits::eHostCached);
+    auto coherent = vk::MemoryPropertyFlags(vk::MemoryPropertyFlagBits::eHostCoherent);
+    auto flags = visible;
+    for (auto candidate : { visible | cached | coherent, visible | cached, visible | coherent })
+    {
+        if (allocator->HasMemoryType(memReqs.memoryTypeBits, candidate))
+        {
+            flags = candidate;
+            break;
+        }
+    }
+    slot.mem = allocator->Allocate(memReqs, flags, AllocationTiling::Linear);
+    device.bindBufferMemory(slot.buffer, slot.mem.memory, slot.mem.offset);
+    slot.capacity = memReqs.size;
+}
+
+void FrameCapture::Free(Slot &slot)
+{
+    if (!slot.buffer)
+        return;
+
+    device.destroyBuffer(slot.buffer);
+    allocator->Free(slot.mem);
+    slot.buffer = nullptr;
+    slot.capacity = 0;
+}
+
+void FrameCapture::WriterMain()
+{
+    while (true)
+    {
+        uint32_t index;
+        {
+            std::unique_lock<std::mutex> lock{ mutex };
+            writerWake.wait(lock, [this]() { return writerQuit || !writes.empty(); });
+            // Everything queued is written before quitting
+            if (writes.empty())
+                return;
+            index = writes.front();
+            writes.pop_front();
+        }
+
+        // Only the writer touches a slot while it's being written
+        Write(slots[index]);
+
+        std::lock_guard<std::mutex> lock{ mutex };
+        slots[index].state = SlotState::Free;
+    }
+}
+
+void FrameCapture::Write(const Slot &slot)
+{
+    auto width = slot.extent.width;
+    auto height = slot.extent.height;
+    auto texels = slot.mem.mapped;
+    auto size = (size_t)width * height * 4;
+    // Byte offsets of red and blue in a texel
+    auto red = IsBgra(slot.format) ? 2 : 0;
+    auto blue = 2 - red;
+
+    char number[32];
+    snprintf(number, sizeof(number), "%06llu", (unsigned long long)slot.frameNumber);
+
+    bool ok = true;
+    switch (format)
+    {
+        case CaptureFormat::Png:
+        {
+            // A filter byte of none and RGB for each row, alpha isn't meaningful on a swap chain
+            scratch.resize((size_t)(width * 3 + 1) * height);
+            auto out = scratch.data();
+            for (uint32_t y = 0; y < height; ++y)
+            {
+                *out++ = 0;
+                auto row = texels + (size_t)y * width * 4;
+                for (uint32_t x = 0; x < width; ++x, row += 4)
+                {
+                    *out++ = row[red];
+                    *out++ = row[1];
+                    *out++ = row[blue];
+                }
+            }
+            EncodePng(width, height, scratch, encoded);
+            ok = WriteFileAtomic(pathPrefix + number + ".png", encoded.data(), encoded.size());
+            break;
+        }
+
+        case CaptureFormat::Raw:
+            ok = WriteFileAtomic(pathPrefix + number + ".raw", texels, size);
+            break;
+
+        case CaptureFormat::Yuv420:
+        {
+            // BT.601 limited range, each chroma sample averages a 2x2 block
+            auto chromaWidth = (width + 1) / 2;
+            auto chromaHeight = (height + 1) / 2;
+            scratch.resize((size_t)width * height + (size_t)chromaWidth * chromaHeight * 2);
+            auto yPlane = scratch.data();
+            auto uPlane = yPlane + (size_t)width * height;
+            auto vPlane = uPlane + (size_t)chromaWidth * chromaHeight;
+            auto texel = [&](uint32_t x, uint32_t y) { return texels + ((size_t)std::min(y, height - 1) * width + std::min(x, width - 1)) * 4; };
+
+            for (uint32_t y = 0; y < height; ++y)
+            {
+                for (uint32_t x = 0; x < width; ++x)
+                {
+                    auto t = texel(x, y);
+                    yPlane[(size_t)y * width + x] = (uint8_t)(16 + ((66 * t[red] + 129 * t[1] + 25 * t[blue] + 128) >> 8));
+                }
+            }
+            for (uint32_t y = 0; y < chromaHeight; ++y)
+            {
+                for (uint32_t x = 0; x < chromaWidth; ++x)
+                {
+                    int r = 0, g = 0, b = 0;
+                    for (uint32_t i = 0; i < 4; ++i)
+                    {
+                        auto t = texel(x * 2 + (i & 1), y * 2 + (i >> 1));
+                        r += t[red];
+                        g += t[1];
+                        b += t[blue];
+                    }
+                    r /= 4;
+                    g /= 4;
+                    b /= 4;
+                    uPlane[(size_t)y * chromaWidth + x] = (uint8_t)(128 + ((-38 * r - 74 * g + 112 * b + 128) >> 8));
+                    vPlane[(size_t)y * chromaWidth + x] = (uint8_t)(128 + ((112 * r - 94 * g - 18 * b + 128) >> 8));
+                }
+            }
+
+            // Frames of a stream have to share a size, so a resize starts a new one
+            auto path = pathPrefix + std::to_string(width) + "x" + std::to_string(height) + ".yuv";
+            if (path != streamPath)
+            {
+                stream.close();
+                stream.open(path, std::ios::binary | std::ios::trunc);
+                streamPath = path;
+                Log("Capturing to " + path);
+            }
+            stream.write((const char *)scratch.data(), scratch.size());
+            ok = (bool)stream;
+            break;
+        }
+    }
+
+    if (ok)
+        ++written;
+    else
+        Log(std::string{ "Couldn't write captured frame " } + number);
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include "LayoutTracker.h"
+#include "MemoryAllocator.h"
+#include <vulkan/vk_cpp.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum class CaptureFormat
+{
+    // One lossless image per frame, for image diffs
+    Png,
+    // One file per frame, tightly packed rows exactly as the GPU wrote them
+    Raw,
+    // Every frame appended to one planar 4:2:0 stream, for encoders
+    Yuv420,
+};
+
+struct CaptureStats
+{
+    uint64_t recorded;
+    uint64_t written;
+    // Frames skipped because every readback buffer was still busy, or because
+    // the image couldn't be captured at all
+    uint64_t dropped;
+};
+
+// Copies rendered images into a ring of host visible buffers and writes them
+// out on a background thread. The copy goes into the frame's own command
+// buffer and is known to be done once that frame's fence has been waited on,
+// so capturing never waits on the GPU. When every buffer is still busy the
+// frame is skipped instead, and the next one is tried.
+class FrameCapture
+{
+public:
+    FrameCapture();
+    ~FrameCapture();
+
+    // Files are named from the prefix and the frame number
+    void Init(
+        vk::Device device,
+        MemoryAllocator &allocator,
+        vk::DeviceSize nonCoherentAtomSize,
+        uint32_t bufferCount,
+        const std::string &pathPrefix,
+        CaptureFormat format
+    );
+    // The device has to be idle, copies that were still in flight are written first
+    void Destroy();
+
+    // Capture the next count frames, safe from any thread
+    void Request(uint32_t count);
+    bool IsRequested() const;
+
+    // Record a copy of a color image with 8-bit RGBA or BGRA texels, which is
+    // left as a transfer source. False if there was no free buffer for it. Any
+    // other format is logged once and the requested frame counts as dropped.
+    bool Record(
+        vk::CommandBuffer commandBuffer,
+        LayoutTracker &layouts,
+        vk::Image image,
+        vk::Format format,
+        vk::Extent2D extent,
+        uint32_t frame,
+        uint64_t frameNumber
+    );
+    // For a requested frame whose image can't be copied from at all. It counts
+    // as dropped and the reason is logged once.
+    void Skip(const std::string &reason);
+    // Call once the frame's fence has signaled, its copies go to the writer
+    void FrameComplete(uint32_t frame);
+
+    CaptureStats GetStats() const;
+
+private:
+    enum class SlotState
+    {
+        Free,
+        // Copy recorded, waiting on its frame
+        Recorded,
+        // Queued for or being written by the writer thread
+        Writing,
+    };
+
+    struct Slot
+    {
+        vk::Buffer buffer;
+        Allocation mem;
+        vk::DeviceSize capacity;
+        SlotState state;
+        uint32_t frame;
+        uint64_t frameNumber;
+        vk::Format format;
+        vk::Extent2D extent;
+    };
+
+    void Allocate(Slot &slot, vk::DeviceSize size);
+    void Free(Slot &slot);
+    void TakeRequest();
+    void WriterMain();
+    void Write(const Slot &slot);
+
+    vk::Device device;
+    MemoryAllocator *allocator;
+    vk::DeviceSize atomSize;
+    std::string pathPrefix;
+    CaptureFormat format;
+    std::atomic<uint32_t> requested;
+
+    // Slot states are shared with the writer
+    std::mutex mutex;
+    std::vector<Slot> slots;
+
+    std::thread writer;
+    std::condition_variable writerWake;
+    std::deque<uint32_t> writes;
+    bool writerQuit;
+    // Only touched by the writer
+    std::vector<uint8_t> scratch;
+    std::vector<uint8_t> encoded;
+    std::ofstream stream;
+    std::string streamPath;
+
+    std::atomic<uint64_t> recorded;
+    std::atomic<uint64_t> written;
+    std::atomic<uint64_t> dropped;
+    std::atomic<bool> skipLogged;
+};
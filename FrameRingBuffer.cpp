@@ -0,0 +1,128 @@
+#include "FrameRingBuffer.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+FrameRingBuffer::FrameRingBuffer()
+    : allocator(nullptr), coherent(true), alignment(1), atomSize(1), frameSize(0), frameStart(0), head(0)
+{
+}
+
+FrameRingBuffer::~FrameRingBuffer()
+{
+    Destroy();
+}
+
+void FrameRingBuffer::Init(
+    vk::Device device,
+    MemoryAllocator &allocator,
+    const vk::PhysicalDeviceLimits &limits,
+    uint32_t frameCount,
+    vk::DeviceSize frameSize,
+    vk::BufferUsageFlags usage)
+{
+    this->device = device;
+    this->allocator = &allocator;
+
+    // Non-coherent flushes work in whole atoms, so frames start on an atom too
+    atomSize = std::max<vk::DeviceSize>(limits.nonCoherentAtomSize, 1);
+    alignment = std::max<vk::DeviceSize>(
+        std::max(limits.minUniformBufferOffsetAlignment, limits.minStorageBufferOffsetAlignment), 4);
+    this->frameSize = AlignUp(frameSize, std::max(alignment, atomSize));
+
+    auto bufferInfo = vk::BufferCreateInfo()
+        .setSize(this->frameSize * frameCount)
+        .setUsage(usage)
+        .setSharingMode(vk::SharingMode::eExclusive);
+    buffer = device.createBuffer(bufferInfo);
+
+    // Coherent memory if there is any, otherwise any host visible memory and flush by hand
+    auto memReqs = device.getBufferMemoryRequirements(buffer);
+    memReqs.alignment = std::max(memReqs.alignment, atomSize);
+    memReqs.size = AlignUp(memReqs.size, atomSize);
+    vk::MemoryPropertyFlags flags = vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
+    if (!allocator.HasMemoryType(memReqs.memoryTypeBits, flags))
+        flags = vk::MemoryPropertyFlagBits::eHostVisible;
+    mem = allocator.Allocate(memReqs, flags, AllocationTiling::Linear);
+    device.bindBufferMemory(buffer, mem.memory, mem.offset);
+
+    auto &memoryType = allocator.GetProperties().memoryTypes[mem.memoryType];
+    coherent = (bool)(memoryType.propertyFlags & vk::MemoryPropertyFlagBits::eHostCoherent);
+
+    frameStart = 0;
+    head = 0;
+}
+
+void FrameRingBuffer::Destroy()
+{
+    if (!buffer)
+        return;
+
+    device.destroyBuffer(buffer);
+    allocator->Free(mem);
+    buffer = nullptr;
+}
+
+void FrameRingBuffer::BeginFrame(uint32_t frame)
+{
+    frameStart = frame * frameSize;
+    head = frameStart;
+}
+
+RingAllocation FrameRingBuffer::Allocate(vk::DeviceSize size, vk::DeviceSize alignment)
+{
+    alignment = std::max(alignment, this->alignment);
+
+    // Several threads record draws at once, so bump with a compare and swap
+    auto offset = head.load(std::memory_order_relaxed);
+    vk::DeviceSize start;
+    do
+    {
+        start = AlignUp(offset, alignment);
+        if (start + size > frameStart + frameSize)
+            throw std::runtime_error{ "Frame ring buffer is full" };
+    } while (!head.compare_exchange_weak(offset, start + size, std::memory_order_relaxed));
+
+    return RingAllocation{ buffer, (uint32_t)start, mem.mapped + start };
+}
+
+RingAllocation FrameRingBuffer::Push(const void *data, vk::DeviceSize size, vk::DeviceSize alignment)
+{
+    auto allocation = Allocate(size, alignment);
+    memcpy(allocation.mapped, data, (size_t)size);
+    return allocation;
+}
+
+void FrameRingBuffer::Flush()
+{
+    auto end = head.load();
+    if (coherent || end == frameStart)
+        return;
+
+    // Frames start on an atom and the buffer ends on one, so rounding up stays inside it
+    auto range = vk::MappedMemoryRange()
+        .setMemory(mem.memory)
+        .setOffset(mem.offset + frameStart)
+        .setSize(AlignUp(end - frameStart, atomSize));
+    device.flushMappedMemoryRanges(range);
+}
+
+vk::Buffer FrameRingBuffer::GetBuffer() const
+{
+    return buffer;
+}
+
+vk::DescriptorBufferInfo FrameRingBuffer::GetDescriptorInfo(vk::DeviceSize range) const
+{
+    return vk::DescriptorBufferInfo(buffer, 0, range);
+}
+
+vk::DeviceSize FrameRingBuffer::GetFrameUsage() const
+{
+    return head.load() - frameStart;
+}
+
+bool FrameRingBuffer::IsCoherent() const
+{
+    return coherent;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "MemoryAllocator.h"
+#include <vulkan/vk_cpp.h>
+#include <atomic>
+#include <cstdint>
+
+struct RingAllocation
+{
+    vk::Buffer buffer;
+    // From the start of the buffer, use it as the dynamic offset when binding
+    uint32_t offset;
+    uint8_t *mapped;
+};
+
+// A persistently mapped buffer split into one region per frame in flight.
+// Allocations are a pointer bump into the current frame's region, and a region
+// is only reused once its frame's fence has signaled, so nothing is ever freed.
+// Allocate is safe to call from several threads.
+class FrameRingBuffer
+{
+public:
+    FrameRingBuffer();
+    ~FrameRingBuffer();
+
+    // Every allocation is aligned for dynamic uniform and storage buffer offsets
+    void Init(
+        vk::Device device,
+        MemoryAllocator &allocator,
+        const vk::PhysicalDeviceLimits &limits,
+        uint32_t frameCount,
+        vk::DeviceSize frameSize,
+        vk::BufferUsageFlags usage = vk::BufferUsageFlagBits::eUniformBuffer |
+            vk::BufferUsageFlagBits::eStorageBuffer |
+            vk::BufferUsageFlagBits::eVertexBuffer |
+            vk::BufferUsageFlagBits::eIndexBuffer
+    );
+    void Destroy();
+
+    // Start handing out the frame's region, its previous use has to have completed
+    void BeginFrame(uint32_t frame);
+    // Throws when the frame's region is full
+    RingAllocation Allocate(vk::DeviceSize size, vk::DeviceSize alignment = 0);
+    // Copies data into a new allocation
+    RingAllocation Push(const void *data, vk::DeviceSize size, vk::DeviceSize alignment = 0);
+    // Make this frame's writes visible to the device, only does anything on non-coherent memory
+    void Flush();
+
+    vk::Buffer GetBuffer() const;
+    // For a dynamic uniform or storage buffer descriptor, the offset comes from each allocation
+    vk::DescriptorBufferInfo GetDescriptorInfo(vk::DeviceSize range) const;
+    // Bytes used by the current frame so far
+    vk::DeviceSize GetFrameUsage() const;
+    bool IsCoherent() const;
+
+private:
+    vk::Device device;
+    MemoryAllocator *allocator;
+    vk::Buffer buffer;
+    Allocation mem;
+    bool coherent;
+    vk::DeviceSize alignment;
+    vk::DeviceSize atomSize;
+    vk::DeviceSize frameSize;
+    vk::DeviceSize frameStart;
+    std::atomic<vk::DeviceSize> head;
+};
@@ -0,0 +1,29 @@
+#include "Frustum.h"
+#include <cmath>
+
+void ExtractFrustumPlanes(const float viewProj[16], float planes[6][4])
+{
+    // Gribb and Hartmann, each plane is the w row plus or minus another row
+    auto m = [viewProj](int row, int col) { return viewProj[col * 4 + row]; };
+    for (int col = 0; col < 4; ++col)
+    {
+        planes[0][col] = m(3, col) + m(0, col);
+        planes[1][col] = m(3, col) - m(0, col);
+        planes[2][col] = m(3, col) + m(1, col);
+        planes[3][col] = m(3, col) - m(1, col);
+        // Depth runs from 0 to w, so near is the z row on its own
+        planes[4][col] = m(2, col);
+        planes[5][col] = m(3, col) - m(2, col);
+    }
+
+    for (int i = 0; i < 6; ++i)
+    {
+        auto plane = planes[i];
+        auto length = std::sqrt(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+        if (length > 0.0f)
+        {
+            for (int col = 0; col < 4; ++col)
+                plane[col] /= length;
+        }
+    }
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+// Clip space planes of a column major view projection with depth from 0 to 1,
+// normalized and pointing inwards: left, right, bottom, top, near, far.
+// A point is inside when dot(plane.xyz, p) + plane.w >= 0 for all six.
+void ExtractFrustumPlanes(const float viewProj[16], float planes[6][4]);
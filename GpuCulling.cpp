@@ -0,0 +1,366 @@
+#include "GpuCulling.h"
+#include "Frustum.h"
+#include "Log.h"
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <stdexcept>
+
+static const vk::DeviceSize CommandSize = sizeof(VkDrawIndexedIndirectCommand);
+
+GpuCulling::GpuCulling()
+    : allocator(nullptr), features(), frameCount(0), maxInstances(0), maxGroups(0), storageAlignment(1),
+#ifdef VK_KHR_draw_indirect_count
+    drawIndexedIndirectCount(nullptr),
+#endif
+    params(), viewProj(), lastViewProj(), hasLastViewProj(false), frame(0)
+{
+}
+
+GpuCulling::~GpuCulling()
+{
+    Destroy();
+}
+
+void GpuCulling::Init(
+    vk::Device device,
+    vk::PhysicalDevice physicalDevice,
+    MemoryAllocator &allocator,
+    vk::ShaderModule shader,
+    vk::PipelineCache pipelineCache,
+    const GpuCullingFeatures &features,
+    uint32_t frameCount,
+    uint32_t maxInstances,
+    uint32_t maxGroups)
+{
+    this->device = device;
+    this->allocator = &allocator;
+    this->features = features;
+    this->frameCount = frameCount;
+    this->maxInstances = maxInstances;
+    this->maxGroups = maxGroups;
+
+    if (!shader)
+        return;
+    if (!features.drawIndirectFirstInstance)
+    {
+        Log("GPU culling is off, the device can't pass instance indices through indirect draws");
+        return;
+    }
+
+#ifdef VK_KHR_draw_indirect_count
+    if (features.drawIndirectCount)
+        drawIndexedIndirectCount = (PFN_vkCmdDrawIndexedIndirectCountKHR)vkGetDeviceProcAddr((VkDevice)device, "vkCmdDrawIndexedIndirectCountKHR");
+    this->features.drawIndirectCount = drawIndexedIndirectCount != nullptr;
+#else
+    this->features.drawIndirectCount = false;
+#endif
+
+    // Every frame in flight gets its own commands and counts
+    storageAlignment = physicalDevice.getProperties().limits.minStorageBufferOffsetAlignment;
+    auto usage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer | vk::BufferUsageFlagBits::eTransferDst;
+    commands = device.createBuffer(vk::BufferCreateInfo()
+        .setSize(GetCommandOffset(frameCount))
+        .setUsage(usage)
+        .setSharingMode(vk::SharingMode::eExclusive));
+    commandsMem = allocator.AllocateBuffer(commands, vk::MemoryPropertyFlagBits::eDeviceLocal);
+    counts = device.createBuffer(vk::BufferCreateInfo()
+        .setSize(GetCountOffset(frameCount))
+        .setUsage(usage)
+        .setSharingMode(vk::SharingMode::eExclusive));
+    countsMem = allocator.AllocateBuffer(counts, vk::MemoryPropertyFlagBits::eDeviceLocal);
+
+    // Instances, draws, commands and counts, then the Hi-Z pyramid and its parameters
+    std::vector<vk::DescriptorSetLayoutBinding> bindings;
+    for (uint32_t binding = 0; binding < 6; ++binding)
+    {
+        auto type = binding < 4 ? vk::DescriptorType::eStorageBuffer
+            : binding == 4 ? vk::DescriptorType::eCombinedImageSampler
+            : vk::DescriptorType::eUniformBuffer;
+        bindings.push_back(vk::DescriptorSetLayoutBinding()
+            .setBinding(binding)
+            .setDescriptorType(type)
+            .setDescriptorCount(1)
+            .setStageFlags(vk::ShaderStageFlagBits::eCompute));
+    }
+    setLayout = device.createDescriptorSetLayout(vk::DescriptorSetLayoutCreateInfo()
+        .setBindingCount((uint32_t)bindings.size())
+        .setPBindings(bindings.data()));
+
+    auto pushRange = vk::PushConstantRange()
+        .setStageFlags(vk::ShaderStageFlagBits::eCompute)
+        .setSize(sizeof(PushConstants));
+    pipelineLayout = device.createPipelineLayout(vk::PipelineLayoutCreateInfo()
+        .setSetLayoutCount(1)
+        .setPSetLayouts(&setLayout)
+        .setPushConstantRangeCount(1)
+        .setPPushConstantRanges(&pushRange));
+
+    auto pipelineInfo = vk::ComputePipelineCreateInfo()
+        .setStage(vk::PipelineShaderStageCreateInfo()
+            .setStage(vk::ShaderStageFlagBits::eCompute)
+            .setModule(shader)
+            .setPName("main"))
+        .setLayout(pipelineLayout);
+    auto result = device.createComputePipelines(pipelineCache, 1, &pipelineInfo, nullptr, &pipeline);
+    if (result != vk::Result::eSuccess)
+        throw std::runtime_error{ "Failed to create the culling pipeline" };
+
+    Log(std::string{ "GPU culling draws with " } + (this->features.drawIndirectCount ? "compacted indirect counts" : "fixed size indirect draws"));
+}
+
+void GpuCulling::Destroy()
+{
+    if (!device)
+        return;
+
+    if (pipeline)
+        device.destroyPipeline(pipeline);
+    if (pipelineLayout)
+        device.destroyPipelineLayout(pipelineLayout);
+    if (setLayout)
+        device.destroyDescriptorSetLayout(setLayout);
+    if (commands)
+    {
+        device.destroyBuffer(commands);
+        allocator->Free(commandsMem);
+        device.destroyBuffer(counts);
+        allocator->Free(countsMem);
+    }
+    pipeline = nullptr;
+    pipelineLayout = nullptr;
+    setLayout = nullptr;
+    commands = nullptr;
+    counts = nullptr;
+    device = nullptr;
+}
+
+bool GpuCulling::IsEnabled() const
+{
+    return !!pipeline;
+}
+
+void GpuCulling::SetInstances(const std::vector<CullInstance> &instances, const std::vector<CullDraw> &draws)
+{
+    if (instances.size() > maxInstances)
+        throw std::runtime_error{ "Too many instances for GPU culling" };
+
+    // Every group gets a run of commands big enough for all of its instances
+    uint32_t groups = 0;
+    for (auto &draw : draws)
+        groups = std::max(groups, draw.group + 1);
+    if (groups > maxGroups)
+        throw std::runtime_error{ "Too many draw groups for GPU culling" };
+
+    groupCount.assign(groups, 0);
+    for (auto &instance : instances)
+    {
+        if (instance.draw >= draws.size())
+            throw std::runtime_error{ "Instance uses a draw that doesn't exist" };
+        ++groupCount[draws[instance.draw].group];
+    }
+
+    groupFirst.assign(groups, 0);
+    for (uint32_t group = 1; group < groups; ++group)
+        groupFirst[group] = groupFirst[group - 1] + groupCount[group - 1];
+
+    this->draws.clear();
+    for (auto &draw : draws)
+    {
+        GpuDraw gpuDraw = {};
+        gpuDraw.indexCount = draw.indexCount;
+        gpuDraw.firstIndex = draw.firstIndex;
+        gpuDraw.vertexOffset = draw.vertexOffset;
+        gpuDraw.group = draw.group;
+        gpuDraw.segmentFirst = groupFirst[draw.group];
+        this->draws.push_back(gpuDraw);
+    }
+
+    // Without compaction each instance keeps its own command slot within its group
+    std::vector<uint32_t> next = groupFirst;
+    this->instances.clear();
+    for (auto &instance : instances)
+    {
+        GpuInstance gpuInstance = {};
+        memcpy(gpuInstance.sphere, instance.center, sizeof(instance.center));
+        gpuInstance.sphere[3] = instance.radius;
+        gpuInstance.draw = instance.draw;
+        gpuInstance.slot = next[draws[instance.draw].group]++;
+        this->instances.push_back(gpuInstance);
+    }
+}
+
+void GpuCulling::SetViewProjection(const float viewProj[16])
+{
+    memcpy(this->viewProj, viewProj, sizeof(this->viewProj));
+    ExtractFrustumPlanes(viewProj, params.planes);
+}
+
+void GpuCulling::Cull(vk::CommandBuffer commandBuffer, uint32_t frame, FrameRingBuffer &frameData, DescriptorHeap &descriptors, HiZBuffer &hiz)
+{
+    this->frame = frame;
+    if (!pipeline || instances.empty())
+    {
+        hasLastViewProj = false;
+        return;
+    }
+
+    // The pyramid is the last frame's depth, so boxes are projected the way that frame saw them
+    OcclusionParams occlusion;
+    memcpy(occlusion.viewProj, lastViewProj, sizeof(lastViewProj));
+    occlusion.size[0] = (float)hiz.GetExtent().width;
+    occlusion.size[1] = (float)hiz.GetExtent().height;
+    occlusion.mipCount = hiz.GetMipCount();
+    occlusion.enabled = hiz.IsBuilt() && hasLastViewProj ? 1 : 0;
+    memcpy(lastViewProj, viewProj, sizeof(viewProj));
+    hasLastViewProj = true;
+
+    auto instanceSize = instances.size() * sizeof(GpuInstance);
+    auto drawSize = draws.size() * sizeof(GpuDraw);
+    auto instanceData = frameData.Push(instances.data(), instanceSize, storageAlignment);
+    auto drawData = frameData.Push(draws.data(), drawSize, storageAlignment);
+    auto occlusionData = frameData.Push(&occlusion, sizeof(occlusion));
+
+    vk::DescriptorBufferInfo buffers[5] =
+    {
+        vk::DescriptorBufferInfo(instanceData.buffer, instanceData.offset, instanceSize),
+        vk::DescriptorBufferInfo(drawData.buffer, drawData.offset, drawSize),
+        vk::DescriptorBufferInfo(commands, GetCommandOffset(frame), instances.size() * CommandSize),
+        vk::DescriptorBufferInfo(counts, GetCountOffset(frame), maxGroups * sizeof(uint32_t)),
+        vk::DescriptorBufferInfo(occlusionData.buffer, occlusionData.offset, sizeof(occlusion)),
+    };
+    auto pyramid = vk::DescriptorImageInfo()
+        .setSampler(hiz.GetSampler())
+        .setImageView(hiz.GetView())
+        .setImageLayout(vk::ImageLayout::eGeneral);
+
+    auto set = descriptors.AllocateTransient(setLayout);
+    std::vector<vk::WriteDescriptorSet> writes;
+    for (uint32_t binding = 0; binding < 4; ++binding)
+    {
+        writes.push_back(vk::WriteDescriptorSet()
+            .setDstSet(set)
+            .setDstBinding(binding)
+            .setDescriptorCount(1)
+            .setDescriptorType(vk::DescriptorType::eStorageBuffer)
+            .setPBufferInfo(&buffers[binding]));
+    }
+    writes.push_back(vk::WriteDescriptorSet()
+        .setDstSet(set)
+        .setDstBinding(4)
+        .setDescriptorCount(1)
+        .setDescriptorType(vk::DescriptorType::eCombinedImageSampler)
+        .setPImageInfo(&pyramid));
+    writes.push_back(vk::WriteDescriptorSet()
+        .setDstSet(set)
+        .setDstBinding(5)
+        .setDescriptorCount(1)
+        .setDescriptorType(vk::DescriptorType::eUniformBuffer)
+        .setPBufferInfo(&buffers[4]));
+    device.updateDescriptorSets(writes, nullptr);
+
+    // Compacted groups count up from zero
+    if (features.drawIndirectCount)
+    {
+        commandBuffer.fillBuffer(counts, GetCountOffset(frame), groupCount.size() * sizeof(uint32_t), 0);
+        auto barrier = vk::BufferMemoryBarrier()
+            .setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+            .setDstAccessMask(vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite)
+            .setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+            .setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+            .setBuffer(counts)
+            .setOffset(GetCountOffset(frame))
+            .setSize(groupCount.size() * sizeof(uint32_t));
+        commandBuffer.pipelineBarrier(
+            vk::PipelineStageFlagBits::eTransfer,
+            vk::PipelineStageFlagBits::eComputeShader,
+            vk::DependencyFlags(),
+            nullptr,
+            barrier,
+            nullptr
+        );
+    }
+
+    params.instanceCount = (uint32_t)instances.size();
+    params.compact = features.drawIndirectCount ? 1 : 0;
+    commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline);
+    commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, pipelineLayout, 0, set, nullptr);
+    vkCmdPushConstants((VkCommandBuffer)commandBuffer, (VkPipelineLayout)pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(params), &params);
+    commandBuffer.dispatch((params.instanceCount + 63) / 64, 1, 1);
+
+    // The draws read the commands and counts as indirect arguments
+    std::array<vk::BufferMemoryBarrier, 2> barriers =
+    {
+        vk::BufferMemoryBarrier()
+            .setSrcAccessMask(vk::AccessFlagBits::eShaderWrite)
+            .setDstAccessMask(vk::AccessFlagBits::eIndirectCommandRead)
+            .setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+            .setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+            .setBuffer(commands)
+            .setOffset(GetCommandOffset(frame))
+            .setSize(instances.size() * CommandSize),
+        vk::BufferMemoryBarrier()
+            .setSrcAccessMask(vk::AccessFlagBits::eShaderWrite)
+            .setDstAccessMask(vk::AccessFlagBits::eIndirectCommandRead)
+            .setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+            .setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+            .setBuffer(counts)
+            .setOffset(GetCountOffset(frame))
+            .setSize(maxGroups * sizeof(uint32_t)),
+    };
+    commandBuffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eComputeShader,
+        vk::PipelineStageFlagBits::eDrawIndirect,
+        vk::DependencyFlags(),
+        nullptr,
+        barriers,
+        nullptr
+    );
+}
+
+void GpuCulling::Draw(vk::CommandBuffer commandBuffer, uint32_t group)
+{
+    if (!pipeline || group >= groupCount.size() || groupCount[group] == 0)
+        return;
+
+    auto offset = GetCommandOffset(frame) + groupFirst[group] * CommandSize;
+#ifdef VK_KHR_draw_indirect_count
+    if (features.drawIndirectCount)
+    {
+        drawIndexedIndirectCount(
+            (VkCommandBuffer)commandBuffer,
+            (VkBuffer)commands,
+            offset,
+            (VkBuffer)counts,
+            GetCountOffset(frame) + group * sizeof(uint32_t),
+            groupCount[group],
+            (uint32_t)CommandSize
+        );
+        return;
+    }
+#endif
+
+    // Culled instances are still drawn, with an instance count of 0
+    if (features.multiDrawIndirect)
+    {
+        commandBuffer.drawIndexedIndirect(commands, offset, groupCount[group], (uint32_t)CommandSize);
+        return;
+    }
+    for (uint32_t i = 0; i < groupCount[group]; ++i)
+        commandBuffer.drawIndexedIndirect(commands, offset + i * CommandSize, 1, (uint32_t)CommandSize);
+}
+
+uint32_t GpuCulling::GetGroupCount() const
+{
+    return (uint32_t)groupCount.size();
+}
+
+vk::DeviceSize GpuCulling::GetCommandOffset(uint32_t frame) const
+{
+    return frame * AlignUp(maxInstances * CommandSize, storageAlignment);
+}
+
+vk::DeviceSize GpuCulling::GetCountOffset(uint32_t frame) const
+{
+    return frame * AlignUp(maxGroups * sizeof(uint32_t), storageAlignment);
+}
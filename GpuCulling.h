@@ -0,0 +1,154 @@
+#pragma once
+
+#include "DescriptorHeap.h"
+#include "FrameRingBuffer.h"
+#include "HiZBuffer.h"
+#include "MemoryAllocator.h"
+#include <vulkan/vk_cpp.h>
+#include <cstdint>
+#include <vector>
+
+// A mesh range that instances draw. Draws with the same group are issued with
+// one indirect call, so a group is everything drawn with the same pipeline.
+struct CullDraw
+{
+    uint32_t indexCount;
+    uint32_t firstIndex;
+    int32_t vertexOffset;
+    uint32_t group;
+};
+
+struct CullInstance
+{
+    // World space bounding sphere
+    float center[3];
+    float radius;
+    uint32_t draw;
+};
+
+// What the device can do, worked out when the device is created
+struct GpuCullingFeatures
+{
+    // VK_KHR_draw_indirect_count, visible draws are compacted and counted on the GPU
+    bool drawIndirectCount;
+    bool multiDrawIndirect;
+    bool drawIndirectFirstInstance;
+};
+
+// Culls instances on the GPU and draws the survivors with indirect draws, so
+// the CPU cost doesn't grow with the number of instances. A compute pass tests
+// every instance against the frustum, then against the Hi-Z pyramid of the last
+// frame's depth, and writes one VkDrawIndexedIndirectCommand
+// per visible instance, then each group is drawn with a single call. The
+// instance index is passed as firstInstance for the vertex shader to look up.
+//
+// With draw indirect count the commands are compacted and the count read on the
+// GPU. Without it every instance keeps a slot and culled ones get an instance
+// count of 0.
+class GpuCulling
+{
+public:
+    GpuCulling();
+    ~GpuCulling();
+
+    // No-op if the shader is null or the device can't pass instance indices.
+    // The pipeline is compiled against the given cache.
+    void Init(
+        vk::Device device,
+        vk::PhysicalDevice physicalDevice,
+        MemoryAllocator &allocator,
+        vk::ShaderModule shader,
+        vk::PipelineCache pipelineCache,
+        const GpuCullingFeatures &features,
+        uint32_t frameCount,
+        uint32_t maxInstances = 65536,
+        uint32_t maxGroups = 256
+    );
+    void Destroy();
+
+    bool IsEnabled() const;
+
+    // Kept until replaced, every instance is culled and drawn each frame
+    void SetInstances(const std::vector<CullInstance> &instances, const std::vector<CullDraw> &draws);
+    // Column major, clip space depth from 0 to 1
+    void SetViewProjection(const float viewProj[16]);
+
+    // Record the culling pass, outside any render pass. Instances are copied
+    // into the frame data, the descriptor set comes from the frame's transient pool.
+    // Occlusion is only tested once the pyramid has been built.
+    void Cull(vk::CommandBuffer commandBuffer, uint32_t frame, FrameRingBuffer &frameData, DescriptorHeap &descriptors, HiZBuffer &hiz);
+    // Draw a group's survivors, with its pipeline and vertex and index buffers already bound
+    void Draw(vk::CommandBuffer commandBuffer, uint32_t group);
+    uint32_t GetGroupCount() const;
+
+private:
+    // Matches the structs in cull.comp
+    struct GpuInstance
+    {
+        float sphere[4];
+        uint32_t draw;
+        uint32_t slot;
+        uint32_t pad[2];
+    };
+
+    struct GpuDraw
+    {
+        uint32_t indexCount;
+        uint32_t firstIndex;
+        int32_t vertexOffset;
+        uint32_t group;
+        uint32_t segmentFirst;
+        uint32_t pad[3];
+    };
+
+    struct PushConstants
+    {
+        float planes[6][4];
+        uint32_t instanceCount;
+        uint32_t compact;
+    };
+
+    struct OcclusionParams
+    {
+        float viewProj[16];
+        float size[2];
+        uint32_t mipCount;
+        uint32_t enabled;
+    };
+
+    vk::DeviceSize GetCommandOffset(uint32_t frame) const;
+    vk::DeviceSize GetCountOffset(uint32_t frame) const;
+
+    vk::Device device;
+    MemoryAllocator *allocator;
+    GpuCullingFeatures features;
+    uint32_t frameCount;
+    uint32_t maxInstances;
+    uint32_t maxGroups;
+    vk::DeviceSize storageAlignment;
+#ifdef VK_KHR_draw_indirect_count
+    PFN_vkCmdDrawIndexedIndirectCountKHR drawIndexedIndirectCount;
+#endif
+
+    vk::DescriptorSetLayout setLayout;
+    vk::PipelineLayout pipelineLayout;
+    vk::Pipeline pipeline;
+
+    // Per frame regions, written by the culling pass and read by the draws
+    vk::Buffer commands;
+    Allocation commandsMem;
+    vk::Buffer counts;
+    Allocation countsMem;
+
+    std::vector<GpuInstance> instances;
+    std::vector<GpuDraw> draws;
+    // Per group, which commands it owns
+    std::vector<uint32_t> groupFirst;
+    std::vector<uint32_t> groupCount;
+    PushConstants params;
+    float viewProj[16];
+    // What the last culled frame was drawn with, the pyramid comes from that frame
+    float lastViewProj[16];
+    bool hasLastViewProj;
+    uint32_t frame;
+};
@@ -0,0 +1,236 @@
+#include "GpuProfiler.h"
+#include "FileUtil.h"
+#include <algorithm>
+#include <sstream>
+
+// Rolling statistics cover this many samples per scope
+static const size_t SampleWindow = 120;
+// Oldest trace events are dropped past this
+static const size_t MaxTraceEvents = 200000;
+
+static std::string EscapeJson(const std::string &str)
+{
+    std::string escaped;
+    for (auto c : str)
+    {
+        if (c == '"' || c == '\\')
+            escaped += '\\';
+        escaped += c;
+    }
+    return escaped;
+}
+
+GpuProfiler::GpuProfiler()
+    : nsPerTick(0.0), timestampMask(0), maxScopes(0), firstTimestamp(0)
+{
+}
+
+GpuProfiler::~GpuProfiler()
+{
+    Destroy();
+}
+
+void GpuProfiler::Init(
+    vk::Device device,
+    float timestampPeriod,
+    uint32_t timestampValidBits,
+    uint32_t slotCount,
+    uint32_t maxScopes)
+{
+    if (timestampValidBits == 0)
+        return;
+
+    this->device = device;
+    this->maxScopes = maxScopes;
+    nsPerTick = timestampPeriod;
+    timestampMask = timestampValidBits >= 64 ? UINT64_MAX : (1ull << timestampValidBits) - 1;
+
+    // Every scope needs a begin and an end timestamp
+    auto poolInfo = vk::QueryPoolCreateInfo()
+        .setQueryType(vk::QueryType::eTimestamp)
+        .setQueryCount(slotCount * maxScopes * 2);
+    queryPool = device.createQueryPool(poolInfo);
+
+    slots.resize(slotCount);
+    for (auto &slot : slots)
+    {
+        slot.frame = 0;
+        slot.track = nullptr;
+        slot.recording = false;
+    }
+}
+
+void GpuProfiler::Destroy()
+{
+    if (device && queryPool)
+        device.destroyQueryPool(queryPool);
+    queryPool = nullptr;
+    slots.clear();
+}
+
+bool GpuProfiler::IsEnabled() const
+{
+    return !!queryPool;
+}
+
+void GpuProfiler::BeginSlot(vk::CommandBuffer commandBuffer, uint32_t slotIndex, uint64_t frame, const char *track)
+{
+    if (!queryPool)
+        return;
+
+    auto &slot = slots[slotIndex];
+    Resolve(slot, slotIndex);
+
+    slot.frame = frame;
+    slot.track = track;
+    slot.recording = true;
+    commandBuffer.resetQueryPool(queryPool, slotIndex * maxScopes * 2, maxScopes * 2);
+}
+
+uint32_t GpuProfiler::BeginScope(vk::CommandBuffer commandBuffer, uint32_t slotIndex, const char *name)
+{
+    if (!queryPool || !slots[slotIndex].recording)
+        return InvalidScope;
+
+    auto &slot = slots[slotIndex];
+    if (slot.scopes.size() == maxScopes)
+        return InvalidScope;
+
+    auto scope = (uint32_t)slot.scopes.size();
+    slot.scopes.push_back(name);
+    commandBuffer.writeTimestamp(
+        vk::PipelineStageFlagBits::eTopOfPipe,
+        queryPool,
+        (slotIndex * maxScopes + scope) * 2
+    );
+    return scope;
+}
+
+void GpuProfiler::EndScope(vk::CommandBuffer commandBuffer, uint32_t slotIndex, uint32_t scope)
+{
+    if (scope == InvalidScope)
+        return;
+
+    commandBuffer.writeTimestamp(
+        vk::PipelineStageFlagBits::eBottomOfPipe,
+        queryPool,
+        (slotIndex * maxScopes + scope) * 2 + 1
+    );
+}
+
+void GpuProfiler::Resolve(uint32_t slotIndex)
+{
+    if (!queryPool)
+        return;
+    Resolve(slots[slotIndex], slotIndex);
+}
+
+std::vector<GpuScopeStats> GpuProfiler::GetStats() const
+{
+    std::lock_guard<std::mutex> lock{ resultsMutex };
+    std::vector<GpuScopeStats> stats;
+    for (auto &entry : samples)
+    {
+        auto &recent = entry.second.recentMs;
+        if (recent.empty())
+            continue;
+
+        GpuScopeStats scope;
+        scope.name = entry.first;
+        scope.samples = entry.second.count;
+        scope.lastMs = recent.back();
+        scope.minMs = *std::min_element(recent.begin(), recent.end());
+        scope.maxMs = *std::max_element(recent.begin(), recent.end());
+        scope.avgMs = 0.0;
+        for (auto ms : recent)
+            scope.avgMs += ms;
+        scope.avgMs /= recent.size();
+        stats.push_back(scope);
+    }
+    return stats;
+}
+
+bool GpuProfiler::WriteChromeTrace(const std::string &path) const
+{
+    // Formatting a full trace takes a while, so only copying it holds up resolving
+    std::deque<TraceEvent> events;
+    {
+        std::lock_guard<std::mutex> lock{ resultsMutex };
+        events = trace;
+    }
+
+    std::ostringstream json;
+    json << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+    bool first = true;
+    for (auto &event : events)
+    {
+        if (!first)
+            json << ",";
+        first = false;
+
+        json << "{\"name\":\"" << EscapeJson(event.name) << "\""
+            << ",\"cat\":\"gpu\",\"ph\":\"X\",\"pid\":1"
+            << ",\"tid\":\"" << event.track << "\""
+            << ",\"ts\":" << event.startUs
+            << ",\"dur\":" << event.durationUs
+            << ",\"args\":{\"frame\":" << event.frame << "}}";
+    }
+    json << "]}";
+
+    auto str = json.str();
+    return WriteFileAtomic(path, str.data(), str.size());
+}
+
+void GpuProfiler::Resolve(Slot &slot, uint32_t slotIndex)
+{
+    if (!slot.recording || slot.scopes.empty())
+    {
+        slot.scopes.clear();
+        return;
+    }
+
+    // Not waiting, if the results somehow aren't there yet the frame is dropped
+    std::vector<uint64_t> timestamps(slot.scopes.size() * 2);
+    auto result = device.getQueryPoolResults(
+        queryPool,
+        slotIndex * maxScopes * 2,
+        (uint32_t)timestamps.size(),
+        timestamps.size() * sizeof(uint64_t),
+        timestamps.data(),
+        sizeof(uint64_t),
+        vk::QueryResultFlagBits::e64
+    );
+
+    if (result == vk::Result::eSuccess)
+    {
+        std::lock_guard<std::mutex> lock{ resultsMutex };
+        for (size_t i = 0; i < slot.scopes.size(); ++i)
+        {
+            auto begin = timestamps[i * 2] & timestampMask;
+            auto end = timestamps[i * 2 + 1] & timestampMask;
+            if (firstTimestamp == 0)
+                firstTimestamp = begin;
+
+            auto durationMs = (double)((end - begin) & timestampMask) * nsPerTick / 1e6;
+            auto &scopeSamples = samples[slot.scopes[i]];
+            scopeSamples.count++;
+            scopeSamples.recentMs.push_back(durationMs);
+            if (scopeSamples.recentMs.size() > SampleWindow)
+                scopeSamples.recentMs.pop_front();
+
+            TraceEvent event;
+            event.name = slot.scopes[i];
+            event.track = slot.track;
+            event.frame = slot.frame;
+            event.startUs = (double)((begin - firstTimestamp) & timestampMask) * nsPerTick / 1e3;
+            event.durationUs = durationMs * 1e3;
+            trace.push_back(event);
+            if (trace.size() > MaxTraceEvents)
+                trace.pop_front();
+        }
+    }
+
+    slot.scopes.clear();
+    slot.recording = false;
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <vulkan/vk_cpp.h>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct GpuScopeStats
+{
+    std::string name;
+    uint64_t samples;
+    // Over the last few samples, in milliseconds
+    double lastMs;
+    double avgMs;
+    double minMs;
+    double maxMs;
+};
+
+// Timestamp query based GPU timing. Each slot owns a range of queries that is
+// written by one command buffer at a time and read back when the slot is
+// reused, by which point the GPU is done with it and reading never stalls.
+// Scopes have to be recorded on the thread that owns the command buffer.
+class GpuProfiler
+{
+public:
+    static const uint32_t InvalidScope = UINT32_MAX;
+
+    GpuProfiler();
+    ~GpuProfiler();
+
+    // timestampValidBits comes from the queue family, 0 disables profiling
+    void Init(
+        vk::Device device,
+        float timestampPeriod,
+        uint32_t timestampValidBits,
+        uint32_t slotCount,
+        uint32_t maxScopes = 64
+    );
+    void Destroy();
+
+    // False when the queue can't write timestamps
+    bool IsEnabled() const;
+
+    // Resolve the slot's previous scopes and start recording new ones. The GPU
+    // has to be done with the slot's previous command buffer.
+    void BeginSlot(vk::CommandBuffer commandBuffer, uint32_t slot, uint64_t frame, const char *track);
+    uint32_t BeginScope(vk::CommandBuffer commandBuffer, uint32_t slot, const char *name);
+    void EndScope(vk::CommandBuffer commandBuffer, uint32_t slot, uint32_t scope);
+    // Read back a slot's scopes without starting new ones, for slots that aren't
+    // reused every frame. The GPU has to be done with the slot's command buffer.
+    void Resolve(uint32_t slot);
+
+    // Safe to call from any thread while frames are being resolved
+    std::vector<GpuScopeStats> GetStats() const;
+    // Chrome trace event JSON, also loads in Perfetto
+    bool WriteChromeTrace(const std::string &path) const;
+
+private:
+    struct Slot
+    {
+        uint64_t frame;
+        const char *track;
+        std::vector<std::string> scopes;
+        bool recording;
+    };
+
+    struct TraceEvent
+    {
+        std::string name;
+        const char *track;
+        uint64_t frame;
+        double startUs;
+        double durationUs;
+    };
+
+    struct Samples
+    {
+        uint64_t count;
+        std::deque<double> recentMs;
+    };
+
+    void Resolve(Slot &slot, uint32_t slotIndex);
+
+    vk::Device device;
+    vk::QueryPool queryPool;
+    double nsPerTick;
+    uint64_t timestampMask;
+    uint32_t maxScopes;
+    std::vector<Slot> slots;
+
+    // Written by Resolve on the rendering thread, read by whoever asks for results
+    mutable std::mutex resultsMutex;
+    uint64_t firstTimestamp;
+    std::map<std::string, Samples> samples;
+    std::deque<TraceEvent> trace;
+};
@@ -0,0 +1,43 @@
+#include "Hash.h"
+
+static const uint64_t FnvOffsetBasis = 14695981039346656037ull;
+static const uint64_t FnvPrime = 1099511628211ull;
+
+Hasher::Hasher()
+    : hash(FnvOffsetBasis)
+{
+}
+
+void Hasher::Add(const void *data, size_t size)
+{
+    auto bytes = (const uint8_t *)data;
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= FnvPrime;
+    }
+}
+
+void Hasher::Add(uint64_t value)
+{
+    Add(&value, sizeof(value));
+}
+
+void Hasher::Add(const std::string &value)
+{
+    // The length keeps "ab" + "c" apart from "a" + "bc"
+    Add((uint64_t)value.size());
+    Add(value.data(), value.size());
+}
+
+uint64_t Hasher::Get() const
+{
+    return hash;
+}
+
+uint64_t HashBytes(const void *data, size_t size)
+{
+    Hasher hasher;
+    hasher.Add(data, size);
+    return hasher.Get();
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// 64-bit FNV-1a, used for content hashes that key caches
+class Hasher
+{
+public:
+    Hasher();
+
+    void Add(const void *data, size_t size);
+    void Add(uint64_t value);
+    void Add(const std::string &value);
+
+    uint64_t Get() const;
+
+private:
+    uint64_t hash;
+};
+
+uint64_t HashBytes(const void *data, size_t size);
@@ -0,0 +1,31 @@
+#include "HeadlessWindow.h"
+
+HeadlessWindow::HeadlessWindow(uint32_t width, uint32_t height)
+    : width(width), height(height)
+{
+}
+
+bool HeadlessWindow::PumpEvents(bool)
+{
+    return !Closed();
+}
+
+void HeadlessWindow::GetClientSize(uint32_t &width, uint32_t &height) const
+{
+    width = this->width;
+    height = this->height;
+}
+
+void HeadlessWindow::Inject(const WindowEvent &event)
+{
+    if (event.type == WindowEventType::Resize)
+    {
+        width = (uint32_t)event.x;
+        height = (uint32_t)event.y;
+    }
+
+    PushEvent(event);
+
+    if (event.type == WindowEventType::Close)
+        closed.store(true, std::memory_order_release);
+}
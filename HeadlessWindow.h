@@ -0,0 +1,24 @@
+#pragma once
+
+#include "Window.h"
+
+// A window without an OS window behind it. Events are injected by hand, which
+// is how tests drive the render thread.
+class HeadlessWindow : public Window
+{
+public:
+    HeadlessWindow(uint32_t width, uint32_t height);
+
+    // Nothing to pump, only reports whether a close was injected
+    bool PumpEvents(bool wait) override;
+    void GetClientSize(uint32_t &width, uint32_t &height) const override;
+
+    // Queue an event as if the OS had sent it, from one thread only.
+    // Resizes change the reported client size, which the offscreen images are
+    // rebuilt to at the next frame, and a close closes the window.
+    void Inject(const WindowEvent &event);
+
+private:
+    std::atomic<uint32_t> width;
+    std::atomic<uint32_t> height;
+};
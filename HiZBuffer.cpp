@@ -0,0 +1,308 @@
+#include "HiZBuffer.h"
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+
+HiZBuffer::HiZBuffer(vk::Device device, MemoryAllocator &allocator, vk::Extent2D depthExtent, vk::ShaderModule shader, vk::PipelineCache pipelineCache, HiZBuffer *previous)
+    : device(device), allocator(allocator), depthExtent(depthExtent), mipCount(1), initialized(false), built(false), inherited(false)
+{
+    extent = vk::Extent2D(1, 1);
+    if (shader)
+    {
+        extent = vk::Extent2D(std::max(depthExtent.width / 2, 1u), std::max(depthExtent.height / 2, 1u));
+        for (auto size = std::max(extent.width, extent.height); size > 1; size /= 2)
+            ++mipCount;
+    }
+
+    auto imageInfo = vk::ImageCreateInfo()
+        .setImageType(vk::ImageType::e2D)
+        .setFormat(vk::Format::eR32Sfloat)
+        .setExtent({ extent.width, extent.height, 1 })
+        .setMipLevels(mipCount)
+        .setArrayLayers(1)
+        .setSamples(vk::SampleCountFlagBits::e1)
+        .setTiling(vk::ImageTiling::eOptimal)
+        .setUsage(vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eTransferDst);
+    image = device.createImage(imageInfo);
+
+    // Same as the depth buffer, reuse the old memory when the pyramid still
+    // fits, otherwise leave some headroom for the window growing further
+    auto memReqs = device.getImageMemoryRequirements(image);
+    if (previous &&
+        previous->mem.memory &&
+        memReqs.size <= previous->mem.size &&
+        previous->mem.offset % memReqs.alignment == 0 &&
+        (memReqs.memoryTypeBits & (1 << previous->mem.memoryType)))
+    {
+        mem = previous->mem;
+        previous->mem = Allocation();
+        inherited = true;
+    }
+    else
+    {
+        if (previous)
+            memReqs.size += memReqs.size / 4;
+        mem = allocator.Allocate(memReqs, vk::MemoryPropertyFlagBits::eDeviceLocal, AllocationTiling::Optimal);
+    }
+    device.bindImageMemory(image, mem.memory, mem.offset);
+
+    auto viewInfo = vk::ImageViewCreateInfo()
+        .setViewType(vk::ImageViewType::e2D)
+        .setFormat(vk::Format::eR32Sfloat)
+        .setSubresourceRange(vk::ImageSubresourceRange()
+            .setAspectMask(vk::ImageAspectFlagBits::eColor)
+            .setLevelCount(mipCount)
+            .setLayerCount(1))
+        .setImage(image);
+    view = device.createImageView(viewInfo);
+
+    // Nearest filtering, the culling shader picks the texels it needs itself
+    auto samplerInfo = vk::SamplerCreateInfo()
+        .setMagFilter(vk::Filter::eNearest)
+        .setMinFilter(vk::Filter::eNearest)
+        .setMipmapMode(vk::SamplerMipmapMode::eNearest)
+        .setAddressModeU(vk::SamplerAddressMode::eClampToEdge)
+        .setAddressModeV(vk::SamplerAddressMode::eClampToEdge)
+        .setAddressModeW(vk::SamplerAddressMode::eClampToEdge)
+        .setMaxLod((float)mipCount);
+    sampler = device.createSampler(samplerInfo);
+
+    if (!shader)
+        return;
+
+    for (uint32_t level = 0; level < mipCount; ++level)
+    {
+        viewInfo.subresourceRange
+            .setBaseMipLevel(level)
+            .setLevelCount(1);
+        levelViews.push_back(device.createImageView(viewInfo));
+    }
+
+    // Nothing in the pipeline depends on the size, so a resize doesn't recompile it
+    if (previous && previous->pipeline)
+    {
+        setLayout = previous->setLayout;
+        pipelineLayout = previous->pipelineLayout;
+        pipeline = previous->pipeline;
+        previous->setLayout = nullptr;
+        previous->pipelineLayout = nullptr;
+        previous->pipeline = nullptr;
+        return;
+    }
+
+    std::vector<vk::DescriptorSetLayoutBinding> bindings =
+    {
+        vk::DescriptorSetLayoutBinding()
+            .setBinding(0)
+            .setDescriptorType(vk::DescriptorType::eCombinedImageSampler)
+            .setDescriptorCount(1)
+            .setStageFlags(vk::ShaderStageFlagBits::eCompute),
+        vk::DescriptorSetLayoutBinding()
+            .setBinding(1)
+            .setDescriptorType(vk::DescriptorType::eStorageImage)
+            .setDescriptorCount(1)
+            .setStageFlags(vk::ShaderStageFlagBits::eCompute),
+    };
+    setLayout = device.createDescriptorSetLayout(vk::DescriptorSetLayoutCreateInfo()
+        .setBindingCount((uint32_t)bindings.size())
+        .setPBindings(bindings.data()));
+
+    auto pushRange = vk::PushConstantRange()
+        .setStageFlags(vk::ShaderStageFlagBits::eCompute)
+        .setSize(sizeof(PushConstants));
+    pipelineLayout = device.createPipelineLayout(vk::PipelineLayoutCreateInfo()
+        .setSetLayoutCount(1)
+        .setPSetLayouts(&setLayout)
+        .setPushConstantRangeCount(1)
+        .setPPushConstantRanges(&pushRange));
+
+    auto pipelineInfo = vk::ComputePipelineCreateInfo()
+        .setStage(vk::PipelineShaderStageCreateInfo()
+            .setStage(vk::ShaderStageFlagBits::eCompute)
+            .setModule(shader)
+            .setPName("main"))
+        .setLayout(pipelineLayout);
+    auto result = device.createComputePipelines(pipelineCache, 1, &pipelineInfo, nullptr, &pipeline);
+    if (result != vk::Result::eSuccess)
+        throw std::runtime_error{ "Failed to create the Hi-Z pipeline" };
+}
+
+HiZBuffer::~HiZBuffer()
+{
+    if (pipeline)
+    {
+        device.destroyPipeline(pipeline);
+        device.destroyPipelineLayout(pipelineLayout);
+        device.destroyDescriptorSetLayout(setLayout);
+    }
+    for (auto levelView : levelViews)
+        device.destroyImageView(levelView);
+    device.destroySampler(sampler);
+    device.destroyImageView(view);
+    device.destroyImage(image);
+    allocator.Free(mem);
+}
+
+bool HiZBuffer::IsEnabled() const
+{
+    return !!pipeline;
+}
+
+bool HiZBuffer::IsBuilt() const
+{
+    return built;
+}
+
+void HiZBuffer::Prepare(vk::CommandBuffer commandBuffer)
+{
+    if (initialized)
+        return;
+
+    // Memory taken from the previous pyramid may still be in use by its last frames
+    vk::AccessFlags srcAccess;
+    vk::PipelineStageFlags srcStages = vk::PipelineStageFlagBits::eTopOfPipe;
+    if (inherited)
+    {
+        srcAccess = vk::AccessFlagBits::eShaderWrite | vk::AccessFlagBits::eTransferWrite;
+        srcStages = vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eTransfer;
+    }
+
+    // Nothing has been drawn yet, so everything counts as far away
+    Barrier(
+        commandBuffer, 0, mipCount,
+        vk::ImageLayout::eUndefined,
+        srcAccess, vk::AccessFlagBits::eTransferWrite,
+        srcStages, vk::PipelineStageFlagBits::eTransfer
+    );
+    auto range = vk::ImageSubresourceRange()
+        .setAspectMask(vk::ImageAspectFlagBits::eColor)
+        .setLevelCount(mipCount)
+        .setLayerCount(1);
+    commandBuffer.clearColorImage(
+        image,
+        vk::ImageLayout::eGeneral,
+        vk::ClearColorValue(std::array<float, 4>{ 1.0f, 1.0f, 1.0f, 1.0f }),
+        range
+    );
+    Barrier(
+        commandBuffer, 0, mipCount,
+        vk::ImageLayout::eGeneral,
+        vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eShaderRead,
+        vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader
+    );
+    initialized = true;
+}
+
+void HiZBuffer::Build(vk::CommandBuffer commandBuffer, vk::ImageView depthView, DescriptorHeap &descriptors)
+{
+    if (!pipeline)
+        return;
+    Prepare(commandBuffer);
+
+    // This frame's culling read the old pyramid, it has to finish first
+    Barrier(
+        commandBuffer, 0, mipCount,
+        vk::ImageLayout::eGeneral,
+        vk::AccessFlagBits::eShaderRead, vk::AccessFlagBits::eShaderWrite,
+        vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader
+    );
+
+    commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline);
+    vk::Extent2D srcSize = depthExtent;
+    for (uint32_t level = 0; level < mipCount; ++level)
+    {
+        vk::Extent2D dstSize(std::max(extent.width >> level, 1u), std::max(extent.height >> level, 1u));
+
+        // Level 0 reads the depth buffer, the others read the level before them
+        auto source = vk::DescriptorImageInfo()
+            .setSampler(sampler)
+            .setImageView(level == 0 ? depthView : levelViews[level - 1])
+            .setImageLayout(level == 0 ? vk::ImageLayout::eShaderReadOnlyOptimal : vk::ImageLayout::eGeneral);
+        auto target = vk::DescriptorImageInfo()
+            .setImageView(levelViews[level])
+            .setImageLayout(vk::ImageLayout::eGeneral);
+
+        auto set = descriptors.AllocateTransient(setLayout);
+        std::vector<vk::WriteDescriptorSet> writes =
+        {
+            vk::WriteDescriptorSet()
+                .setDstSet(set)
+                .setDstBinding(0)
+                .setDescriptorCount(1)
+                .setDescriptorType(vk::DescriptorType::eCombinedImageSampler)
+                .setPImageInfo(&source),
+            vk::WriteDescriptorSet()
+                .setDstSet(set)
+                .setDstBinding(1)
+                .setDescriptorCount(1)
+                .setDescriptorType(vk::DescriptorType::eStorageImage)
+                .setPImageInfo(&target),
+        };
+        device.updateDescriptorSets(writes, nullptr);
+
+        PushConstants params;
+        params.srcSize[0] = (int32_t)srcSize.width;
+        params.srcSize[1] = (int32_t)srcSize.height;
+        params.dstSize[0] = (int32_t)dstSize.width;
+        params.dstSize[1] = (int32_t)dstSize.height;
+        commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, pipelineLayout, 0, set, nullptr);
+        vkCmdPushConstants((VkCommandBuffer)commandBuffer, (VkPipelineLayout)pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(params), &params);
+        commandBuffer.dispatch((dstSize.width + 7) / 8, (dstSize.height + 7) / 8, 1);
+
+        // The next level reads this one, and next frame's culling reads them all
+        Barrier(
+            commandBuffer, level, 1,
+            vk::ImageLayout::eGeneral,
+            vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead,
+            vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader
+        );
+        srcSize = dstSize;
+    }
+    built = true;
+}
+
+vk::ImageView HiZBuffer::GetView() const
+{
+    return view;
+}
+
+vk::Sampler HiZBuffer::GetSampler() const
+{
+    return sampler;
+}
+
+vk::Extent2D HiZBuffer::GetExtent() const
+{
+    return extent;
+}
+
+uint32_t HiZBuffer::GetMipCount() const
+{
+    return mipCount;
+}
+
+void HiZBuffer::Barrier(
+    vk::CommandBuffer commandBuffer,
+    uint32_t level,
+    uint32_t levelCount,
+    vk::ImageLayout oldLayout,
+    vk::AccessFlags srcAccess,
+    vk::AccessFlags dstAccess,
+    vk::PipelineStageFlags srcStages,
+    vk::PipelineStageFlags dstStages)
+{
+    auto barrier = vk::ImageMemoryBarrier()
+        .setOldLayout(oldLayout)
+        .setNewLayout(vk::ImageLayout::eGeneral)
+        .setSrcAccessMask(srcAccess)
+        .setDstAccessMask(dstAccess)
+        .setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+        .setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+        .setImage(image)
+        .setSubresourceRange(vk::ImageSubresourceRange()
+            .setAspectMask(vk::ImageAspectFlagBits::eColor)
+            .setBaseMipLevel(level)
+            .setLevelCount(levelCount)
+            .setLayerCount(1));
+    commandBuffer.pipelineBarrier(srcStages, dstStages, vk::DependencyFlags(), nullptr, nullptr, barrier);
+}
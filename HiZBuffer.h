@@ -0,0 +1,82 @@
+#pragma once
+
+#include "DescriptorHeap.h"
+#include "MemoryAllocator.h"
+#include <vulkan/vk_cpp.h>
+#include <cstdint>
+#include <vector>
+
+// A depth pyramid where every texel holds the farthest depth
+// under it, built from the depth buffer at the end of each frame and tested
+// against by the next frame's occlusion culling. Level 0 is half the size of
+// the depth buffer. The image stays in the general layout.
+//
+// Without a shader it's a single far plane texel, so culling can always bind
+// it and never finds anything occluded.
+//
+// A resize makes a new pyramid, which takes over the previous one's pipeline,
+// and its memory when it still fits.
+class HiZBuffer
+{
+public:
+    HiZBuffer(vk::Device device, MemoryAllocator &allocator, vk::Extent2D depthExtent, vk::ShaderModule shader, vk::PipelineCache pipelineCache, HiZBuffer *previous = nullptr);
+    ~HiZBuffer();
+
+    HiZBuffer(const HiZBuffer &) = delete;
+    HiZBuffer &operator=(const HiZBuffer &) = delete;
+
+    bool IsEnabled() const;
+    // Set once a pyramid has been built, before that it's all far plane
+    bool IsBuilt() const;
+
+    // Record before anything reads the pyramid in a frame, clears it the first time
+    void Prepare(vk::CommandBuffer commandBuffer);
+    // Reduce the depth buffer into the pyramid. Depth has to be in the shader read
+    // layout, the sets come from the frame's transient pool.
+    void Build(vk::CommandBuffer commandBuffer, vk::ImageView depthView, DescriptorHeap &descriptors);
+
+    // Every level, in the general layout
+    vk::ImageView GetView() const;
+    vk::Sampler GetSampler() const;
+    vk::Extent2D GetExtent() const;
+    uint32_t GetMipCount() const;
+
+private:
+    struct PushConstants
+    {
+        int32_t srcSize[2];
+        int32_t dstSize[2];
+    };
+
+    void Barrier(
+        vk::CommandBuffer commandBuffer,
+        uint32_t level,
+        uint32_t levelCount,
+        vk::ImageLayout oldLayout,
+        vk::AccessFlags srcAccess,
+        vk::AccessFlags dstAccess,
+        vk::PipelineStageFlags srcStages,
+        vk::PipelineStageFlags dstStages
+    );
+
+    vk::Device device;
+    MemoryAllocator &allocator;
+    vk::Extent2D depthExtent;
+    vk::Extent2D extent;
+    uint32_t mipCount;
+    bool initialized;
+    bool built;
+    // Frames in flight may still be building the previous pyramid in this memory
+    bool inherited;
+
+    vk::Image image;
+    Allocation mem;
+    vk::ImageView view;
+    // One per level, for reading one level while writing the next
+    std::vector<vk::ImageView> levelViews;
+    vk::Sampler sampler;
+
+    vk::DescriptorSetLayout setLayout;
+    vk::PipelineLayout pipelineLayout;
+    vk::Pipeline pipeline;
+};
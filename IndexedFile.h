@@ -0,0 +1,164 @@
+#pragma once
+
+#include "FileUtil.h"
+#include "Hash.h"
+#include "Log.h"
+#include "MappedFile.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Every indexed file starts with this, followed by the index
+struct IndexedFileHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t entryCount;
+    uint32_t reserved;
+};
+
+// A memory mapped file made of a header, an index sorted by name hash, then
+// the data the entries point at. The shader library and asset pack are both
+// laid out like this, with their own Entry type. Entries start with a 64-bit
+// nameHash and have an offset from the start of the file and a size.
+//
+// The index is checked once when it's opened, after that lookups are read
+// only and safe from any thread.
+template <typename Entry>
+class IndexedFile
+{
+public:
+    // Checks anything about an entry beyond it being in the file
+    typedef bool (*EntryCheck)(const Entry &entry);
+
+    IndexedFile()
+        : entries(nullptr), entryCount(0)
+    {
+    }
+
+    // Returns false if the file is missing or malformed. Data has to start on
+    // a multiple of alignment. kind names the file in log messages.
+    bool Open(const std::string &path, const char *kind, uint32_t magic, uint32_t version, uint64_t alignment, EntryCheck isValid)
+    {
+        Close();
+        if (!file.Open(path))
+            return false;
+
+        // Check everything up front so lookups can trust the index
+        auto data = file.GetData();
+        auto size = file.GetSize();
+        IndexedFileHeader header;
+        if (size < sizeof(header))
+        {
+            Log(std::string{ kind } + " " + path + " is truncated");
+            file.Close();
+            return false;
+        }
+        memcpy(&header, data, sizeof(header));
+
+        auto indexSize = (uint64_t)header.entryCount * sizeof(Entry);
+        if (header.magic != magic || header.version != version || indexSize > size - sizeof(header))
+        {
+            Log(std::string{ kind } + " " + path + " has a bad header");
+            file.Close();
+            return false;
+        }
+
+        auto index = (const Entry *)(data + sizeof(header));
+        for (uint32_t i = 0; i < header.entryCount; ++i)
+        {
+            auto &entry = index[i];
+            bool sorted = i == 0 || index[i - 1].nameHash < entry.nameHash;
+            if (!sorted || entry.offset % alignment != 0 || entry.offset > size || entry.size > size - entry.offset ||
+                !isValid(entry))
+            {
+                Log(std::string{ kind } + " " + path + " has a bad index");
+                file.Close();
+                return false;
+            }
+        }
+
+        entries = index;
+        entryCount = header.entryCount;
+        return true;
+    }
+
+    void Close()
+    {
+        file.Close();
+        entries = nullptr;
+        entryCount = 0;
+    }
+
+    bool IsOpen() const
+    {
+        return entries != nullptr;
+    }
+
+    // Null if there's nothing by that name
+    const Entry *Find(const std::string &name) const
+    {
+        auto nameHash = HashBytes(name.data(), name.size());
+        auto end = entries + entryCount;
+        auto found = std::lower_bound(entries, end, nameHash, [](const Entry &entry, uint64_t hash)
+        {
+            return entry.nameHash < hash;
+        });
+        return found != end && found->nameHash == nameHash ? found : nullptr;
+    }
+
+    const uint8_t *GetData(const Entry &entry) const
+    {
+        return file.GetData() + entry.offset;
+    }
+
+    uint32_t GetCount() const
+    {
+        return entryCount;
+    }
+
+    // Where data can start after the header and an index of count entries
+    static uint64_t GetIndexEnd(size_t count)
+    {
+        return sizeof(IndexedFileHeader) + count * sizeof(Entry);
+    }
+
+    // Sort the index and write it with its header over the start of data, which
+    // the caller leaves GetIndexEnd bytes free at and fills the rest of with
+    // what the entries point at. Throws if two names hash the same.
+    static bool Write(const std::string &path, const char *kind, uint32_t magic, uint32_t version, std::vector<Entry> index, std::vector<uint8_t> &data)
+    {
+        if (data.size() < GetIndexEnd(index.size()))
+            throw std::runtime_error{ std::string{ kind } + " has no room for its index" };
+
+        std::sort(index.begin(), index.end(), [](const Entry &a, const Entry &b)
+        {
+            return a.nameHash < b.nameHash;
+        });
+        for (size_t i = 1; i < index.size(); ++i)
+        {
+            if (index[i].nameHash == index[i - 1].nameHash)
+                throw std::runtime_error{ std::string{ kind } + " has two entries with the same name hash" };
+        }
+
+        IndexedFileHeader header;
+        header.magic = magic;
+        header.version = version;
+        header.entryCount = (uint32_t)index.size();
+        header.reserved = 0;
+
+        memcpy(data.data(), &header, sizeof(header));
+        if (!index.empty())
+            memcpy(data.data() + sizeof(header), index.data(), index.size() * sizeof(Entry));
+
+        return WriteFileAtomic(path, data.data(), data.size());
+    }
+
+private:
+    MappedFile file;
+    const Entry *entries;
+    uint32_t entryCount;
+};
@@ -0,0 +1,190 @@
+#include "JobSystem.h"
+#include <algorithm>
+
+// Which queue the current thread owns, -1 for threads outside any pool
+static thread_local uint32_t currentThread = UINT32_MAX;
+
+JobCounter::JobCounter()
+    : pending(0)
+{
+}
+
+bool JobCounter::IsDone() const
+{
+    return pending.load(std::memory_order_acquire) == 0;
+}
+
+JobSystem::JobSystem(uint32_t workerCount)
+    : owner(std::this_thread::get_id()), nextQueue(0), queuedCount(0), quit(false)
+{
+    if (workerCount == 0)
+        workerCount = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+
+    // One queue per worker plus one for the owning thread
+    for (uint32_t i = 0; i <= workerCount; ++i)
+        queues.push_back(std::make_unique<WorkQueue>());
+    currentThread = workerCount;
+
+    for (uint32_t i = 0; i < workerCount; ++i)
+        workers.emplace_back(&JobSystem::WorkerMain, this, i);
+}
+
+JobSystem::~JobSystem()
+{
+    {
+        std::lock_guard<std::mutex> lock{ sleepMutex };
+        quit = true;
+    }
+    wake.notify_all();
+
+    for (auto &worker : workers)
+        worker.join();
+}
+
+uint32_t JobSystem::GetThreadCount() const
+{
+    return (uint32_t)queues.size();
+}
+
+uint32_t JobSystem::GetCurrentThread() const
+{
+    // A thread that gave the pool away still has the owner's index, it no longer counts
+    if (currentThread == GetThreadCount() - 1 && owner.load(std::memory_order_acquire) != std::this_thread::get_id())
+        return UINT32_MAX;
+    return currentThread;
+}
+
+void JobSystem::TakeOwnership()
+{
+    currentThread = GetThreadCount() - 1;
+    owner.store(std::this_thread::get_id(), std::memory_order_release);
+}
+
+void JobSystem::Submit(Job job, JobCounter *counter)
+{
+    if (counter)
+        counter->pending.fetch_add(1, std::memory_order_relaxed);
+
+    // Workers push to their own queue, anyone else spreads jobs around
+    auto thread = GetCurrentThread();
+    if (thread >= queues.size())
+        thread = nextQueue.fetch_add(1, std::memory_order_relaxed) % (uint32_t)queues.size();
+
+    auto &queue = *queues[thread];
+    {
+        std::lock_guard<std::mutex> lock{ queue.mutex };
+        queue.tasks.push_back(Task{ std::move(job), counter });
+    }
+
+    {
+        std::lock_guard<std::mutex> lock{ sleepMutex };
+        queuedCount++;
+    }
+    wake.notify_one();
+}
+
+void JobSystem::Wait(JobCounter &counter)
+{
+    // Outsiders leave the jobs to the pool, a job run here would get an index
+    // some other thread is using
+    auto thread = GetCurrentThread();
+    while (!counter.IsDone())
+    {
+        if (thread >= queues.size() || !RunOne(thread))
+            std::this_thread::yield();
+    }
+}
+
+bool JobSystem::RunPending()
+{
+    auto thread = GetCurrentThread();
+    return thread < queues.size() && RunOne(thread);
+}
+
+void JobSystem::ParallelFor(uint32_t count, const ForJob &fn)
+{
+    if (count == 0)
+        return;
+
+    // Split into a few chunks per thread so stealing can even out uneven work
+    auto chunkCount = std::min(count, GetThreadCount() * 4);
+    auto chunkSize = (count + chunkCount - 1) / chunkCount;
+
+    JobCounter counter;
+    for (uint32_t begin = 0; begin < count; begin += chunkSize)
+    {
+        auto end = std::min(begin + chunkSize, count);
+        Submit([this, begin, end, &fn]()
+        {
+            auto worker = GetCurrentThread();
+            for (auto i = begin; i < end; ++i)
+                fn(i, worker);
+        }, &counter);
+    }
+
+    Wait(counter);
+}
+
+void JobSystem::WorkerMain(uint32_t index)
+{
+    currentThread = index;
+
+    while (true)
+    {
+        if (RunOne(index))
+            continue;
+
+        std::unique_lock<std::mutex> lock{ sleepMutex };
+        wake.wait(lock, [this]() { return quit || queuedCount > 0; });
+        if (quit)
+            return;
+    }
+}
+
+bool JobSystem::RunOne(uint32_t thread)
+{
+    Task task;
+    if (!Pop(thread, task) && !Steal(thread, task))
+        return false;
+
+    {
+        std::lock_guard<std::mutex> lock{ sleepMutex };
+        queuedCount--;
+    }
+
+    task.job();
+    if (task.counter)
+        task.counter->pending.fetch_sub(1, std::memory_order_release);
+    return true;
+}
+
+bool JobSystem::Pop(uint32_t thread, Task &task)
+{
+    auto &queue = *queues[thread];
+    std::lock_guard<std::mutex> lock{ queue.mutex };
+    if (queue.tasks.empty())
+        return false;
+
+    // Newest first, its data is most likely still in cache
+    task = std::move(queue.tasks.back());
+    queue.tasks.pop_back();
+    return true;
+}
+
+bool JobSystem::Steal(uint32_t thread, Task &task)
+{
+    auto count = (uint32_t)queues.size();
+    for (uint32_t i = 1; i < count; ++i)
+    {
+        auto &queue = *queues[(thread + i) % count];
+        std::lock_guard<std::mutex> lock{ queue.mutex };
+        if (queue.tasks.empty())
+            continue;
+
+        // Oldest first, it's the one the owner is furthest from getting to
+        task = std::move(queue.tasks.front());
+        queue.tasks.pop_front();
+        return true;
+    }
+    return false;
+}
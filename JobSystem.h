@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Counts outstanding jobs so a group of them can be waited on
+class JobCounter
+{
+public:
+    JobCounter();
+    bool IsDone() const;
+
+private:
+    friend class JobSystem;
+    std::atomic<uint32_t> pending;
+};
+
+// Work-stealing worker pool. Each worker pops from the back of its own queue
+// and steals from the front of the others when it runs dry. The thread that
+// owns the pool, at first the one that created it, gets a queue of its own and
+// helps out while it waits. Any other thread may submit and wait, but never
+// runs jobs itself, so thread indices always belong to exactly one thread.
+class JobSystem
+{
+public:
+    typedef std::function<void()> Job;
+    typedef std::function<void(uint32_t index, uint32_t worker)> ForJob;
+
+    // 0 workers means one per hardware thread besides the owner
+    explicit JobSystem(uint32_t workerCount = 0);
+    ~JobSystem();
+
+    // Worker threads plus the owning thread
+    uint32_t GetThreadCount() const;
+    // Index of the calling thread, the owning thread is GetThreadCount() - 1.
+    // UINT32_MAX for threads that are neither a worker nor the owner.
+    uint32_t GetCurrentThread() const;
+    // Make the calling thread the owning thread, for handing the pool to another
+    // thread. The old owner only waits on jobs until it takes it back.
+    void TakeOwnership();
+
+    void Submit(Job job, JobCounter *counter = nullptr);
+    // Run the jobs until the counter drains, or just wait for them when the
+    // calling thread isn't part of the pool
+    void Wait(JobCounter &counter);
+    // Run one queued job on the calling thread, false if there was nothing to
+    // run or the calling thread isn't part of the pool
+    bool RunPending();
+    // Run fn over [0, count) spread across all threads, returns when every index is done
+    void ParallelFor(uint32_t count, const ForJob &fn);
+
+private:
+    struct Task
+    {
+        Job job;
+        JobCounter *counter;
+    };
+
+    struct WorkQueue
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void WorkerMain(uint32_t index);
+    bool RunOne(uint32_t thread);
+    bool Pop(uint32_t thread, Task &task);
+    bool Steal(uint32_t thread, Task &task);
+
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    std::vector<std::thread> workers;
+    // Only this thread may use the owner's queue
+    std::atomic<std::thread::id> owner;
+    std::atomic<uint32_t> nextQueue;
+    std::atomic<uint32_t> queuedCount;
+    std::atomic<bool> quit;
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+};
@@ -0,0 +1,167 @@
+#include "LayoutTracker.h"
+#include <stdexcept>
+
+static const vk::AccessFlags WriteAccess =
+    vk::AccessFlagBits::eShaderWrite |
+    vk::AccessFlagBits::eColorAttachmentWrite |
+    vk::AccessFlagBits::eDepthStencilAttachmentWrite |
+    vk::AccessFlagBits::eTransferWrite |
+    vk::AccessFlagBits::eHostWrite |
+    vk::AccessFlagBits::eMemoryWrite;
+
+ImageState::ImageState()
+    : layout(vk::ImageLayout::eUndefined)
+{
+}
+
+ImageState::ImageState(vk::ImageLayout layout, vk::AccessFlags access, vk::PipelineStageFlags stages)
+    : layout(layout), access(access), stages(stages)
+{
+}
+
+ImageState ImageState::ColorAttachment()
+{
+    return ImageState(
+        vk::ImageLayout::eColorAttachmentOptimal,
+        vk::AccessFlagBits::eColorAttachmentRead | vk::AccessFlagBits::eColorAttachmentWrite,
+        vk::PipelineStageFlagBits::eColorAttachmentOutput
+    );
+}
+
+ImageState ImageState::DepthStencilAttachment()
+{
+    return ImageState(
+        vk::ImageLayout::eDepthStencilAttachmentOptimal,
+        vk::AccessFlagBits::eDepthStencilAttachmentRead | vk::AccessFlagBits::eDepthStencilAttachmentWrite,
+        vk::PipelineStageFlagBits::eEarlyFragmentTests | vk::PipelineStageFlagBits::eLateFragmentTests
+    );
+}
+
+ImageState ImageState::TransferSrc()
+{
+    return ImageState(
+        vk::ImageLayout::eTransferSrcOptimal,
+        vk::AccessFlagBits::eTransferRead,
+        vk::PipelineStageFlagBits::eTransfer
+    );
+}
+
+ImageState ImageState::TransferDst()
+{
+    return ImageState(
+        vk::ImageLayout::eTransferDstOptimal,
+        vk::AccessFlagBits::eTransferWrite,
+        vk::PipelineStageFlagBits::eTransfer
+    );
+}
+
+ImageState ImageState::ShaderRead(vk::PipelineStageFlags stages)
+{
+    return ImageState(
+        vk::ImageLayout::eShaderReadOnlyOptimal,
+        vk::AccessFlagBits::eShaderRead,
+        stages
+    );
+}
+
+ImageState ImageState::Present()
+{
+    return ImageState(
+        vk::ImageLayout::ePresentSrcKHR,
+        vk::AccessFlags(),
+        vk::PipelineStageFlagBits::eColorAttachmentOutput
+    );
+}
+
+void LayoutTracker::Register(vk::Image image, vk::ImageAspectFlags aspectMask, const ImageState &state)
+{
+    std::lock_guard<std::mutex> lock{ mutex };
+    images[(VkImage)image] = TrackedImage{ aspectMask, state };
+}
+
+void LayoutTracker::Unregister(vk::Image image)
+{
+    std::lock_guard<std::mutex> lock{ mutex };
+    images.erase((VkImage)image);
+}
+
+void LayoutTracker::Transition(vk::Image image, const ImageState &usage, bool discard)
+{
+    std::lock_guard<std::mutex> lock{ mutex };
+    auto &tracked = Find(image);
+    auto &current = tracked.state;
+
+    // Reads after reads in the same layout don't need anything
+    bool layoutChange = current.layout != usage.layout;
+    bool hazard = (current.access & WriteAccess) || (usage.access & WriteAccess);
+    if (!layoutChange && !hazard)
+    {
+        current.access |= usage.access;
+        current.stages |= usage.stages;
+        return;
+    }
+
+    // Only writes have to be made available, earlier reads just need the execution dependency
+    auto barrier = vk::ImageMemoryBarrier()
+        .setOldLayout(discard ? vk::ImageLayout::eUndefined : current.layout)
+        .setNewLayout(usage.layout)
+        .setSrcAccessMask(current.access & WriteAccess)
+        .setDstAccessMask(usage.access)
+        .setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+        .setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+        .setImage(image)
+        .setSubresourceRange(vk::ImageSubresourceRange()
+            .setAspectMask(tracked.aspectMask)
+            .setLevelCount(VK_REMAINING_MIP_LEVELS)
+            .setLayerCount(VK_REMAINING_ARRAY_LAYERS));
+    pending.push_back(barrier);
+
+    // An image nothing has touched yet has nothing to wait for
+    pendingSrcStages |= current.stages ? current.stages : vk::PipelineStageFlagBits::eTopOfPipe;
+    pendingDstStages |= usage.stages;
+
+    current = usage;
+}
+
+void LayoutTracker::Flush(vk::CommandBuffer commandBuffer)
+{
+    std::lock_guard<std::mutex> lock{ mutex };
+    if (pending.empty())
+        return;
+
+    commandBuffer.pipelineBarrier(
+        pendingSrcStages,
+        pendingDstStages ? pendingDstStages : vk::PipelineStageFlags(vk::PipelineStageFlagBits::eBottomOfPipe),
+        vk::DependencyFlags(),
+        nullptr,
+        nullptr,
+        pending
+    );
+
+    pending.clear();
+    pendingSrcStages = vk::PipelineStageFlags();
+    pendingDstStages = vk::PipelineStageFlags();
+}
+
+void LayoutTracker::Assume(vk::Image image, const ImageState &state)
+{
+    std::lock_guard<std::mutex> lock{ mutex };
+    Find(image).state = state;
+}
+
+ImageState LayoutTracker::GetState(vk::Image image) const
+{
+    std::lock_guard<std::mutex> lock{ mutex };
+    auto it = images.find((VkImage)image);
+    if (it == images.end())
+        throw std::runtime_error{ "Image isn't tracked" };
+    return it->second.state;
+}
+
+LayoutTracker::TrackedImage &LayoutTracker::Find(vk::Image image)
+{
+    auto it = images.find((VkImage)image);
+    if (it == images.end())
+        throw std::runtime_error{ "Image isn't tracked" };
+    return it->second;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <vulkan/vk_cpp.h>
+#include <map>
+#include <mutex>
+#include <vector>
+
+// How an image was last used, or is about to be used
+struct ImageState
+{
+    vk::ImageLayout layout;
+    vk::AccessFlags access;
+    vk::PipelineStageFlags stages;
+
+    ImageState();
+    ImageState(vk::ImageLayout layout, vk::AccessFlags access, vk::PipelineStageFlags stages);
+
+    static ImageState ColorAttachment();
+    static ImageState DepthStencilAttachment();
+    static ImageState TransferSrc();
+    static ImageState TransferDst();
+    static ImageState ShaderRead(vk::PipelineStageFlags stages);
+    // Waiting on the acquire semaphore happens at color output, so later
+    // barriers on a presented image have to start from that stage
+    static ImageState Present();
+};
+
+// Tracks the layout, access and stages of each image and turns usage changes
+// into barriers. Transitions are queued and recorded as one pipelineBarrier.
+// Safe to use from several threads, e.g. startup stages registering images.
+class LayoutTracker
+{
+public:
+    void Register(vk::Image image, vk::ImageAspectFlags aspectMask, const ImageState &state = ImageState());
+    void Unregister(vk::Image image);
+
+    // Queue the barrier needed before the image can be used as described.
+    // Discarding skips preserving the contents, e.g. before a clear.
+    void Transition(vk::Image image, const ImageState &usage, bool discard = false);
+    // Record all queued transitions into one barrier
+    void Flush(vk::CommandBuffer commandBuffer);
+    // Update the state after something outside the tracker changed it, e.g. a render pass
+    void Assume(vk::Image image, const ImageState &state);
+
+    ImageState GetState(vk::Image image) const;
+
+private:
+    struct TrackedImage
+    {
+        vk::ImageAspectFlags aspectMask;
+        ImageState state;
+    };
+
+    TrackedImage &Find(vk::Image image);
+
+    mutable std::mutex mutex;
+    std::map<VkImage, TrackedImage> images;
+    std::vector<vk::ImageMemoryBarrier> pending;
+    vk::PipelineStageFlags pendingSrcStages;
+    vk::PipelineStageFlags pendingDstStages;
+};
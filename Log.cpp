@@ -0,0 +1,18 @@
+#include "Log.h"
+#include <iostream>
+#include <mutex>
+
+#ifdef _WIN32
+#include <Windows.h>
+#endif
+
+void Log(const std::string &message)
+{
+    static std::mutex mutex;
+    std::lock_guard<std::mutex> lock{ mutex };
+
+#ifdef _WIN32
+    OutputDebugStringA((message + "\n").c_str());
+#endif
+    std::cerr << message << std::endl;
+}
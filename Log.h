@@ -0,0 +1,6 @@
+#pragma once
+
+#include <string>
+
+// Write a line to stderr and, on Windows, the debugger output
+void Log(const std::string &message);
@@ -1,24 +1,67 @@
-#include "VkApp.h"
-#include "Window.h"
-#include <iostream>
-
-INT WINAPI WinMain(HINSTANCE hinstance, HINSTANCE, LPSTR, INT)
-{
-    // Initialize the instance
-    VkApp app;
-
-    // Handle window messages to the end
-    MSG msg;
-    auto window = app.GetWindow();
-    while (GetMessageW(&msg, window->GetHandle(), 0, 0))
-    {
-        TranslateMessage(&msg);
-        DispatchMessageW(&msg);
-
-        if (window->Closed())
-            break;
-    }
-
-    return 0;
-}
-
+#include "VkApp.h"
+#include "Win32Window.h"
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+
+#ifdef _WIN32
+
+INT WINAPI WinMain(HINSTANCE hinstance, HINSTANCE, LPSTR, INT)
+{
+    // Initialize the instance
+    VkApp app;
+
+    // Frames render on their own thread and this one only waits on window
+    // messages, so a slow frame never leaves the window unresponsive
+    app.StartRendering();
+    auto window = app.GetWindow();
+    while (window->PumpEvents(true))
+    {
+    }
+    app.StopRendering();
+
+    return 0;
+}
+
+#else
+
+int main(int argc, char **argv)
+{
+    // No window system support yet, render into offscreen images
+    VkAppConfig config;
+    config.headless = true;
+    VkApp app(config);
+
+    // Render a fixed number of frames and report the throughput
+    uint64_t frames = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000;
+    auto start = std::chrono::steady_clock::now();
+    while (app.GetFrameCount() < frames)
+        app.RenderFrame();
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << frames << " frames in " << elapsed << "s (" << frames / elapsed << " fps)" << std::endl;
+
+    // The setup batch is only resolved once, make sure its timings made it out.
+    // It went to the queue before the first frame, so it's done by the time
+    // that frame's slot comes around again.
+    if (app.GetProfiler().IsEnabled() && frames > config.framesInFlight)
+    {
+        bool setupResolved = false;
+        for (auto &scope : app.GetProfiler().GetStats())
+        {
+            if (scope.name == "setup")
+            {
+                setupResolved = true;
+                std::cout << "setup took " << scope.lastMs << "ms on the GPU" << std::endl;
+            }
+        }
+        if (!setupResolved)
+        {
+            std::cerr << "No GPU timings for the setup batch" << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+#endif
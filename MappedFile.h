@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Read only view of a whole file mapped into memory
+class MappedFile
+{
+public:
+    MappedFile();
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    // Returns false if the file doesn't exist or can't be mapped
+    bool Open(const std::string &path);
+    void Close();
+
+    bool IsOpen() const;
+    const uint8_t *GetData() const;
+    size_t GetSize() const;
+
+private:
+    const uint8_t *data;
+    size_t size;
+#ifdef _WIN32
+    void *file;
+    void *mapping;
+#endif
+};
@@ -0,0 +1,430 @@
+#include "MemoryAllocator.h"
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+
+vk::DeviceSize AlignUp(vk::DeviceSize value, vk::DeviceSize alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+MemoryBlock::MemoryBlock(
+    vk::Device device,
+    uint32_t memoryType,
+    vk::DeviceSize size,
+    vk::DeviceSize granularity,
+    AllocationStrategy strategy,
+    bool hostVisible)
+    : device(device), size(size), granularity(granularity), strategy(strategy),
+    memoryType(memoryType), mapped(nullptr), head(0), lastTiling(AllocationTiling::Linear), liveCount(0)
+{
+    auto allocateInfo = vk::MemoryAllocateInfo()
+        .setAllocationSize(size)
+        .setMemoryTypeIndex(memoryType);
+    memory = device.allocateMemory(allocateInfo);
+
+    // Host visible blocks stay mapped for their whole lifetime
+    if (hostVisible)
+        mapped = (uint8_t *)device.mapMemory(memory, 0, VK_WHOLE_SIZE, vk::MemoryMapFlags());
+
+    ranges[0] = Range{ size, AllocationTiling::Linear, true };
+}
+
+MemoryBlock::~MemoryBlock()
+{
+    // Freeing implicitly unmaps
+    device.freeMemory(memory);
+}
+
+bool MemoryBlock::Allocate(vk::DeviceSize size, vk::DeviceSize alignment, AllocationTiling tiling, Allocation &allocation)
+{
+    vk::DeviceSize offset;
+    bool success = strategy == AllocationStrategy::Linear
+        ? AllocateLinear(size, alignment, tiling, offset)
+        : AllocateFreeList(size, alignment, tiling, offset);
+    if (!success)
+        return false;
+
+    allocation.memory = memory;
+    allocation.offset = offset;
+    allocation.size = size;
+    allocation.mapped = mapped ? mapped + offset : nullptr;
+    allocation.memoryType = memoryType;
+    allocation.block = this;
+    return true;
+}
+
+void MemoryBlock::Free(const Allocation &allocation)
+{
+    if (strategy == AllocationStrategy::Linear)
+    {
+        // The bump pointer rewinds once everything handed out has been returned
+        if (liveCount > 0 && --liveCount == 0)
+            head = 0;
+        return;
+    }
+
+    auto it = ranges.find(allocation.offset);
+    if (it == ranges.end() || it->second.free)
+        throw std::runtime_error{ "Freeing memory that isn't allocated from this block" };
+    it->second.free = true;
+
+    // Merge with the following range
+    auto next = std::next(it);
+    if (next != ranges.end() && next->second.free)
+    {
+        it->second.size += next->second.size;
+        ranges.erase(next);
+    }
+
+    // Merge with the preceding range
+    if (it != ranges.begin())
+    {
+        auto prev = std::prev(it);
+        if (prev->second.free)
+        {
+            prev->second.size += it->second.size;
+            ranges.erase(it);
+        }
+    }
+}
+
+void MemoryBlock::Reset()
+{
+    head = 0;
+    liveCount = 0;
+}
+
+bool MemoryBlock::IsEmpty() const
+{
+    if (strategy == AllocationStrategy::Linear)
+        return liveCount == 0;
+    return ranges.size() == 1 && ranges.begin()->second.free;
+}
+
+void MemoryBlock::AddStats(AllocationStats &stats) const
+{
+    stats.blockCount++;
+    stats.blockBytes += size;
+
+    if (strategy == AllocationStrategy::Linear)
+    {
+        stats.usedBytes += head;
+        if (head < size)
+        {
+            stats.freeBytes += size - head;
+            stats.freeRangeCount++;
+            stats.largestFreeRange = std::max(stats.largestFreeRange, size - head);
+        }
+        return;
+    }
+
+    for (auto &range : ranges)
+    {
+        if (range.second.free)
+        {
+            stats.freeBytes += range.second.size;
+            stats.freeRangeCount++;
+            stats.largestFreeRange = std::max(stats.largestFreeRange, range.second.size);
+        }
+        else
+        {
+            stats.usedBytes += range.second.size;
+        }
+    }
+}
+
+vk::DeviceMemory MemoryBlock::GetMemory() const
+{
+    return memory;
+}
+
+uint32_t MemoryBlock::GetMemoryType() const
+{
+    return memoryType;
+}
+
+AllocationStrategy MemoryBlock::GetStrategy() const
+{
+    return strategy;
+}
+
+bool MemoryBlock::AllocateFreeList(vk::DeviceSize size, vk::DeviceSize alignment, AllocationTiling tiling, vk::DeviceSize &offset)
+{
+    // Best fit: the smallest free range the request fits in
+    auto best = ranges.end();
+    vk::DeviceSize bestOffset = 0;
+    for (auto it = ranges.begin(); it != ranges.end(); ++it)
+    {
+        if (!it->second.free || it->second.size < size)
+            continue;
+        if (best != ranges.end() && it->second.size >= best->second.size)
+            continue;
+
+        // Free ranges are always coalesced, so the neighbours are allocations
+        auto start = AlignUp(it->first, alignment);
+        if (it != ranges.begin())
+        {
+            auto prev = std::prev(it);
+            if (prev->second.tiling != tiling && OnSamePage(prev->first + prev->second.size, start))
+                start = AlignUp(start, granularity);
+        }
+
+        auto end = it->first + it->second.size;
+        if (start + size > end)
+            continue;
+
+        auto next = std::next(it);
+        if (next != ranges.end() && next->second.tiling != tiling && OnSamePage(start + size, next->first))
+            continue;
+
+        best = it;
+        bestOffset = start;
+    }
+
+    if (best == ranges.end())
+        return false;
+
+    // Split the range into leading padding, the allocation and the remainder
+    auto rangeStart = best->first;
+    auto rangeEnd = rangeStart + best->second.size;
+    if (bestOffset > rangeStart)
+        best->second.size = bestOffset - rangeStart;
+    else
+        ranges.erase(best);
+
+    ranges[bestOffset] = Range{ size, tiling, false };
+    if (bestOffset + size < rangeEnd)
+        ranges[bestOffset + size] = Range{ rangeEnd - bestOffset - size, AllocationTiling::Linear, true };
+
+    offset = bestOffset;
+    return true;
+}
+
+bool MemoryBlock::AllocateLinear(vk::DeviceSize size, vk::DeviceSize alignment, AllocationTiling tiling, vk::DeviceSize &offset)
+{
+    auto start = AlignUp(head, alignment);
+    if (liveCount > 0 && lastTiling != tiling && OnSamePage(head, start))
+        start = AlignUp(start, granularity);
+
+    if (start + size > this->size)
+        return false;
+
+    head = start + size;
+    lastTiling = tiling;
+    liveCount++;
+
+    offset = start;
+    return true;
+}
+
+bool MemoryBlock::OnSamePage(vk::DeviceSize endA, vk::DeviceSize startB) const
+{
+    // endA is one past the last byte of the first resource
+    if (endA == 0)
+        return false;
+    auto pageA = (endA - 1) / granularity;
+    auto pageB = startB / granularity;
+    return pageA == pageB;
+}
+
+MemoryAllocator::MemoryAllocator()
+    : blockSize(0), granularity(1), dedicatedCount(0), dedicatedBytes(0)
+{
+}
+
+MemoryAllocator::~MemoryAllocator()
+{
+    Destroy();
+}
+
+void MemoryAllocator::Init(vk::PhysicalDevice physicalDevice, vk::Device device, vk::DeviceSize blockSize)
+{
+    this->device = device;
+    this->blockSize = blockSize;
+
+    // Memory properties never change, so only ask once
+    memProps = physicalDevice.getMemoryProperties();
+    granularity = std::max<vk::DeviceSize>(physicalDevice.getProperties().limits.bufferImageGranularity, 1);
+}
+
+void MemoryAllocator::Destroy()
+{
+    std::lock_guard<std::mutex> lock{ mutex };
+    for (auto &typeBlocks : blocks)
+        typeBlocks.clear();
+}
+
+const vk::PhysicalDeviceMemoryProperties &MemoryAllocator::GetProperties() const
+{
+    return memProps;
+}
+
+uint32_t MemoryAllocator::GetMemoryType(uint32_t typeBits, vk::MemoryPropertyFlags flags) const
+{
+    for (uint32_t i = 0; i < memProps.memoryTypeCount; ++i)
+    {
+        if (typeBits & (1 << i))
+        {
+            if ((memProps.memoryTypes[i].propertyFlags & flags) == flags)
+            {
+                return i;
+            }
+        }
+    }
+    throw std::runtime_error{ "No suitable memory types" };
+}
+
+bool MemoryAllocator::HasMemoryType(uint32_t typeBits, vk::MemoryPropertyFlags flags) const
+{
+    for (uint32_t i = 0; i < memProps.memoryTypeCount; ++i)
+    {
+        if ((typeBits & (1 << i)) && (memProps.memoryTypes[i].propertyFlags & flags) == flags)
+            return true;
+    }
+    return false;
+}
+
+Allocation MemoryAllocator::Allocate(
+    const vk::MemoryRequirements &memReqs,
+    vk::MemoryPropertyFlags flags,
+    AllocationTiling tiling,
+    bool dedicated)
+{
+    auto memoryType = GetMemoryType(memReqs.memoryTypeBits, flags);
+
+    // Big resources would just waste the rest of a block
+    if (dedicated || memReqs.size >= blockSize / 2)
+        return AllocateDedicated(memReqs.size, memoryType);
+
+    std::lock_guard<std::mutex> lock{ mutex };
+
+    Allocation allocation;
+    auto &typeBlocks = blocks[memoryType];
+    for (auto &block : typeBlocks)
+    {
+        if (block->Allocate(memReqs.size, memReqs.alignment, tiling, allocation))
+            return allocation;
+    }
+
+    // Nothing fits, so start a new block. Small heaps get smaller blocks.
+    auto heapSize = memProps.memoryHeaps[memProps.memoryTypes[memoryType].heapIndex].size;
+    auto newBlockSize = std::max(std::min(blockSize, heapSize / 8), memReqs.size);
+    typeBlocks.push_back(std::make_unique<MemoryBlock>(
+        device,
+        memoryType,
+        newBlockSize,
+        granularity,
+        AllocationStrategy::FreeList,
+        IsHostVisible(memoryType)
+    ));
+
+    if (!typeBlocks.back()->Allocate(memReqs.size, memReqs.alignment, tiling, allocation))
+        throw std::runtime_error{ "Allocation doesn't fit in a new memory block" };
+    return allocation;
+}
+
+Allocation MemoryAllocator::AllocateImage(vk::Image image, vk::MemoryPropertyFlags flags, bool dedicated)
+{
+    // Everything we create uses optimal tiling
+    auto memReqs = device.getImageMemoryRequirements(image);
+    auto allocation = Allocate(memReqs, flags, AllocationTiling::Optimal, dedicated);
+    device.bindImageMemory(image, allocation.memory, allocation.offset);
+    return allocation;
+}
+
+Allocation MemoryAllocator::AllocateBuffer(vk::Buffer buffer, vk::MemoryPropertyFlags flags, bool dedicated)
+{
+    auto memReqs = device.getBufferMemoryRequirements(buffer);
+    auto allocation = Allocate(memReqs, flags, AllocationTiling::Linear, dedicated);
+    device.bindBufferMemory(buffer, allocation.memory, allocation.offset);
+    return allocation;
+}
+
+void MemoryAllocator::Free(Allocation &allocation)
+{
+    if (!allocation.memory)
+        return;
+
+    std::lock_guard<std::mutex> lock{ mutex };
+
+    if (!allocation.block)
+    {
+        device.freeMemory(allocation.memory);
+        dedicatedCount--;
+        dedicatedBytes -= allocation.size;
+        allocation = Allocation();
+        return;
+    }
+
+    auto block = allocation.block;
+    block->Free(allocation);
+    allocation = Allocation();
+
+    // Keep at most one empty block per memory type around for reuse
+    if (block->GetStrategy() == AllocationStrategy::Linear || !block->IsEmpty())
+        return;
+
+    auto &typeBlocks = blocks[block->GetMemoryType()];
+    auto emptyBlocks = std::count_if(typeBlocks.begin(), typeBlocks.end(),
+        [](const std::unique_ptr<MemoryBlock> &b) { return b->IsEmpty(); });
+    if (emptyBlocks > 1)
+    {
+        typeBlocks.erase(std::find_if(typeBlocks.begin(), typeBlocks.end(),
+            [block](const std::unique_ptr<MemoryBlock> &b) { return b.get() == block; }));
+    }
+}
+
+std::unique_ptr<MemoryBlock> MemoryAllocator::CreateLinearBlock(vk::DeviceSize size, uint32_t memoryType)
+{
+    return std::make_unique<MemoryBlock>(
+        device,
+        memoryType,
+        size,
+        granularity,
+        AllocationStrategy::Linear,
+        IsHostVisible(memoryType)
+    );
+}
+
+AllocationStats MemoryAllocator::GetStats()
+{
+    std::lock_guard<std::mutex> lock{ mutex };
+
+    AllocationStats stats;
+    for (auto &typeBlocks : blocks)
+    {
+        for (auto &block : typeBlocks)
+            block->AddStats(stats);
+    }
+
+    stats.dedicatedCount = dedicatedCount;
+    stats.dedicatedBytes = dedicatedBytes;
+    if (stats.freeBytes > 0)
+        stats.fragmentation = 1.0 - (double)stats.largestFreeRange / (double)stats.freeBytes;
+    return stats;
+}
+
+Allocation MemoryAllocator::AllocateDedicated(vk::DeviceSize size, uint32_t memoryType)
+{
+    auto allocateInfo = vk::MemoryAllocateInfo()
+        .setAllocationSize(size)
+        .setMemoryTypeIndex(memoryType);
+
+    Allocation allocation;
+    allocation.memory = device.allocateMemory(allocateInfo);
+    allocation.size = size;
+    allocation.memoryType = memoryType;
+    if (IsHostVisible(memoryType))
+        allocation.mapped = (uint8_t *)device.mapMemory(allocation.memory, 0, VK_WHOLE_SIZE, vk::MemoryMapFlags());
+
+    std::lock_guard<std::mutex> lock{ mutex };
+    dedicatedCount++;
+    dedicatedBytes += size;
+    return allocation;
+}
+
+bool MemoryAllocator::IsHostVisible(uint32_t memoryType) const
+{
+    return (bool)(memProps.memoryTypes[memoryType].propertyFlags & vk::MemoryPropertyFlagBits::eHostVisible);
+}
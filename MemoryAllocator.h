@@ -0,0 +1,152 @@
+#pragma once
+
+#include <vulkan/vk_cpp.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class MemoryBlock;
+
+// Round up to a multiple of alignment, which doesn't have to be a power of two
+vk::DeviceSize AlignUp(vk::DeviceSize value, vk::DeviceSize alignment);
+
+// Linear resources (buffers, linear images) and optimal images can't share a
+// bufferImageGranularity page, so every suballocation remembers which it is.
+enum class AllocationTiling
+{
+    Linear,
+    Optimal,
+};
+
+enum class AllocationStrategy
+{
+    // Best-fit free list with coalescing, for long lived resources
+    FreeList,
+    // Bump pointer that's only ever reset as a whole, for transient data
+    Linear,
+};
+
+struct Allocation
+{
+    vk::DeviceMemory memory;
+    vk::DeviceSize offset = 0;
+    vk::DeviceSize size = 0;
+    // Host pointer to the start of the allocation, null if the memory isn't host visible
+    uint8_t *mapped = nullptr;
+    uint32_t memoryType = 0;
+    // Null for dedicated allocations
+    MemoryBlock *block = nullptr;
+};
+
+struct AllocationStats
+{
+    uint32_t blockCount = 0;
+    uint32_t dedicatedCount = 0;
+    vk::DeviceSize blockBytes = 0;
+    vk::DeviceSize dedicatedBytes = 0;
+    vk::DeviceSize usedBytes = 0;
+    vk::DeviceSize freeBytes = 0;
+    uint32_t freeRangeCount = 0;
+    vk::DeviceSize largestFreeRange = 0;
+    // 0 when all free space is one range, approaching 1 as it's split into small pieces
+    double fragmentation = 0.0;
+};
+
+class MemoryBlock
+{
+public:
+    MemoryBlock(
+        vk::Device device,
+        uint32_t memoryType,
+        vk::DeviceSize size,
+        vk::DeviceSize granularity,
+        AllocationStrategy strategy,
+        bool hostVisible
+    );
+    ~MemoryBlock();
+
+    bool Allocate(vk::DeviceSize size, vk::DeviceSize alignment, AllocationTiling tiling, Allocation &allocation);
+    void Free(const Allocation &allocation);
+    // Forget every allocation at once, only valid for linear blocks
+    void Reset();
+
+    bool IsEmpty() const;
+    void AddStats(AllocationStats &stats) const;
+
+    vk::DeviceMemory GetMemory() const;
+    uint32_t GetMemoryType() const;
+    AllocationStrategy GetStrategy() const;
+
+private:
+    struct Range
+    {
+        vk::DeviceSize size;
+        AllocationTiling tiling;
+        bool free;
+    };
+
+    bool AllocateFreeList(vk::DeviceSize size, vk::DeviceSize alignment, AllocationTiling tiling, vk::DeviceSize &offset);
+    bool AllocateLinear(vk::DeviceSize size, vk::DeviceSize alignment, AllocationTiling tiling, vk::DeviceSize &offset);
+    bool OnSamePage(vk::DeviceSize endA, vk::DeviceSize startB) const;
+
+    vk::Device device;
+    vk::DeviceMemory memory;
+    vk::DeviceSize size;
+    vk::DeviceSize granularity;
+    AllocationStrategy strategy;
+    uint32_t memoryType;
+    uint8_t *mapped;
+
+    // Free list: every range in the block, keyed by offset
+    std::map<vk::DeviceSize, Range> ranges;
+
+    // Linear: bump pointer and what the last allocation was
+    vk::DeviceSize head;
+    AllocationTiling lastTiling;
+    uint32_t liveCount;
+};
+
+class MemoryAllocator
+{
+public:
+    MemoryAllocator();
+    ~MemoryAllocator();
+
+    void Init(vk::PhysicalDevice physicalDevice, vk::Device device, vk::DeviceSize blockSize = 64 * 1024 * 1024);
+    void Destroy();
+
+    const vk::PhysicalDeviceMemoryProperties &GetProperties() const;
+    uint32_t GetMemoryType(uint32_t typeBits, vk::MemoryPropertyFlags flags) const;
+    bool HasMemoryType(uint32_t typeBits, vk::MemoryPropertyFlags flags) const;
+
+    Allocation Allocate(
+        const vk::MemoryRequirements &memReqs,
+        vk::MemoryPropertyFlags flags,
+        AllocationTiling tiling,
+        bool dedicated = false
+    );
+    // Allocate and bind memory for a resource
+    Allocation AllocateImage(vk::Image image, vk::MemoryPropertyFlags flags, bool dedicated = false);
+    Allocation AllocateBuffer(vk::Buffer buffer, vk::MemoryPropertyFlags flags, bool dedicated = false);
+    void Free(Allocation &allocation);
+
+    // Create a block that is handed out with a bump pointer and reset as a whole
+    std::unique_ptr<MemoryBlock> CreateLinearBlock(vk::DeviceSize size, uint32_t memoryType);
+
+    AllocationStats GetStats();
+
+private:
+    Allocation AllocateDedicated(vk::DeviceSize size, uint32_t memoryType);
+    bool IsHostVisible(uint32_t memoryType) const;
+
+    vk::Device device;
+    vk::PhysicalDeviceMemoryProperties memProps;
+    vk::DeviceSize blockSize;
+    vk::DeviceSize granularity;
+
+    std::mutex mutex;
+    std::vector<std::unique_ptr<MemoryBlock>> blocks[VK_MAX_MEMORY_TYPES];
+    uint32_t dedicatedCount;
+    vk::DeviceSize dedicatedBytes;
+};
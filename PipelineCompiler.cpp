@@ -0,0 +1,266 @@
+#include "PipelineCompiler.h"
+#include "Hash.h"
+#include "Log.h"
+#include <stdexcept>
+#include <string>
+
+PipelineDesc::PipelineDesc()
+    : topology(vk::PrimitiveTopology::eTriangleList),
+    polygonMode(vk::PolygonMode::eFill),
+    cullMode(vk::CullModeFlagBits::eBack),
+    frontFace(vk::FrontFace::eCounterClockwise),
+    depthTest(true),
+    depthWrite(true),
+    depthCompare(vk::CompareOp::eLessOrEqual),
+    blend(false),
+    colorAttachmentCount(1),
+    subpass(0)
+{
+}
+
+uint64_t PipelineDesc::GetHash() const
+{
+    // Every field goes in one at a time, struct padding would make raw bytes unreliable
+    Hasher hasher;
+    hasher.Add((uint64_t)shaders.size());
+    for (auto &shader : shaders)
+    {
+        hasher.Add((uint64_t)shader.stage);
+        hasher.Add((uint64_t)(VkShaderModule)shader.module);
+        hasher.Add(shader.entryPoint);
+    }
+
+    hasher.Add((uint64_t)vertexBindings.size());
+    for (auto &binding : vertexBindings)
+    {
+        hasher.Add((uint64_t)binding.binding);
+        hasher.Add((uint64_t)binding.stride);
+        hasher.Add((uint64_t)binding.inputRate);
+    }
+
+    hasher.Add((uint64_t)vertexAttributes.size());
+    for (auto &attribute : vertexAttributes)
+    {
+        hasher.Add((uint64_t)attribute.location);
+        hasher.Add((uint64_t)attribute.binding);
+        hasher.Add((uint64_t)attribute.format);
+        hasher.Add((uint64_t)attribute.offset);
+    }
+
+    hasher.Add((uint64_t)topology);
+    hasher.Add((uint64_t)polygonMode);
+    hasher.Add((uint64_t)(VkCullModeFlags)cullMode);
+    hasher.Add((uint64_t)frontFace);
+    hasher.Add((uint64_t)depthTest);
+    hasher.Add((uint64_t)depthWrite);
+    hasher.Add((uint64_t)depthCompare);
+    hasher.Add((uint64_t)blend);
+    hasher.Add((uint64_t)colorAttachmentCount);
+    hasher.Add((uint64_t)(VkPipelineLayout)layout);
+    hasher.Add((uint64_t)(VkRenderPass)renderPass);
+    hasher.Add((uint64_t)subpass);
+    return hasher.Get();
+}
+
+PipelineCompiler::PipelineCompiler()
+    : jobs(nullptr)
+{
+}
+
+PipelineCompiler::~PipelineCompiler()
+{
+    Destroy();
+}
+
+void PipelineCompiler::Init(vk::Device device, vk::PipelineCache cache, JobSystem &jobs)
+{
+    this->device = device;
+    this->cache = cache;
+    this->jobs = &jobs;
+}
+
+void PipelineCompiler::Destroy()
+{
+    if (!device)
+        return;
+
+    WaitAll();
+    for (auto &entry : entries)
+    {
+        if (entry.pipeline)
+            device.destroyPipeline(entry.pipeline);
+    }
+    entries.clear();
+    handles.clear();
+    device = nullptr;
+}
+
+PipelineHandle PipelineCompiler::Request(const PipelineDesc &desc, PipelineHandle fallback)
+{
+    auto hash = desc.GetHash();
+
+    std::lock_guard<std::mutex> lock{ mutex };
+    auto found = handles.find(hash);
+    if (found != handles.end())
+        return found->second;
+
+    auto handle = (PipelineHandle)entries.size();
+    entries.emplace_back();
+    auto entry = &entries.back();
+    entry->desc = desc;
+    entry->fallback = fallback;
+    handles[hash] = handle;
+
+    // Submitted under the lock so Wait never sees an entry that isn't queued yet
+    jobs->Submit([this, entry]() { Compile(*entry); }, &entry->done);
+    return handle;
+}
+
+vk::Pipeline PipelineCompiler::Get(PipelineHandle handle)
+{
+    std::lock_guard<std::mutex> lock{ mutex };
+
+    // Follow the fallbacks until one is ready
+    while (handle != InvalidPipeline)
+    {
+        auto &entry = Find(handle);
+        if (entry.done.IsDone() && entry.pipeline)
+            return entry.pipeline;
+        handle = entry.fallback;
+    }
+    return vk::Pipeline();
+}
+
+bool PipelineCompiler::IsReady(PipelineHandle handle)
+{
+    std::lock_guard<std::mutex> lock{ mutex };
+    return Find(handle).done.IsDone();
+}
+
+vk::Pipeline PipelineCompiler::Wait(PipelineHandle handle)
+{
+    Entry *entry;
+    {
+        std::lock_guard<std::mutex> lock{ mutex };
+        entry = &Find(handle);
+    }
+
+    jobs->Wait(entry->done);
+    return entry->pipeline;
+}
+
+void PipelineCompiler::WaitAll()
+{
+    std::unique_lock<std::mutex> lock{ mutex };
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        // Compiles don't take the lock, but requests made while waiting might
+        auto &entry = entries[i];
+        lock.unlock();
+        jobs->Wait(entry.done);
+        lock.lock();
+    }
+}
+
+uint32_t PipelineCompiler::GetCount()
+{
+    std::lock_guard<std::mutex> lock{ mutex };
+    return (uint32_t)entries.size();
+}
+
+PipelineCompiler::Entry &PipelineCompiler::Find(PipelineHandle handle)
+{
+    if (handle >= entries.size())
+        throw std::runtime_error{ "Invalid pipeline handle" };
+    return entries[handle];
+}
+
+void PipelineCompiler::Compile(Entry &entry)
+{
+    auto &desc = entry.desc;
+
+    std::vector<vk::PipelineShaderStageCreateInfo> stages;
+    for (auto &shader : desc.shaders)
+    {
+        stages.push_back(vk::PipelineShaderStageCreateInfo()
+            .setStage(shader.stage)
+            .setModule(shader.module)
+            .setPName(shader.entryPoint.c_str()));
+    }
+
+    auto vertexInput = vk::PipelineVertexInputStateCreateInfo()
+        .setVertexBindingDescriptionCount((uint32_t)desc.vertexBindings.size())
+        .setPVertexBindingDescriptions(desc.vertexBindings.data())
+        .setVertexAttributeDescriptionCount((uint32_t)desc.vertexAttributes.size())
+        .setPVertexAttributeDescriptions(desc.vertexAttributes.data());
+
+    auto inputAssembly = vk::PipelineInputAssemblyStateCreateInfo()
+        .setTopology(desc.topology);
+
+    // Set when drawing
+    auto viewport = vk::PipelineViewportStateCreateInfo()
+        .setViewportCount(1)
+        .setScissorCount(1);
+    vk::DynamicState dynamicStates[] = { vk::DynamicState::eViewport, vk::DynamicState::eScissor };
+    auto dynamic = vk::PipelineDynamicStateCreateInfo()
+        .setDynamicStateCount(2)
+        .setPDynamicStates(dynamicStates);
+
+    auto rasterization = vk::PipelineRasterizationStateCreateInfo()
+        .setPolygonMode(desc.polygonMode)
+        .setCullMode(desc.cullMode)
+        .setFrontFace(desc.frontFace)
+        .setLineWidth(1.0f);
+
+    auto multisample = vk::PipelineMultisampleStateCreateInfo()
+        .setRasterizationSamples(vk::SampleCountFlagBits::e1);
+
+    auto depthStencil = vk::PipelineDepthStencilStateCreateInfo()
+        .setDepthTestEnable(desc.depthTest)
+        .setDepthWriteEnable(desc.depthWrite)
+        .setDepthCompareOp(desc.depthCompare);
+
+    auto blendAttachment = vk::PipelineColorBlendAttachmentState()
+        .setBlendEnable(desc.blend)
+        .setSrcColorBlendFactor(vk::BlendFactor::eSrcAlpha)
+        .setDstColorBlendFactor(vk::BlendFactor::eOneMinusSrcAlpha)
+        .setColorBlendOp(vk::BlendOp::eAdd)
+        .setSrcAlphaBlendFactor(vk::BlendFactor::eOne)
+        .setDstAlphaBlendFactor(vk::BlendFactor::eOneMinusSrcAlpha)
+        .setAlphaBlendOp(vk::BlendOp::eAdd)
+        .setColorWriteMask(
+            vk::ColorComponentFlagBits::eR |
+            vk::ColorComponentFlagBits::eG |
+            vk::ColorComponentFlagBits::eB |
+            vk::ColorComponentFlagBits::eA);
+    std::vector<vk::PipelineColorBlendAttachmentState> blendAttachments(desc.colorAttachmentCount, blendAttachment);
+    auto blend = vk::PipelineColorBlendStateCreateInfo()
+        .setAttachmentCount((uint32_t)blendAttachments.size())
+        .setPAttachments(blendAttachments.data());
+
+    auto pipelineInfo = vk::GraphicsPipelineCreateInfo()
+        .setStageCount((uint32_t)stages.size())
+        .setPStages(stages.data())
+        .setPVertexInputState(&vertexInput)
+        .setPInputAssemblyState(&inputAssembly)
+        .setPViewportState(&viewport)
+        .setPRasterizationState(&rasterization)
+        .setPMultisampleState(&multisample)
+        .setPDepthStencilState(&depthStencil)
+        .setPColorBlendState(&blend)
+        .setPDynamicState(&dynamic)
+        .setLayout(desc.layout)
+        .setRenderPass(desc.renderPass)
+        .setSubpass(desc.subpass);
+
+    // Pipeline caches are internally synchronized, every worker can use the same one
+    vk::Pipeline pipeline;
+    auto result = device.createGraphicsPipelines(cache, 1, &pipelineInfo, nullptr, &pipeline);
+    if (result != vk::Result::eSuccess)
+    {
+        // Leaves the pipeline null, Get keeps handing out the fallback
+        Log("Pipeline compile failed: " + std::to_string((int)result));
+        return;
+    }
+    entry.pipeline = pipeline;
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "JobSystem.h"
+#include <vulkan/vk_cpp.h>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+typedef uint32_t PipelineHandle;
+
+static const PipelineHandle InvalidPipeline = UINT32_MAX;
+
+struct PipelineShaderDesc
+{
+    vk::ShaderStageFlagBits stage;
+    vk::ShaderModule module;
+    std::string entryPoint;
+};
+
+// Everything that goes into a graphics pipeline. Viewport and scissor are
+// always dynamic so pipelines don't depend on the window size.
+struct PipelineDesc
+{
+    std::vector<PipelineShaderDesc> shaders;
+    std::vector<vk::VertexInputBindingDescription> vertexBindings;
+    std::vector<vk::VertexInputAttributeDescription> vertexAttributes;
+    vk::PrimitiveTopology topology;
+    vk::PolygonMode polygonMode;
+    vk::CullModeFlags cullMode;
+    vk::FrontFace frontFace;
+    bool depthTest;
+    bool depthWrite;
+    vk::CompareOp depthCompare;
+    // Straight alpha blending on every color attachment
+    bool blend;
+    uint32_t colorAttachmentCount;
+    vk::PipelineLayout layout;
+    vk::RenderPass renderPass;
+    uint32_t subpass;
+
+    PipelineDesc();
+
+    uint64_t GetHash() const;
+};
+
+// Compiles graphics pipelines on the job system against a shared pipeline
+// cache. Identical descriptions share one pipeline. Requests return right
+// away, and until a pipeline is ready Get hands out its fallback instead so
+// rendering never waits on a compile.
+class PipelineCompiler
+{
+public:
+    PipelineCompiler();
+    ~PipelineCompiler();
+
+    void Init(vk::Device device, vk::PipelineCache cache, JobSystem &jobs);
+    // Waits for compiles still running and destroys every pipeline
+    void Destroy();
+
+    // Queue a compile, or return the handle of an identical earlier request.
+    // The fallback is used while this one compiles or if it fails.
+    PipelineHandle Request(const PipelineDesc &desc, PipelineHandle fallback = InvalidPipeline);
+
+    // Never blocks, returns the fallback's pipeline or a null handle when neither is ready
+    vk::Pipeline Get(PipelineHandle handle);
+    bool IsReady(PipelineHandle handle);
+    // Help compile until the pipeline is done, null if it failed
+    vk::Pipeline Wait(PipelineHandle handle);
+    void WaitAll();
+
+    uint32_t GetCount();
+
+private:
+    struct Entry
+    {
+        PipelineDesc desc;
+        PipelineHandle fallback;
+        JobCounter done;
+        vk::Pipeline pipeline;
+    };
+
+    Entry &Find(PipelineHandle handle);
+    void Compile(Entry &entry);
+
+    vk::Device device;
+    vk::PipelineCache cache;
+    JobSystem *jobs;
+
+    std::mutex mutex;
+    // Deque so entries stay put while compile jobs hold on to them
+    std::deque<Entry> entries;
+    std::unordered_map<uint64_t, PipelineHandle> handles;
+};
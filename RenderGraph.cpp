@@ -0,0 +1,678 @@
+#include "RenderGraph.h"
+#include "Log.h"
+#include <algorithm>
+#include <stdexcept>
+
+static const uint32_t NoGroup = UINT32_MAX;
+static const uint32_t NoAttachment = UINT32_MAX;
+
+static vk::ImageAspectFlags GetAspect(vk::Format format)
+{
+    switch (format)
+    {
+    case vk::Format::eD16Unorm:
+    case vk::Format::eX8D24UnormPack32:
+    case vk::Format::eD32Sfloat:
+        return vk::ImageAspectFlagBits::eDepth;
+    case vk::Format::eS8Uint:
+        return vk::ImageAspectFlagBits::eStencil;
+    case vk::Format::eD16UnormS8Uint:
+    case vk::Format::eD24UnormS8Uint:
+    case vk::Format::eD32SfloatS8Uint:
+        return vk::ImageAspectFlagBits::eDepth | vk::ImageAspectFlagBits::eStencil;
+    default:
+        return vk::ImageAspectFlagBits::eColor;
+    }
+}
+
+RenderGraph::RenderGraph(vk::Device device, MemoryAllocator &allocator, LayoutTracker &layouts, vk::Extent2D extent, RenderGraph *previous)
+    : device(device), allocator(allocator), layouts(layouts), extent(extent), compiled(false), previous(previous)
+{
+}
+
+RenderGraph::~RenderGraph()
+{
+    for (auto &group : groups)
+    {
+        for (auto framebuffer : group.framebuffers)
+            device.destroyFramebuffer(framebuffer);
+        if (group.renderPass)
+            device.destroyRenderPass(group.renderPass);
+    }
+
+    for (auto &resource : resources)
+    {
+        if (resource.imported || resource.images.empty())
+            continue;
+
+        layouts.Unregister(resource.images[0]);
+        for (auto view : resource.sampledViews)
+            device.destroyImageView(view);
+        device.destroyImageView(resource.views[0]);
+        device.destroyImage(resource.images[0]);
+    }
+
+    for (auto &slot : memory)
+        allocator.Free(slot.mem);
+}
+
+RenderResource RenderGraph::ImportImage(const char *name, vk::Format format, const std::vector<vk::Image> &images, const std::vector<vk::ImageView> &views)
+{
+    if (images.empty() || images.size() != views.size())
+        throw std::runtime_error{ "Imported images need a view each" };
+
+    Resource resource;
+    resource.name = name;
+    resource.format = format;
+    resource.imported = true;
+    resource.images = images;
+    resource.views = views;
+    resource.aspect = GetAspect(format);
+    resource.lazy = false;
+    resource.aliasPrevious = (RenderResource)resources.size();
+    resource.memorySlot = UINT32_MAX;
+    resources.push_back(resource);
+    return (RenderResource)resources.size() - 1;
+}
+
+RenderResource RenderGraph::CreateAttachment(const char *name, vk::Format format)
+{
+    Resource resource;
+    resource.name = name;
+    resource.format = format;
+    resource.imported = false;
+    resource.aspect = GetAspect(format);
+    resource.lazy = false;
+    resource.aliasPrevious = (RenderResource)resources.size();
+    resource.memorySlot = UINT32_MAX;
+    resources.push_back(resource);
+    return (RenderResource)resources.size() - 1;
+}
+
+RenderPassId RenderGraph::AddPass(const char *name, PassRecorder recorder, vk::SubpassContents contents)
+{
+    if (compiled)
+        throw std::runtime_error{ "Passes can't be added once the graph is compiled" };
+
+    Pass pass;
+    pass.name = name;
+    pass.recorder = std::move(recorder);
+    pass.contents = contents;
+    pass.group = NoGroup;
+    pass.subpass = 0;
+    passes.push_back(std::move(pass));
+    return (RenderPassId)passes.size() - 1;
+}
+
+void RenderGraph::WriteColor(RenderPassId pass, RenderResource resource)
+{
+    AddAttachment(pass, resource, false, false, vk::ClearValue());
+}
+
+void RenderGraph::WriteColor(RenderPassId pass, RenderResource resource, const vk::ClearColorValue &clear)
+{
+    vk::ClearValue clearValue;
+    clearValue.setColor(clear);
+    AddAttachment(pass, resource, false, true, clearValue);
+}
+
+void RenderGraph::WriteDepth(RenderPassId pass, RenderResource resource)
+{
+    AddAttachment(pass, resource, true, false, vk::ClearValue());
+}
+
+void RenderGraph::WriteDepth(RenderPassId pass, RenderResource resource, const vk::ClearDepthStencilValue &clear)
+{
+    vk::ClearValue clearValue;
+    clearValue.setDepthStencil(clear);
+    AddAttachment(pass, resource, true, true, clearValue);
+}
+
+void RenderGraph::ReadTexture(RenderPassId pass, RenderResource resource, vk::PipelineStageFlags stages)
+{
+    GetResource(resource).usage |= vk::ImageUsageFlagBits::eSampled;
+    GetPass(pass).reads.push_back(TextureRead{ resource, stages });
+}
+
+void RenderGraph::Compile()
+{
+    if (compiled)
+        throw std::runtime_error{ "Render graph is already compiled" };
+    compiled = true;
+
+    BuildGroups();
+    FindLifetimes();
+    CreateImages();
+    for (auto &group : groups)
+    {
+        if (group.attachments.empty())
+            continue;
+        CreateRenderPass(group);
+        CreateFramebuffers(group);
+    }
+    previous = nullptr;
+}
+
+void RenderGraph::Execute(vk::CommandBuffer commandBuffer, uint32_t imageIndex, GpuProfiler *profiler, uint32_t profilerSlot)
+{
+    for (uint32_t groupIndex = 0; groupIndex < groups.size(); ++groupIndex)
+    {
+        auto &group = groups[groupIndex];
+        auto scope = GpuProfiler::InvalidScope;
+        if (profiler)
+            scope = profiler->BeginScope(commandBuffer, profilerSlot, passes[group.passes.front()].name.c_str());
+
+        // Everything the render pass touches goes through one barrier up front
+        for (auto passIndex : group.passes)
+        {
+            for (auto &read : passes[passIndex].reads)
+                layouts.Transition(GetImage(read.resource, imageIndex), ImageState::ShaderRead(read.stages));
+        }
+        for (uint32_t i = 0; i < group.attachments.size(); ++i)
+        {
+            auto &resource = resources[group.attachments[i]];
+            auto image = GetImage(group.attachments[i], imageIndex);
+
+            // The memory may have been used by another image since this one last
+            // used it, so wait for whatever that image did last instead
+            if (!resource.imported && resource.firstGroup == groupIndex)
+            {
+                auto previous = layouts.GetState(GetImage(resource.aliasPrevious));
+                layouts.Assume(image, ImageState(vk::ImageLayout::eUndefined, previous.access, previous.stages));
+            }
+
+            auto usage = resource.aspect & vk::ImageAspectFlagBits::eColor
+                ? ImageState::ColorAttachment()
+                : ImageState::DepthStencilAttachment();
+            layouts.Transition(image, usage, group.loadOps[i] != vk::AttachmentLoadOp::eLoad);
+        }
+        layouts.Flush(commandBuffer);
+
+        RenderPassContext context;
+        context.renderPass = group.renderPass;
+        context.subpass = 0;
+        context.extent = extent;
+        context.imageIndex = imageIndex;
+
+        if (!group.renderPass)
+        {
+            auto &pass = passes[group.passes.front()];
+            if (pass.recorder)
+                pass.recorder(commandBuffer, context);
+        }
+        else
+        {
+            context.framebuffer = group.framebuffers[imageIndex % group.framebuffers.size()];
+            auto passInfo = vk::RenderPassBeginInfo()
+                .setRenderPass(group.renderPass)
+                .setFramebuffer(context.framebuffer)
+                .setRenderArea(vk::Rect2D({ 0, 0 }, extent))
+                .setClearValueCount((uint32_t)group.clearValues.size())
+                .setPClearValues(group.clearValues.data());
+
+            for (uint32_t subpass = 0; subpass < group.passes.size(); ++subpass)
+            {
+                auto &pass = passes[group.passes[subpass]];
+                if (subpass == 0)
+                    commandBuffer.beginRenderPass(passInfo, pass.contents);
+                else
+                    commandBuffer.nextSubpass(pass.contents);
+
+                context.subpass = subpass;
+                if (pass.recorder)
+                    pass.recorder(commandBuffer, context);
+            }
+            commandBuffer.endRenderPass();
+        }
+
+        if (profiler)
+            profiler->EndScope(commandBuffer, profilerSlot, scope);
+    }
+}
+
+vk::RenderPass RenderGraph::GetRenderPass(RenderPassId pass) const
+{
+    return groups[passes[pass].group].renderPass;
+}
+
+uint32_t RenderGraph::GetSubpass(RenderPassId pass) const
+{
+    return passes[pass].subpass;
+}
+
+vk::Image RenderGraph::GetImage(RenderResource resource, uint32_t imageIndex) const
+{
+    auto &images = resources[resource].images;
+    return images[imageIndex % images.size()];
+}
+
+vk::ImageView RenderGraph::GetView(RenderResource resource, uint32_t imageIndex) const
+{
+    auto &views = resources[resource].views;
+    return views[imageIndex % views.size()];
+}
+
+vk::ImageView RenderGraph::GetSampledView(RenderResource resource, uint32_t imageIndex) const
+{
+    auto &views = resources[resource].sampledViews.empty() ? resources[resource].views : resources[resource].sampledViews;
+    return views[imageIndex % views.size()];
+}
+
+vk::Extent2D RenderGraph::GetExtent() const
+{
+    return extent;
+}
+
+RenderGraph::Resource &RenderGraph::GetResource(RenderResource resource)
+{
+    if (resource >= resources.size())
+        throw std::runtime_error{ "Invalid render graph resource" };
+    return resources[resource];
+}
+
+RenderGraph::Pass &RenderGraph::GetPass(RenderPassId pass)
+{
+    if (compiled)
+        throw std::runtime_error{ "Passes can't be changed once the graph is compiled" };
+    if (pass >= passes.size())
+        throw std::runtime_error{ "Invalid render graph pass" };
+    return passes[pass];
+}
+
+void RenderGraph::AddAttachment(RenderPassId pass, RenderResource resource, bool depth, bool clear, const vk::ClearValue &clearValue)
+{
+    auto &target = GetResource(resource);
+    bool isDepth = !(target.aspect & vk::ImageAspectFlagBits::eColor);
+    if (depth != isDepth)
+        throw std::runtime_error{ "Attachment " + target.name + " has the wrong format for how it's used" };
+
+    target.usage |= depth ? vk::ImageUsageFlagBits::eDepthStencilAttachment : vk::ImageUsageFlagBits::eColorAttachment;
+    GetPass(pass).attachments.push_back(Attachment{ resource, depth, clear, clearValue });
+}
+
+void RenderGraph::BuildGroups()
+{
+    for (RenderPassId passIndex = 0; passIndex < passes.size(); ++passIndex)
+    {
+        auto &pass = passes[passIndex];
+
+        // A pass can become the next subpass as long as it doesn't sample
+        // anything the render pass so far writes, that needs a layout change
+        bool merge = !pass.attachments.empty() && !groups.empty() && !groups.back().attachments.empty();
+        for (auto &read : pass.reads)
+            merge = merge && FindAttachment(groups.back(), read.resource) == NoAttachment;
+
+        if (!merge)
+            groups.push_back(Group());
+        auto &group = groups.back();
+
+        pass.group = (uint32_t)groups.size() - 1;
+        pass.subpass = (uint32_t)group.passes.size();
+        group.passes.push_back(passIndex);
+
+        for (auto &attachment : pass.attachments)
+        {
+            if (FindAttachment(group, attachment.resource) != NoAttachment)
+                continue;
+
+            // Everything about loading comes from the first subpass to use it
+            auto &resource = resources[attachment.resource];
+            bool writtenBefore = false;
+            for (RenderPassId earlier = 0; earlier < passIndex; ++earlier)
+            {
+                for (auto &other : passes[earlier].attachments)
+                    writtenBefore = writtenBefore || other.resource == attachment.resource;
+            }
+
+            auto loadOp = vk::AttachmentLoadOp::eDontCare;
+            if (attachment.clear)
+                loadOp = vk::AttachmentLoadOp::eClear;
+            else if (resource.imported || writtenBefore)
+                loadOp = vk::AttachmentLoadOp::eLoad;
+
+            group.attachments.push_back(attachment.resource);
+            group.loadOps.push_back(loadOp);
+            group.clearValues.push_back(attachment.clearValue);
+        }
+    }
+}
+
+void RenderGraph::FindLifetimes()
+{
+    for (auto &resource : resources)
+    {
+        resource.firstGroup = NoGroup;
+        resource.lastGroup = 0;
+    }
+
+    auto use = [this](RenderResource id, uint32_t group)
+    {
+        auto &resource = resources[id];
+        resource.firstGroup = std::min(resource.firstGroup, group);
+        resource.lastGroup = std::max(resource.lastGroup, group);
+    };
+
+    for (auto &pass : passes)
+    {
+        for (auto &attachment : pass.attachments)
+            use(attachment.resource, pass.group);
+        for (auto &read : pass.reads)
+            use(read.resource, pass.group);
+    }
+
+    // Never sampled and never needed outside one render pass means the
+    // contents only ever have to exist in tile memory
+    for (auto &resource : resources)
+    {
+        resource.lazy = !resource.imported &&
+            resource.firstGroup != NoGroup &&
+            resource.firstGroup == resource.lastGroup &&
+            !(resource.usage & vk::ImageUsageFlagBits::eSampled);
+        if (resource.lazy)
+            resource.usage |= vk::ImageUsageFlagBits::eTransientAttachment;
+    }
+}
+
+void RenderGraph::CreateImages()
+{
+    // Place images in the order they start living so earlier ones free up memory for later ones
+    std::vector<RenderResource> order;
+    for (RenderResource id = 0; id < resources.size(); ++id)
+    {
+        if (!resources[id].imported && resources[id].firstGroup != NoGroup)
+            order.push_back(id);
+    }
+    std::stable_sort(order.begin(), order.end(), [this](RenderResource a, RenderResource b)
+    {
+        return resources[a].firstGroup < resources[b].firstGroup;
+    });
+
+    // Images sharing each memory slot, in the order they use it
+    std::vector<std::vector<RenderResource>> occupants;
+    vk::DeviceSize lazySize = 0;
+    for (auto id : order)
+    {
+        auto &resource = resources[id];
+        auto imageInfo = vk::ImageCreateInfo()
+            .setImageType(vk::ImageType::e2D)
+            .setFormat(resource.format)
+            .setExtent({ extent.width, extent.height, 1 })
+            .setMipLevels(1)
+            .setArrayLayers(1)
+            .setSamples(vk::SampleCountFlagBits::e1)
+            .setTiling(vk::ImageTiling::eOptimal)
+            .setUsage(resource.usage);
+        auto image = device.createImage(imageInfo);
+        auto memReqs = device.getImageMemoryRequirements(image);
+
+        // Lazily allocated memory is only backed if the tiler actually needs it.
+        // It gets its own allocation, sharing a block would commit the whole block.
+        resource.aliasPrevious = id;
+        resource.memorySlot = (uint32_t)memory.size();
+        // Anything new while replacing a graph gets some headroom, so growing
+        // a window doesn't allocate again on every resize
+        auto allocReqs = memReqs;
+        if (previous)
+            allocReqs.size += allocReqs.size / 4;
+
+        if (resource.lazy && allocator.HasMemoryType(memReqs.memoryTypeBits, vk::MemoryPropertyFlagBits::eLazilyAllocated))
+        {
+            MemorySlot slot;
+            if (!TakePreviousMemory(memReqs, true, slot))
+                slot.mem = allocator.Allocate(allocReqs, vk::MemoryPropertyFlagBits::eLazilyAllocated, AllocationTiling::Optimal, true);
+            slot.lastGroup = NoGroup;
+            memory.push_back(slot);
+            occupants.push_back({ id });
+            lazySize += memReqs.size;
+        }
+        else
+        {
+            // Reuse memory whose images are all done by the time this one starts
+            for (uint32_t i = 0; i < memory.size(); ++i)
+            {
+                auto &slot = memory[i];
+                if (slot.lastGroup < resource.firstGroup &&
+                    memReqs.size <= slot.mem.size &&
+                    slot.mem.offset % memReqs.alignment == 0 &&
+                    (memReqs.memoryTypeBits & (1 << slot.mem.memoryType)))
+                {
+                    resource.memorySlot = i;
+                    break;
+                }
+            }
+
+            if (resource.memorySlot == memory.size())
+            {
+                MemorySlot slot;
+                if (!TakePreviousMemory(memReqs, false, slot))
+                    slot.mem = allocator.Allocate(allocReqs, vk::MemoryPropertyFlagBits::eDeviceLocal, AllocationTiling::Optimal);
+                memory.push_back(slot);
+                occupants.push_back({});
+            }
+
+            memory[resource.memorySlot].lastGroup = resource.lastGroup;
+            occupants[resource.memorySlot].push_back(id);
+        }
+
+        auto &mem = memory[resource.memorySlot].mem;
+        device.bindImageMemory(image, mem.memory, mem.offset);
+
+        auto viewInfo = vk::ImageViewCreateInfo()
+            .setViewType(vk::ImageViewType::e2D)
+            .setFormat(resource.format)
+            .setSubresourceRange(vk::ImageSubresourceRange()
+                .setAspectMask(resource.aspect)
+                .setLevelCount(1)
+                .setLayerCount(1))
+            .setImage(image);
+
+        resource.images.push_back(image);
+        resource.views.push_back(device.createImageView(viewInfo));
+        layouts.Register(image, resource.aspect, memory[resource.memorySlot].inherited);
+
+        bool depthStencil = (resource.aspect & vk::ImageAspectFlagBits::eDepth) && (resource.aspect & vk::ImageAspectFlagBits::eStencil);
+        if (depthStencil && (resource.usage & vk::ImageUsageFlagBits::eSampled))
+        {
+            viewInfo.subresourceRange.setAspectMask(vk::ImageAspectFlagBits::eDepth);
+            resource.sampledViews.push_back(device.createImageView(viewInfo));
+        }
+    }
+
+    // Each image waits on the one before it in its slot, the first on the last
+    // since that's who used the memory in the previous frame
+    vk::DeviceSize aliasedSize = 0;
+    for (auto &slot : occupants)
+    {
+        for (size_t i = 0; i < slot.size(); ++i)
+            resources[slot[i]].aliasPrevious = slot[(i + slot.size() - 1) % slot.size()];
+        for (size_t i = 1; i < slot.size(); ++i)
+            aliasedSize += device.getImageMemoryRequirements(resources[slot[i]].images[0]).size;
+    }
+
+    Log("Render graph: " + std::to_string(passes.size()) + " passes in " + std::to_string(groups.size()) +
+        " groups, " + std::to_string(order.size()) + " images, " + std::to_string(lazySize / 1024) +
+        " KiB lazily allocated, " + std::to_string(aliasedSize / 1024) + " KiB saved by aliasing");
+}
+
+bool RenderGraph::TakePreviousMemory(const vk::MemoryRequirements &memReqs, bool lazy, MemorySlot &slot)
+{
+    if (!previous)
+        return false;
+
+    for (uint32_t i = 0; i < previous->memory.size(); ++i)
+    {
+        auto &old = previous->memory[i];
+        if (!old.mem.memory ||
+            (old.lastGroup == NoGroup) != lazy ||
+            memReqs.size > old.mem.size ||
+            old.mem.offset % memReqs.alignment != 0 ||
+            !(memReqs.memoryTypeBits & (1 << old.mem.memoryType)))
+            continue;
+
+        // Frames still in flight may use the old images, so whatever
+        // they did last has to finish before the new ones start
+        slot.mem = old.mem;
+        slot.inherited = ImageState();
+        for (auto &resource : previous->resources)
+        {
+            if (resource.imported || resource.memorySlot != i || resource.images.empty())
+                continue;
+            auto state = layouts.GetState(resource.images[0]);
+            slot.inherited.access |= state.access;
+            slot.inherited.stages |= state.stages;
+        }
+
+        // The previous graph no longer frees it
+        old.mem = Allocation();
+        return true;
+    }
+    return false;
+}
+
+void RenderGraph::CreateRenderPass(Group &group)
+{
+    auto groupIndex = passes[group.passes.front()].group;
+
+    std::vector<vk::AttachmentDescription> descriptions;
+    for (uint32_t i = 0; i < group.attachments.size(); ++i)
+    {
+        auto &resource = resources[group.attachments[i]];
+
+        // Stored only when someone after this render pass looks at it
+        auto storeOp = resource.imported || resource.lastGroup > groupIndex
+            ? vk::AttachmentStoreOp::eStore
+            : vk::AttachmentStoreOp::eDontCare;
+
+        // The tracker has the image in the attachment layout before the pass starts
+        auto layout = resource.aspect & vk::ImageAspectFlagBits::eColor
+            ? vk::ImageLayout::eColorAttachmentOptimal
+            : vk::ImageLayout::eDepthStencilAttachmentOptimal;
+
+        bool stencil = (bool)(resource.aspect & vk::ImageAspectFlagBits::eStencil);
+        descriptions.push_back(vk::AttachmentDescription
+        {
+            vk::AttachmentDescriptionFlags(),
+            resource.format,
+            vk::SampleCountFlagBits::e1,
+            group.loadOps[i],
+            storeOp,
+            stencil ? group.loadOps[i] : vk::AttachmentLoadOp::eDontCare,
+            stencil ? storeOp : vk::AttachmentStoreOp::eDontCare,
+            layout,
+            layout,
+        });
+    }
+
+    // References have to stay alive until the render pass is created
+    std::vector<std::vector<vk::AttachmentReference>> colorReferences(group.passes.size());
+    std::vector<vk::AttachmentReference> depthReferences(group.passes.size());
+    std::vector<std::vector<uint32_t>> preserveReferences(group.passes.size());
+    std::vector<vk::SubpassDescription> subpasses;
+    for (uint32_t subpass = 0; subpass < group.passes.size(); ++subpass)
+    {
+        auto &pass = passes[group.passes[subpass]];
+        bool hasDepth = false;
+        std::vector<bool> used(group.attachments.size(), false);
+        for (auto &attachment : pass.attachments)
+        {
+            auto index = FindAttachment(group, attachment.resource);
+            used[index] = true;
+            if (attachment.depth)
+            {
+                depthReferences[subpass] = vk::AttachmentReference(index, vk::ImageLayout::eDepthStencilAttachmentOptimal);
+                hasDepth = true;
+            }
+            else
+            {
+                colorReferences[subpass].push_back(vk::AttachmentReference(index, vk::ImageLayout::eColorAttachmentOptimal));
+            }
+        }
+
+        // Anything a later subpass uses has to survive this one
+        for (uint32_t index = 0; index < group.attachments.size(); ++index)
+        {
+            if (used[index])
+                continue;
+            for (auto later = subpass + 1; later < group.passes.size(); ++later)
+            {
+                auto &laterPass = passes[group.passes[later]];
+                bool needed = false;
+                for (auto &attachment : laterPass.attachments)
+                    needed = needed || attachment.resource == group.attachments[index];
+                if (needed)
+                {
+                    preserveReferences[subpass].push_back(index);
+                    break;
+                }
+            }
+        }
+
+        subpasses.push_back(vk::SubpassDescription()
+            .setPipelineBindPoint(vk::PipelineBindPoint::eGraphics)
+            .setColorAttachmentCount((uint32_t)colorReferences[subpass].size())
+            .setPColorAttachments(colorReferences[subpass].data())
+            .setPDepthStencilAttachment(hasDepth ? &depthReferences[subpass] : nullptr)
+            .setPreserveAttachmentCount((uint32_t)preserveReferences[subpass].size())
+            .setPPreserveAttachments(preserveReferences[subpass].data()));
+    }
+
+    // Each subpass finishes its attachment writes before the next one touches them
+    std::vector<vk::SubpassDependency> dependencies;
+    for (uint32_t subpass = 1; subpass < group.passes.size(); ++subpass)
+    {
+        dependencies.push_back(vk::SubpassDependency()
+            .setSrcSubpass(subpass - 1)
+            .setDstSubpass(subpass)
+            .setSrcStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput | vk::PipelineStageFlagBits::eLateFragmentTests)
+            .setDstStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput | vk::PipelineStageFlagBits::eEarlyFragmentTests)
+            .setSrcAccessMask(vk::AccessFlagBits::eColorAttachmentWrite | vk::AccessFlagBits::eDepthStencilAttachmentWrite)
+            .setDstAccessMask(
+                vk::AccessFlagBits::eColorAttachmentRead | vk::AccessFlagBits::eColorAttachmentWrite |
+                vk::AccessFlagBits::eDepthStencilAttachmentRead | vk::AccessFlagBits::eDepthStencilAttachmentWrite)
+            .setDependencyFlags(vk::DependencyFlagBits::eByRegion));
+    }
+
+    auto renderPassInfo = vk::RenderPassCreateInfo()
+        .setAttachmentCount((uint32_t)descriptions.size())
+        .setPAttachments(descriptions.data())
+        .setSubpassCount((uint32_t)subpasses.size())
+        .setPSubpasses(subpasses.data())
+        .setDependencyCount((uint32_t)dependencies.size())
+        .setPDependencies(dependencies.data());
+
+    group.renderPass = device.createRenderPass(renderPassInfo);
+}
+
+void RenderGraph::CreateFramebuffers(Group &group)
+{
+    // Imported images with several images, like the swap chain, need a framebuffer each
+    size_t count = 1;
+    for (auto id : group.attachments)
+        count = std::max(count, resources[id].images.size());
+
+    std::vector<vk::ImageView> views(group.attachments.size());
+    for (size_t imageIndex = 0; imageIndex < count; ++imageIndex)
+    {
+        for (size_t i = 0; i < group.attachments.size(); ++i)
+            views[i] = GetView(group.attachments[i], (uint32_t)imageIndex);
+
+        auto fbInfo = vk::FramebufferCreateInfo()
+            .setRenderPass(group.renderPass)
+            .setAttachmentCount((uint32_t)views.size())
+            .setPAttachments(views.data())
+            .setWidth(extent.width)
+            .setHeight(extent.height)
+            .setLayers(1);
+        group.framebuffers.push_back(device.createFramebuffer(fbInfo));
+    }
+}
+
+uint32_t RenderGraph::FindAttachment(const Group &group, RenderResource resource) const
+{
+    for (uint32_t i = 0; i < group.attachments.size(); ++i)
+    {
+        if (group.attachments[i] == resource)
+            return i;
+    }
+    return NoAttachment;
+}
@@ -0,0 +1,174 @@
+#pragma once
+
+#include "GpuProfiler.h"
+#include "LayoutTracker.h"
+#include "MemoryAllocator.h"
+#include <vulkan/vk_cpp.h>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+typedef uint32_t RenderResource;
+typedef uint32_t RenderPassId;
+
+// What a pass needs to record into its subpass or begin secondaries with
+struct RenderPassContext
+{
+    // Null for passes without attachments
+    vk::RenderPass renderPass;
+    uint32_t subpass;
+    vk::Framebuffer framebuffer;
+    vk::Extent2D extent;
+    uint32_t imageIndex;
+};
+
+// Passes declare what they read and write, the graph works out everything
+// else when compiled:
+// - Consecutive passes that only render to attachments are merged into the
+//   subpasses of one render pass.
+// - Attachments load what an earlier pass wrote, otherwise clear or don't care,
+//   and are only stored when a later pass or someone outside the graph reads them.
+// - Barriers come from the layout tracker before each render pass.
+// - Attachments the graph owns that live and die inside one render pass get
+//   transient, lazily allocated images. The others share memory with owned
+//   images whose lifetimes don't overlap.
+// Passes run in the order they were added. Everything is sized to the graph's
+// extent, so a resize builds a new graph, which takes over the memory of the
+// graph it replaces wherever its images still fit.
+class RenderGraph
+{
+public:
+    typedef std::function<void(vk::CommandBuffer commandBuffer, const RenderPassContext &context)> PassRecorder;
+
+    // Memory the previous graph's images no longer need moves to this one when it's
+    // compiled, the rest stays with it. It has to stay alive until Compile returns.
+    RenderGraph(vk::Device device, MemoryAllocator &allocator, LayoutTracker &layouts, vk::Extent2D extent, RenderGraph *previous = nullptr);
+    ~RenderGraph();
+
+    RenderGraph(const RenderGraph &) = delete;
+    RenderGraph &operator=(const RenderGraph &) = delete;
+
+    // Images owned by someone else, e.g. the swap chain. With several images the
+    // one used is picked by the image index passed to Execute. They have to be
+    // registered with the layout tracker and are always stored.
+    RenderResource ImportImage(const char *name, vk::Format format, const std::vector<vk::Image> &images, const std::vector<vk::ImageView> &views);
+    RenderResource CreateAttachment(const char *name, vk::Format format);
+
+    RenderPassId AddPass(const char *name, PassRecorder recorder, vk::SubpassContents contents = vk::SubpassContents::eInline);
+    void WriteColor(RenderPassId pass, RenderResource resource);
+    void WriteColor(RenderPassId pass, RenderResource resource, const vk::ClearColorValue &clear);
+    void WriteDepth(RenderPassId pass, RenderResource resource);
+    void WriteDepth(RenderPassId pass, RenderResource resource, const vk::ClearDepthStencilValue &clear);
+    // Sampled in the given shader stages
+    void ReadTexture(RenderPassId pass, RenderResource resource, vk::PipelineStageFlags stages);
+
+    // Create render passes, framebuffers and the images the graph owns
+    void Compile();
+    void Execute(vk::CommandBuffer commandBuffer, uint32_t imageIndex, GpuProfiler *profiler = nullptr, uint32_t profilerSlot = 0);
+
+    // For creating pipelines and inheritance info, valid once compiled
+    vk::RenderPass GetRenderPass(RenderPassId pass) const;
+    uint32_t GetSubpass(RenderPassId pass) const;
+    vk::Image GetImage(RenderResource resource, uint32_t imageIndex = 0) const;
+    vk::ImageView GetView(RenderResource resource, uint32_t imageIndex = 0) const;
+    // For passes that read the resource, depth only for combined depth stencil images
+    vk::ImageView GetSampledView(RenderResource resource, uint32_t imageIndex = 0) const;
+    vk::Extent2D GetExtent() const;
+
+private:
+    struct Resource
+    {
+        std::string name;
+        vk::Format format;
+        bool imported;
+        std::vector<vk::Image> images;
+        std::vector<vk::ImageView> views;
+        // Only for owned depth stencil images that are read, a view can only sample one aspect
+        std::vector<vk::ImageView> sampledViews;
+        vk::ImageUsageFlags usage;
+        vk::ImageAspectFlags aspect;
+
+        // Derived when compiled
+        uint32_t firstGroup;
+        uint32_t lastGroup;
+        bool lazy;
+        // Owned image that used the memory last, its final barrier has to
+        // finish before this one starts. Itself when nothing is aliased.
+        RenderResource aliasPrevious;
+        // Index into memory, or none for imported images
+        uint32_t memorySlot;
+    };
+
+    struct Attachment
+    {
+        RenderResource resource;
+        bool depth;
+        bool clear;
+        vk::ClearValue clearValue;
+    };
+
+    struct TextureRead
+    {
+        RenderResource resource;
+        vk::PipelineStageFlags stages;
+    };
+
+    struct Pass
+    {
+        std::string name;
+        PassRecorder recorder;
+        vk::SubpassContents contents;
+        std::vector<Attachment> attachments;
+        std::vector<TextureRead> reads;
+
+        uint32_t group;
+        uint32_t subpass;
+    };
+
+    // Passes sharing a render pass, or a single pass without attachments
+    struct Group
+    {
+        std::vector<RenderPassId> passes;
+        // Every resource used as an attachment by any subpass, in attachment order
+        std::vector<RenderResource> attachments;
+        std::vector<vk::AttachmentLoadOp> loadOps;
+        std::vector<vk::ClearValue> clearValues;
+        vk::RenderPass renderPass;
+        // One per image index when an imported image with several images is attached
+        std::vector<vk::Framebuffer> framebuffers;
+    };
+
+    struct MemorySlot
+    {
+        Allocation mem;
+        // NoGroup for lazily allocated memory, which is never shared
+        uint32_t lastGroup;
+        // Last use by the previous graph's images, the first barrier waits for it
+        ImageState inherited;
+    };
+
+    Resource &GetResource(RenderResource resource);
+    Pass &GetPass(RenderPassId pass);
+    void AddAttachment(RenderPassId pass, RenderResource resource, bool depth, bool clear, const vk::ClearValue &clearValue);
+    void BuildGroups();
+    void FindLifetimes();
+    void CreateImages();
+    bool TakePreviousMemory(const vk::MemoryRequirements &memReqs, bool lazy, MemorySlot &slot);
+    void CreateRenderPass(Group &group);
+    void CreateFramebuffers(Group &group);
+    uint32_t FindAttachment(const Group &group, RenderResource resource) const;
+
+    vk::Device device;
+    MemoryAllocator &allocator;
+    LayoutTracker &layouts;
+    vk::Extent2D extent;
+    bool compiled;
+    // Only until compiled
+    RenderGraph *previous;
+
+    std::vector<Resource> resources;
+    std::vector<Pass> passes;
+    std::vector<Group> groups;
+    std::vector<MemorySlot> memory;
+};
@@ -0,0 +1,335 @@
+#include "Scene.h"
+#include "Frustum.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <stdexcept>
+#include <immintrin.h>
+
+// Boxes are culled in blocks of this many, the bounds arrays are padded to it
+static const uint32_t BlockSize = 8;
+// Fewer nodes than this per job and splitting the work costs more than it saves
+static const uint32_t MinUpdateChunk = 1024;
+static const uint32_t MinCullBlocks = 512;
+
+static uint32_t PaddedCount(uint32_t count)
+{
+    return (count + BlockSize - 1) / BlockSize * BlockSize;
+}
+
+static uint32_t ChunkCount(JobSystem &jobs, uint32_t count, uint32_t minChunk)
+{
+    return std::max(std::min(jobs.GetThreadCount(), count / minChunk), 1u);
+}
+
+// out = a * b, column major, out may not alias either input
+static void Multiply(const float *a, const float *b, float *out)
+{
+#ifdef __AVX__
+    // Each half works on one column of b, so two output columns come out at once
+    auto a0 = _mm256_broadcast_ps((const __m128 *)(a + 0));
+    auto a1 = _mm256_broadcast_ps((const __m128 *)(a + 4));
+    auto a2 = _mm256_broadcast_ps((const __m128 *)(a + 8));
+    auto a3 = _mm256_broadcast_ps((const __m128 *)(a + 12));
+    for (int col = 0; col < 16; col += 8)
+    {
+        auto bCols = _mm256_loadu_ps(b + col);
+        auto r = _mm256_mul_ps(a0, _mm256_permute_ps(bCols, 0x00));
+        r = _mm256_add_ps(r, _mm256_mul_ps(a1, _mm256_permute_ps(bCols, 0x55)));
+        r = _mm256_add_ps(r, _mm256_mul_ps(a2, _mm256_permute_ps(bCols, 0xaa)));
+        r = _mm256_add_ps(r, _mm256_mul_ps(a3, _mm256_permute_ps(bCols, 0xff)));
+        _mm256_storeu_ps(out + col, r);
+    }
+#else
+    auto a0 = _mm_loadu_ps(a + 0);
+    auto a1 = _mm_loadu_ps(a + 4);
+    auto a2 = _mm_loadu_ps(a + 8);
+    auto a3 = _mm_loadu_ps(a + 12);
+    for (int col = 0; col < 16; col += 4)
+    {
+        auto r = _mm_mul_ps(a0, _mm_set1_ps(b[col + 0]));
+        r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_set1_ps(b[col + 1])));
+        r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_set1_ps(b[col + 2])));
+        r = _mm_add_ps(r, _mm_mul_ps(a3, _mm_set1_ps(b[col + 3])));
+        _mm_storeu_ps(out + col, r);
+    }
+#endif
+}
+
+Scene::Scene()
+    : levelsDirty(false)
+{
+    for (auto &plane : planes)
+        std::fill(plane, plane + 4, 0.0f);
+}
+
+void Scene::Reserve(uint32_t capacity)
+{
+    parents.reserve(capacity);
+    levels.reserve(capacity);
+    locals.reserve(capacity);
+    worlds.reserve(capacity);
+    localBounds.reserve(capacity * 8);
+    for (auto array : { &centerX, &centerY, &centerZ, &extentX, &extentY, &extentZ })
+        array->reserve(PaddedCount(capacity));
+    levelOrder.reserve(capacity);
+    visible.reserve(capacity);
+}
+
+void Scene::Clear()
+{
+    parents.clear();
+    levels.clear();
+    locals.clear();
+    worlds.clear();
+    localBounds.clear();
+    for (auto array : { &centerX, &centerY, &centerZ, &extentX, &extentY, &extentZ })
+        array->clear();
+    levelOrder.clear();
+    levelStarts.clear();
+    levelsDirty = false;
+    visible.clear();
+}
+
+uint32_t Scene::Add(uint32_t parent, const SceneMatrix &local)
+{
+    auto node = GetCount();
+    if (parent != NoParent && parent >= node)
+        throw std::runtime_error{ "Scene parents have to be added before their children" };
+
+    parents.push_back(parent);
+    levels.push_back(parent == NoParent ? 0 : levels[parent] + 1);
+    locals.push_back(local);
+    worlds.push_back(local);
+    // No box until SetBounds
+    localBounds.insert(localBounds.end(), { 0.0f, 0.0f, 0.0f, 0.0f, -1.0f, -1.0f, -1.0f, 0.0f });
+
+    auto padded = PaddedCount(node + 1);
+    for (auto array : { &centerX, &centerY, &centerZ })
+        array->resize(padded, 0.0f);
+    for (auto array : { &extentX, &extentY, &extentZ })
+        array->resize(padded, -FLT_MAX);
+
+    levelsDirty = true;
+    return node;
+}
+
+void Scene::SetLocal(uint32_t node, const SceneMatrix &local)
+{
+    locals[node] = local;
+}
+
+void Scene::SetBounds(uint32_t node, const float min[3], const float max[3])
+{
+    auto bounds = &localBounds[node * 8];
+    for (int i = 0; i < 3; ++i)
+    {
+        bounds[i] = (min[i] + max[i]) * 0.5f;
+        bounds[4 + i] = (max[i] - min[i]) * 0.5f;
+    }
+}
+
+void Scene::SetViewProjection(const SceneMatrix &viewProj)
+{
+    ExtractFrustumPlanes(viewProj.m, planes);
+}
+
+uint32_t Scene::GetCount() const
+{
+    return (uint32_t)parents.size();
+}
+
+uint32_t Scene::GetParent(uint32_t node) const
+{
+    return parents[node];
+}
+
+const SceneMatrix &Scene::GetWorld(uint32_t node) const
+{
+    return worlds[node];
+}
+
+void Scene::Update(JobSystem &jobs)
+{
+    if (levelsDirty)
+        BuildLevels();
+
+    // A level only reads the one above it, so its nodes can go in any order
+    for (size_t level = 0; level + 1 < levelStarts.size(); ++level)
+    {
+        auto first = levelStarts[level];
+        auto count = levelStarts[level + 1] - first;
+        auto chunkCount = ChunkCount(jobs, count, MinUpdateChunk);
+        if (chunkCount == 1)
+        {
+            UpdateRange(&levelOrder[first], count);
+            continue;
+        }
+
+        jobs.ParallelFor(chunkCount, [&](uint32_t chunk, uint32_t)
+        {
+            auto begin = (uint32_t)((uint64_t)count * chunk / chunkCount);
+            auto end = (uint32_t)((uint64_t)count * (chunk + 1) / chunkCount);
+            UpdateRange(&levelOrder[first + begin], end - begin);
+        });
+    }
+}
+
+void Scene::Cull(JobSystem &jobs)
+{
+    visible.clear();
+
+    auto blockCount = PaddedCount(GetCount()) / BlockSize;
+    auto chunkCount = ChunkCount(jobs, blockCount, MinCullBlocks);
+    if (chunkCount == 1)
+    {
+        CullRange(0, blockCount, visible);
+        return;
+    }
+
+    // Each chunk keeps its own list so they can be joined in node order
+    chunkVisible.resize(chunkCount);
+    jobs.ParallelFor(chunkCount, [&](uint32_t chunk, uint32_t)
+    {
+        auto begin = (uint32_t)((uint64_t)blockCount * chunk / chunkCount);
+        auto end = (uint32_t)((uint64_t)blockCount * (chunk + 1) / chunkCount);
+        chunkVisible[chunk].clear();
+        CullRange(begin, end - begin, chunkVisible[chunk]);
+    });
+
+    for (auto &list : chunkVisible)
+        visible.insert(visible.end(), list.begin(), list.end());
+}
+
+const std::vector<uint32_t> &Scene::GetVisible() const
+{
+    return visible;
+}
+
+void Scene::BuildLevels()
+{
+    // Counting sort by level keeps the nodes of a level in the order they were added
+    uint32_t levelCount = 0;
+    for (auto level : levels)
+        levelCount = std::max(levelCount, level + 1);
+
+    levelStarts.assign(levelCount + 1, 0);
+    for (auto level : levels)
+        ++levelStarts[level + 1];
+    for (uint32_t level = 0; level < levelCount; ++level)
+        levelStarts[level + 1] += levelStarts[level];
+
+    auto next = levelStarts;
+    levelOrder.resize(levels.size());
+    for (uint32_t node = 0; node < GetCount(); ++node)
+        levelOrder[next[levels[node]]++] = node;
+
+    levelsDirty = false;
+}
+
+void Scene::UpdateRange(const uint32_t *nodes, uint32_t count)
+{
+    auto absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    alignas(16) float center[4];
+    alignas(16) float extent[4];
+
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        auto node = nodes[i];
+        auto &world = worlds[node];
+        if (parents[node] == NoParent)
+            world = locals[node];
+        else
+            Multiply(worlds[parents[node]].m, locals[node].m, world.m);
+
+        auto bounds = &localBounds[node * 8];
+        if (bounds[4] < 0.0f)
+        {
+            extentX[node] = extentY[node] = extentZ[node] = -FLT_MAX;
+            continue;
+        }
+
+        // Arvo's method, the corners' spread along each axis is the absolute
+        // matrix times the extent
+        auto c0 = _mm_loadu_ps(world.m + 0);
+        auto c1 = _mm_loadu_ps(world.m + 4);
+        auto c2 = _mm_loadu_ps(world.m + 8);
+        auto c3 = _mm_loadu_ps(world.m + 12);
+        auto c = _mm_add_ps(c3, _mm_mul_ps(c0, _mm_set1_ps(bounds[0])));
+        c = _mm_add_ps(c, _mm_mul_ps(c1, _mm_set1_ps(bounds[1])));
+        c = _mm_add_ps(c, _mm_mul_ps(c2, _mm_set1_ps(bounds[2])));
+        auto e = _mm_mul_ps(_mm_and_ps(c0, absMask), _mm_set1_ps(bounds[4]));
+        e = _mm_add_ps(e, _mm_mul_ps(_mm_and_ps(c1, absMask), _mm_set1_ps(bounds[5])));
+        e = _mm_add_ps(e, _mm_mul_ps(_mm_and_ps(c2, absMask), _mm_set1_ps(bounds[6])));
+        _mm_store_ps(center, c);
+        _mm_store_ps(extent, e);
+
+        centerX[node] = center[0];
+        centerY[node] = center[1];
+        centerZ[node] = center[2];
+        extentX[node] = extent[0];
+        extentY[node] = extent[1];
+        extentZ[node] = extent[2];
+    }
+}
+
+void Scene::CullRange(uint32_t firstBlock, uint32_t blockCount, std::vector<uint32_t> &visible) const
+{
+    // A box is outside once its center is further behind a plane than its
+    // extent reaches along the plane's normal. Nodes without a box and the
+    // padding have a negative extent and are out from the start.
+    for (auto block = firstBlock; block < firstBlock + blockCount; ++block)
+    {
+        auto base = block * BlockSize;
+        uint32_t mask;
+#ifdef __AVX__
+        auto cx = _mm256_loadu_ps(&centerX[base]);
+        auto cy = _mm256_loadu_ps(&centerY[base]);
+        auto cz = _mm256_loadu_ps(&centerZ[base]);
+        auto ex = _mm256_loadu_ps(&extentX[base]);
+        auto ey = _mm256_loadu_ps(&extentY[base]);
+        auto ez = _mm256_loadu_ps(&extentZ[base]);
+        auto outside = _mm256_cmp_ps(ex, _mm256_setzero_ps(), _CMP_LT_OQ);
+        for (auto &plane : planes)
+        {
+            auto d = _mm256_add_ps(_mm256_set1_ps(plane[3]), _mm256_mul_ps(cx, _mm256_set1_ps(plane[0])));
+            d = _mm256_add_ps(d, _mm256_mul_ps(cy, _mm256_set1_ps(plane[1])));
+            d = _mm256_add_ps(d, _mm256_mul_ps(cz, _mm256_set1_ps(plane[2])));
+            d = _mm256_add_ps(d, _mm256_mul_ps(ex, _mm256_set1_ps(std::fabs(plane[0]))));
+            d = _mm256_add_ps(d, _mm256_mul_ps(ey, _mm256_set1_ps(std::fabs(plane[1]))));
+            d = _mm256_add_ps(d, _mm256_mul_ps(ez, _mm256_set1_ps(std::fabs(plane[2]))));
+            outside = _mm256_or_ps(outside, _mm256_cmp_ps(d, _mm256_setzero_ps(), _CMP_LT_OQ));
+        }
+        mask = ~(uint32_t)_mm256_movemask_ps(outside) & 0xff;
+#else
+        mask = 0;
+        for (uint32_t half = 0; half < BlockSize; half += 4)
+        {
+            auto cx = _mm_loadu_ps(&centerX[base + half]);
+            auto cy = _mm_loadu_ps(&centerY[base + half]);
+            auto cz = _mm_loadu_ps(&centerZ[base + half]);
+            auto ex = _mm_loadu_ps(&extentX[base + half]);
+            auto ey = _mm_loadu_ps(&extentY[base + half]);
+            auto ez = _mm_loadu_ps(&extentZ[base + half]);
+            auto outside = _mm_cmplt_ps(ex, _mm_setzero_ps());
+            for (auto &plane : planes)
+            {
+                auto d = _mm_add_ps(_mm_set1_ps(plane[3]), _mm_mul_ps(cx, _mm_set1_ps(plane[0])));
+                d = _mm_add_ps(d, _mm_mul_ps(cy, _mm_set1_ps(plane[1])));
+                d = _mm_add_ps(d, _mm_mul_ps(cz, _mm_set1_ps(plane[2])));
+                d = _mm_add_ps(d, _mm_mul_ps(ex, _mm_set1_ps(std::fabs(plane[0]))));
+                d = _mm_add_ps(d, _mm_mul_ps(ey, _mm_set1_ps(std::fabs(plane[1]))));
+                d = _mm_add_ps(d, _mm_mul_ps(ez, _mm_set1_ps(std::fabs(plane[2]))));
+                outside = _mm_or_ps(outside, _mm_cmplt_ps(d, _mm_setzero_ps()));
+            }
+            mask |= (~(uint32_t)_mm_movemask_ps(outside) & 0xf) << half;
+        }
+#endif
+
+        for (uint32_t lane = 0; lane < BlockSize; ++lane)
+        {
+            if (mask & (1u << lane))
+                visible.push_back(base + lane);
+        }
+    }
+}
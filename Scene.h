@@ -0,0 +1,77 @@
+#pragma once
+
+#include "JobSystem.h"
+#include <cstdint>
+#include <vector>
+
+// Column major, the same layout the shaders use
+struct SceneMatrix
+{
+    float m[16];
+};
+
+// Transform hierarchy and CPU frustum culling.
+//
+// Nodes live in flat arrays in the order they were added, and since a parent
+// has to be added before its children, every node's parent is updated first.
+// World matrices are updated one hierarchy level at a time with each level
+// split across the job system, then the world space boxes are culled against
+// the frustum 4 boxes at a time with SSE, or 8 with AVX.
+class Scene
+{
+public:
+    static const uint32_t NoParent = UINT32_MAX;
+
+    Scene();
+
+    void Reserve(uint32_t capacity);
+    void Clear();
+
+    // The parent has to be NoParent or an earlier node, returns the new node
+    uint32_t Add(uint32_t parent, const SceneMatrix &local);
+    void SetLocal(uint32_t node, const SceneMatrix &local);
+    // Box in the node's own space, nodes without one are never visible
+    void SetBounds(uint32_t node, const float min[3], const float max[3]);
+    // Clip space depth from 0 to 1
+    void SetViewProjection(const SceneMatrix &viewProj);
+
+    uint32_t GetCount() const;
+    uint32_t GetParent(uint32_t node) const;
+    // Valid after Update
+    const SceneMatrix &GetWorld(uint32_t node) const;
+
+    // Compute every world matrix and world space box from the local ones
+    void Update(JobSystem &jobs);
+    // Find the nodes whose box touches the frustum, after Update
+    void Cull(JobSystem &jobs);
+    // Visible nodes in ascending order
+    const std::vector<uint32_t> &GetVisible() const;
+
+private:
+    void BuildLevels();
+    void UpdateRange(const uint32_t *nodes, uint32_t count);
+    void CullRange(uint32_t firstBlock, uint32_t blockCount, std::vector<uint32_t> &visible) const;
+
+    std::vector<uint32_t> parents;
+    std::vector<uint32_t> levels;
+    std::vector<SceneMatrix> locals;
+    std::vector<SceneMatrix> worlds;
+    // Local boxes as center and half size, w unused
+    std::vector<float> localBounds;
+
+    // World boxes, one array per component padded to a whole SIMD block.
+    // A negative extent is never visible.
+    std::vector<float> centerX, centerY, centerZ;
+    std::vector<float> extentX, extentY, extentZ;
+
+    // Nodes sorted by level, with where each level starts
+    std::vector<uint32_t> levelOrder;
+    std::vector<uint32_t> levelStarts;
+    bool levelsDirty;
+
+    // Normalized, pointing inwards
+    float planes[6][4];
+
+    std::vector<std::vector<uint32_t>> chunkVisible;
+    std::vector<uint32_t> visible;
+};
@@ -0,0 +1,111 @@
+#include "ShaderLibrary.h"
+#include "Hash.h"
+#include <stdexcept>
+
+static const uint32_t LibraryMagic = 0x42494c53; // "SLIB"
+static const uint32_t LibraryVersion = 1;
+
+ShaderLibrary::ShaderLibrary()
+{
+}
+
+ShaderLibrary::~ShaderLibrary()
+{
+    Destroy();
+}
+
+bool ShaderLibrary::Open(vk::Device device, const std::string &path)
+{
+    Destroy();
+    this->device = device;
+    return index.Open(path, "Shader library", LibraryMagic, LibraryVersion, 4, &ShaderLibrary::IsValid);
+}
+
+void ShaderLibrary::Destroy()
+{
+    std::lock_guard<std::mutex> lock{ mutex };
+    for (auto &module : modules)
+        device.destroyShaderModule(module.second);
+    modules.clear();
+
+    index.Close();
+}
+
+bool ShaderLibrary::Contains(const std::string &name) const
+{
+    return index.Find(name) != nullptr;
+}
+
+vk::ShaderModule ShaderLibrary::GetModule(const std::string &name)
+{
+    auto entry = index.Find(name);
+    if (!entry)
+        throw std::runtime_error{ "Shader " + name + " isn't in the library" };
+
+    std::lock_guard<std::mutex> lock{ mutex };
+    auto found = modules.find(entry->codeHash);
+    if (found != modules.end())
+        return found->second;
+
+    // No copy, the driver reads the code straight out of the mapping
+    auto moduleInfo = vk::ShaderModuleCreateInfo()
+        .setCodeSize((size_t)entry->size)
+        .setPCode((const uint32_t *)index.GetData(*entry));
+
+    auto module = device.createShaderModule(moduleInfo);
+    modules[entry->codeHash] = module;
+    return module;
+}
+
+uint32_t ShaderLibrary::GetShaderCount() const
+{
+    return index.GetCount();
+}
+
+uint32_t ShaderLibrary::GetModuleCount()
+{
+    std::lock_guard<std::mutex> lock{ mutex };
+    return (uint32_t)modules.size();
+}
+
+bool ShaderLibrary::Pack(const std::string &path, const std::vector<ShaderSource> &shaders)
+{
+    std::vector<ShaderLibraryEntry> entries;
+    for (auto &shader : shaders)
+    {
+        if (shader.code.empty() || shader.code.size() % 4 != 0)
+            throw std::runtime_error{ "Shader " + shader.name + " isn't SPIR-V" };
+
+        ShaderLibraryEntry entry;
+        entry.nameHash = HashBytes(shader.name.data(), shader.name.size());
+        entry.codeHash = HashBytes(shader.code.data(), shader.code.size());
+        entry.offset = 0;
+        entry.size = shader.code.size();
+        entries.push_back(entry);
+    }
+
+    // Blobs go in the original order, the index is sorted for binary search
+    std::vector<uint8_t> data((size_t)IndexedFile<ShaderLibraryEntry>::GetIndexEnd(entries.size()));
+    std::unordered_map<uint64_t, uint64_t> blobOffsets;
+    for (size_t i = 0; i < shaders.size(); ++i)
+    {
+        // Identical code is only stored once
+        auto found = blobOffsets.find(entries[i].codeHash);
+        if (found != blobOffsets.end())
+        {
+            entries[i].offset = found->second;
+            continue;
+        }
+
+        entries[i].offset = data.size();
+        blobOffsets[entries[i].codeHash] = entries[i].offset;
+        data.insert(data.end(), shaders[i].code.begin(), shaders[i].code.end());
+    }
+
+    return IndexedFile<ShaderLibraryEntry>::Write(path, "Shader library", LibraryMagic, LibraryVersion, std::move(entries), data);
+}
+
+bool ShaderLibrary::IsValid(const ShaderLibraryEntry &entry)
+{
+    return entry.size != 0 && entry.size % 4 == 0;
+}
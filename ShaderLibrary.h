@@ -0,0 +1,60 @@
+#pragma once
+
+#include "IndexedFile.h"
+#include <vulkan/vk_cpp.h>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// On disk a library is an IndexedFile of these pointing at SPIR-V blobs.
+// Blobs are 4 byte aligned so they can be passed to createShaderModule
+// straight from the mapping.
+struct ShaderLibraryEntry
+{
+    uint64_t nameHash;
+    // Hash of the SPIR-V, identical variants share a module
+    uint64_t codeHash;
+    // From the start of the file
+    uint64_t offset;
+    uint64_t size;
+};
+
+struct ShaderSource
+{
+    std::string name;
+    std::vector<uint8_t> code;
+};
+
+// A memory mapped shader library. Modules are created on first use and cached
+// by the hash of their code. Safe to use from several threads.
+class ShaderLibrary
+{
+public:
+    ShaderLibrary();
+    ~ShaderLibrary();
+
+    // Returns false if the file is missing or malformed
+    bool Open(vk::Device device, const std::string &path);
+    // Destroys every module handed out
+    void Destroy();
+
+    bool Contains(const std::string &name) const;
+    // Throws if the library has no shader by that name
+    vk::ShaderModule GetModule(const std::string &name);
+    uint32_t GetShaderCount() const;
+    uint32_t GetModuleCount();
+
+    // Build a library file out of loose SPIR-V, e.g. from a build step
+    static bool Pack(const std::string &path, const std::vector<ShaderSource> &shaders);
+
+private:
+    static bool IsValid(const ShaderLibraryEntry &entry);
+
+    vk::Device device;
+    IndexedFile<ShaderLibraryEntry> index;
+
+    std::mutex mutex;
+    std::unordered_map<uint64_t, vk::ShaderModule> modules;
+};
@@ -0,0 +1,60 @@
+#include "ShaderLibrary.h"
+#include "FileUtil.h"
+#include <exception>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Packs loose SPIR-V into a shader library, run as the last step of building
+// vulkan-shaders. Usage: vulkan-shaders <library> <shader.spv>...
+//
+// Each shader is named after its file without the directory and the .spv
+// extension, so cull.comp.spv is looked up as cull.comp.
+
+static std::string GetShaderName(const std::string &path)
+{
+    auto name = path.substr(path.find_last_of("/\\") + 1);
+    auto extension = name.rfind(".spv");
+    if (extension != std::string::npos && extension == name.size() - 4)
+        name.resize(extension);
+    return name;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        std::cerr << "Usage: vulkan-shaders <library> <shader.spv>..." << std::endl;
+        return 1;
+    }
+
+    std::vector<ShaderSource> shaders;
+    for (int i = 2; i < argc; ++i)
+    {
+        ShaderSource shader;
+        shader.name = GetShaderName(argv[i]);
+        if (!ReadFileBytes(argv[i], shader.code))
+        {
+            std::cerr << "Can't read " << argv[i] << std::endl;
+            return 1;
+        }
+        shaders.push_back(std::move(shader));
+    }
+
+    try
+    {
+        if (!ShaderLibrary::Pack(argv[1], shaders))
+        {
+            std::cerr << "Can't write " << argv[1] << std::endl;
+            return 1;
+        }
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    std::cout << "Packed " << shaders.size() << " shaders into " << argv[1] << std::endl;
+    return 0;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+// Bounded lock-free ring for exactly one producer thread and one consumer
+// thread. Neither side ever blocks, TryPush fails when the ring is full.
+template <typename T>
+class SpscQueue
+{
+    static_assert(std::is_trivially_copyable<T>::value, "SpscQueue only holds plain data");
+
+public:
+    // Rounded up to a power of two
+    explicit SpscQueue(uint32_t capacity = 1024)
+        : head(0), cachedTail(0), tail(0), cachedHead(0)
+    {
+        uint32_t size = 1;
+        while (size < capacity)
+            size <<= 1;
+        items.resize(size);
+        mask = size - 1;
+    }
+
+    // Producer only
+    bool TryPush(const T &item)
+    {
+        auto index = tail.load(std::memory_order_relaxed);
+        // Only look at the consumer's index when the last copy of it says we're full
+        if (index - cachedHead > mask)
+        {
+            cachedHead = head.load(std::memory_order_acquire);
+            if (index - cachedHead > mask)
+                return false;
+        }
+
+        items[index & mask] = item;
+        tail.store(index + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer only
+    bool TryPop(T &item)
+    {
+        auto index = head.load(std::memory_order_relaxed);
+        if (index == cachedTail)
+        {
+            cachedTail = tail.load(std::memory_order_acquire);
+            if (index == cachedTail)
+                return false;
+        }
+
+        item = items[index & mask];
+        head.store(index + 1, std::memory_order_release);
+        return true;
+    }
+
+    uint32_t GetCapacity() const
+    {
+        return mask + 1;
+    }
+
+private:
+    std::vector<T> items;
+    uint32_t mask;
+
+    // Each side writes one index and keeps a copy of the other's, on separate
+    // cache lines so the two threads don't keep stealing the line from each other
+    alignas(64) std::atomic<uint32_t> head;
+    uint32_t cachedTail;
+    alignas(64) std::atomic<uint32_t> tail;
+    uint32_t cachedHead;
+};
@@ -0,0 +1,55 @@
+#include "StageTimer.h"
+#include <algorithm>
+#include <sstream>
+
+StageTimer::StageTimer()
+    : origin(Clock::now())
+{
+}
+
+void StageTimer::Record(const char *name, Clock::time_point start, Clock::time_point end)
+{
+    typedef std::chrono::duration<double, std::milli> Ms;
+
+    StageTiming timing;
+    timing.name = name;
+    timing.startMs = Ms(start - origin).count();
+    timing.durationMs = Ms(end - start).count();
+
+    std::lock_guard<std::mutex> lock{ mutex };
+    timings.push_back(timing);
+}
+
+std::vector<StageTiming> StageTimer::GetTimings() const
+{
+    std::lock_guard<std::mutex> lock{ mutex };
+    return timings;
+}
+
+double StageTimer::GetTotalMs() const
+{
+    std::lock_guard<std::mutex> lock{ mutex };
+
+    double total = 0.0;
+    for (auto &timing : timings)
+        total = std::max(total, timing.startMs + timing.durationMs);
+    return total;
+}
+
+std::string StageTimer::ToJson() const
+{
+    auto stages = GetTimings();
+
+    std::ostringstream json;
+    json << "{\"total_ms\":" << GetTotalMs() << ",\"stages\":[";
+    for (size_t i = 0; i < stages.size(); ++i)
+    {
+        if (i > 0)
+            json << ",";
+        json << "{\"name\":\"" << stages[i].name << "\""
+            << ",\"start_ms\":" << stages[i].startMs
+            << ",\"duration_ms\":" << stages[i].durationMs << "}";
+    }
+    json << "]}";
+    return json.str();
+}
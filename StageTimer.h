@@ -0,0 +1,44 @@
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct StageTiming
+{
+    std::string name;
+    // Relative to when the timer was created
+    double startMs;
+    double durationMs;
+};
+
+// Wall clock timing of named stages, safe to record from several threads
+class StageTimer
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    StageTimer();
+
+    template <typename Fn>
+    void Time(const char *name, Fn &&fn)
+    {
+        auto start = Clock::now();
+        fn();
+        Record(name, start, Clock::now());
+    }
+
+    void Record(const char *name, Clock::time_point start, Clock::time_point end);
+
+    std::vector<StageTiming> GetTimings() const;
+    // From creation to the end of the last stage
+    double GetTotalMs() const;
+    // {"total_ms":...,"stages":[{"name":...,"start_ms":...,"duration_ms":...},...]}
+    std::string ToJson() const;
+
+private:
+    Clock::time_point origin;
+    mutable std::mutex mutex;
+    std::vector<StageTiming> timings;
+};
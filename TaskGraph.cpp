@@ -0,0 +1,183 @@
+#include "TaskGraph.h"
+#include "Log.h"
+#include <stdexcept>
+#include <thread>
+
+TaskGraph::TaskGraph()
+    : jobs(nullptr), timer(nullptr), criticalRemaining(0), failed(false)
+{
+}
+
+TaskGraph::~TaskGraph()
+{
+    WaitAll();
+}
+
+TaskId TaskGraph::Add(const char *name, Task task, std::initializer_list<TaskId> dependencies, TaskKind kind)
+{
+    if (jobs)
+        throw std::runtime_error{ "Tasks can't be added to a graph that is running" };
+
+    auto id = (TaskId)nodes.size();
+    auto node = std::make_unique<Node>();
+    node->name = name;
+    node->task = std::move(task);
+    node->kind = kind;
+    node->dependencyCount = 0;
+    node->remaining = 0;
+    node->done = false;
+
+    for (auto dependency : dependencies)
+    {
+        if (dependency >= id)
+            throw std::runtime_error{ "Task dependencies have to be added first" };
+        nodes[dependency]->dependents.push_back(id);
+        node->dependencyCount++;
+    }
+
+    nodes.push_back(std::move(node));
+    return id;
+}
+
+void TaskGraph::Run(JobSystem &jobs, StageTimer *timer)
+{
+    if (this->jobs)
+        throw std::runtime_error{ "Task graph has already been run" };
+    this->jobs = &jobs;
+    this->timer = timer;
+
+    // Set up every count before anything runs, tasks finishing early update them
+    uint32_t critical = 0;
+    for (auto &node : nodes)
+    {
+        node->remaining = node->dependencyCount;
+        if (node->kind != TaskKind::Background)
+            ++critical;
+    }
+    criticalRemaining = critical;
+
+    for (TaskId id = 0; id < nodes.size(); ++id)
+    {
+        if (nodes[id]->dependencyCount == 0)
+            Schedule(id);
+    }
+
+    // The calling thread runs main thread tasks and otherwise helps with the rest
+    while (criticalRemaining > 0 && !failed)
+    {
+        if (!Help())
+            std::this_thread::yield();
+    }
+
+    if (failed)
+    {
+        WaitAll();
+        std::lock_guard<std::mutex> lock{ errorMutex };
+        std::rethrow_exception(error);
+    }
+}
+
+bool TaskGraph::IsComplete(TaskId task) const
+{
+    return nodes[task]->done.load(std::memory_order_acquire);
+}
+
+void TaskGraph::Wait(TaskId task)
+{
+    if (!jobs)
+        throw std::runtime_error{ "Task graph hasn't been run" };
+
+    while (!IsComplete(task))
+    {
+        if (failed && running.IsDone())
+            throw std::runtime_error{ "Task " + nodes[task]->name + " didn't run because an earlier task failed" };
+        if (!Help())
+            std::this_thread::yield();
+    }
+}
+
+void TaskGraph::WaitAll()
+{
+    if (!jobs)
+        return;
+
+    // A job queues its dependents before it counts as done, so an idle counter
+    // with nothing left for the main thread means the graph has stopped
+    while (true)
+    {
+        if (running.IsDone())
+        {
+            std::lock_guard<std::mutex> lock{ mainMutex };
+            if (mainReady.empty())
+                return;
+        }
+        if (!Help())
+            std::this_thread::yield();
+    }
+}
+
+void TaskGraph::Schedule(TaskId task)
+{
+    if (nodes[task]->kind == TaskKind::MainThread)
+    {
+        std::lock_guard<std::mutex> lock{ mainMutex };
+        mainReady.push_back(task);
+        return;
+    }
+
+    jobs->Submit([this, task]() { Execute(task); }, &running);
+}
+
+void TaskGraph::Execute(TaskId task)
+{
+    auto &node = *nodes[task];
+    if (failed)
+        return;
+
+    try
+    {
+        if (timer)
+            timer->Time(node.name.c_str(), node.task);
+        else
+            node.task();
+    }
+    catch (...)
+    {
+        Log("Task " + node.name + " failed");
+        std::lock_guard<std::mutex> lock{ errorMutex };
+        if (!error)
+            error = std::current_exception();
+        failed = true;
+        return;
+    }
+
+    node.done.store(true, std::memory_order_release);
+    if (node.kind != TaskKind::Background)
+        criticalRemaining--;
+
+    for (auto dependent : node.dependents)
+    {
+        if (nodes[dependent]->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            Schedule(dependent);
+    }
+}
+
+bool TaskGraph::RunMainThreadTask()
+{
+    TaskId task;
+    {
+        std::lock_guard<std::mutex> lock{ mainMutex };
+        if (mainReady.empty())
+            return false;
+        task = mainReady.back();
+        mainReady.pop_back();
+    }
+
+    Execute(task);
+    return true;
+}
+
+bool TaskGraph::Help()
+{
+    return RunMainThreadTask() || jobs->RunPending();
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "JobSystem.h"
+#include "StageTimer.h"
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+typedef uint32_t TaskId;
+
+enum class TaskKind
+{
+    // Run has to wait for it
+    Critical,
+    // Keeps running after Run returns, wait on it before using what it makes
+    Background,
+    // Critical and always run by the thread that calls Run, e.g. creating windows
+    MainThread,
+};
+
+// A set of tasks with explicit dependencies run on a JobSystem. Each task
+// starts as soon as everything it depends on is done, so independent tasks
+// overlap. Run returns once the critical tasks are done and leaves background
+// ones running.
+class TaskGraph
+{
+public:
+    typedef std::function<void()> Task;
+
+    TaskGraph();
+    // Waits for any tasks that are still running
+    ~TaskGraph();
+
+    // Dependencies have to be added first. Main thread tasks may only depend on
+    // critical tasks, nothing runs them once Run has returned.
+    TaskId Add(const char *name, Task task, std::initializer_list<TaskId> dependencies = {}, TaskKind kind = TaskKind::Critical);
+
+    // Start everything and return when the critical tasks are done. Tasks are
+    // timed into the timer if there is one. If a task throws, nothing that
+    // depends on it runs and the first error is rethrown once the running tasks
+    // have stopped.
+    void Run(JobSystem &jobs, StageTimer *timer = nullptr);
+
+    bool IsComplete(TaskId task) const;
+    // Help run jobs until the task is done, throws if it failed or never will
+    void Wait(TaskId task);
+    // Help run jobs until nothing is running, errors are only logged
+    void WaitAll();
+
+private:
+    struct Node
+    {
+        std::string name;
+        Task task;
+        TaskKind kind;
+        std::vector<TaskId> dependents;
+        uint32_t dependencyCount;
+        std::atomic<uint32_t> remaining;
+        std::atomic<bool> done;
+    };
+
+    void Schedule(TaskId task);
+    void Execute(TaskId task);
+    bool RunMainThreadTask();
+    // One step of helping out, returns false if there was nothing to do
+    bool Help();
+
+    std::vector<std::unique_ptr<Node>> nodes;
+    JobSystem *jobs;
+    StageTimer *timer;
+    JobCounter running;
+    std::atomic<uint32_t> criticalRemaining;
+    std::atomic<bool> failed;
+
+    std::mutex mainMutex;
+    std::vector<TaskId> mainReady;
+
+    std::mutex errorMutex;
+    std::exception_ptr error;
+};
@@ -0,0 +1,464 @@
+#include "UploadContext.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+UploadContext::UploadContext()
+    : queueFamily(0), ownerFamily(VK_QUEUE_FAMILY_IGNORED), allocator(nullptr), stagingChunkSize(0),
+    nextTicket(1), completedTicket(0)
+{
+}
+
+UploadContext::~UploadContext()
+{
+    Destroy();
+}
+
+void UploadContext::Init(
+    vk::Device device,
+    vk::Queue queue,
+    uint32_t queueFamily,
+    MemoryAllocator *allocator,
+    uint32_t ownerFamily,
+    vk::DeviceSize stagingChunkSize)
+{
+    this->device = device;
+    this->queue = queue;
+    this->queueFamily = queueFamily;
+    this->ownerFamily = ownerFamily;
+    this->allocator = allocator;
+    this->stagingChunkSize = stagingChunkSize;
+
+    auto poolInfo = vk::CommandPoolCreateInfo()
+        .setQueueFamilyIndex(queueFamily)
+        .setFlags(vk::CommandPoolCreateFlagBits::eTransient | vk::CommandPoolCreateFlagBits::eResetCommandBuffer);
+    commandPool = device.createCommandPool(poolInfo);
+}
+
+void UploadContext::Destroy()
+{
+    if (!device || !commandPool)
+        return;
+
+    // Anything still recording is submitted so its work isn't silently lost
+    Wait(Flush());
+
+    for (auto &batch : freeBatches)
+    {
+        for (auto &chunk : batch->chunks)
+        {
+            device.destroyBuffer(chunk.buffer);
+            allocator->Free(chunk.mem);
+        }
+        device.destroyFence(batch->fence);
+    }
+    freeBatches.clear();
+
+    // Acquires nobody took are dropped along with their semaphores
+    for (auto &acquire : readyAcquires)
+        freeSemaphores.insert(freeSemaphores.end(), acquire.semaphores.begin(), acquire.semaphores.end());
+    readyAcquires.clear();
+    for (auto semaphore : freeSemaphores)
+        device.destroySemaphore(semaphore);
+    freeSemaphores.clear();
+
+    // Command buffers go away with their pool
+    device.destroyCommandPool(commandPool);
+    commandPool = nullptr;
+}
+
+vk::CommandBuffer UploadContext::GetCommandBuffer()
+{
+    return BeginBatch()->cmdBuffer;
+}
+
+UploadTicket UploadContext::GetPendingTicket()
+{
+    return BeginBatch()->ticket;
+}
+
+StagingSpan UploadContext::Stage(vk::DeviceSize size, vk::DeviceSize alignment)
+{
+    auto batch = BeginBatch();
+
+    // Bump allocate out of the newest chunk
+    if (!batch->chunks.empty())
+    {
+        auto &chunk = batch->chunks.back();
+        auto offset = (chunk.head + alignment - 1) / alignment * alignment;
+        if (offset + size <= chunk.size)
+        {
+            chunk.head = offset + size;
+            return StagingSpan{ chunk.buffer, offset, chunk.mem.mapped + offset };
+        }
+    }
+
+    // Uploads bigger than a chunk get a chunk of their own
+    batch->chunks.push_back(CreateChunk(std::max(size, stagingChunkSize)));
+    auto &chunk = batch->chunks.back();
+    chunk.head = size;
+    return StagingSpan{ chunk.buffer, 0, chunk.mem.mapped };
+}
+
+void UploadContext::UploadBuffer(
+    vk::Buffer dst,
+    vk::DeviceSize dstOffset,
+    const void *data,
+    vk::DeviceSize size,
+    vk::PipelineStageFlags dstStages,
+    vk::AccessFlags dstAccess)
+{
+    auto span = Stage(size);
+    memcpy(span.mapped, data, (size_t)size);
+    CopyBuffer(span.buffer, span.offset, dst, dstOffset, size, dstStages, dstAccess);
+}
+
+void UploadContext::UploadImage(
+    vk::Image dst,
+    vk::ImageAspectFlags aspectMask,
+    vk::Extent3D extent,
+    const void *data,
+    vk::DeviceSize size,
+    const ImageState &finalState)
+{
+    auto span = Stage(size);
+    memcpy(span.mapped, data, (size_t)size);
+
+    auto region = vk::BufferImageCopy()
+        .setBufferOffset(span.offset)
+        .setImageSubresource(vk::ImageSubresourceLayers()
+            .setAspectMask(aspectMask)
+            .setLayerCount(1))
+        .setImageExtent(extent);
+    CopyImage(span.buffer, dst, aspectMask, 1, { region }, finalState);
+}
+
+void UploadContext::CopyBuffer(
+    vk::Buffer src,
+    vk::DeviceSize srcOffset,
+    vk::Buffer dst,
+    vk::DeviceSize dstOffset,
+    vk::DeviceSize size,
+    vk::PipelineStageFlags dstStages,
+    vk::AccessFlags dstAccess)
+{
+    auto region = vk::BufferCopy()
+        .setSrcOffset(srcOffset)
+        .setDstOffset(dstOffset)
+        .setSize(size);
+    GetCommandBuffer().copyBuffer(src, dst, region);
+
+    // Submission order alone doesn't make the copy visible to later reads
+    if (!NeedsOwnershipTransfer())
+    {
+        recording->visibleBuffers.push_back(vk::BufferMemoryBarrier()
+            .setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+            .setDstAccessMask(dstAccess)
+            .setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+            .setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+            .setBuffer(dst)
+            .setOffset(dstOffset)
+            .setSize(size));
+        recording->visibleStages |= dstStages;
+        return;
+    }
+
+    // Release here, the owning queue acquires with a matching barrier
+    auto barrier = vk::BufferMemoryBarrier()
+        .setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+        .setSrcQueueFamilyIndex(queueFamily)
+        .setDstQueueFamilyIndex(ownerFamily)
+        .setBuffer(dst)
+        .setOffset(dstOffset)
+        .setSize(size);
+    recording->releaseBuffers.push_back(barrier);
+
+    barrier
+        .setSrcAccessMask(vk::AccessFlags())
+        .setDstAccessMask(dstAccess);
+    recording->acquire.bufferBarriers.push_back(barrier);
+    recording->acquire.dstStages |= dstStages;
+}
+
+void UploadContext::CopyImage(
+    vk::Buffer src,
+    vk::Image dst,
+    vk::ImageAspectFlags aspectMask,
+    uint32_t levelCount,
+    const std::vector<vk::BufferImageCopy> &regions,
+    const ImageState &finalState)
+{
+    auto commandBuffer = GetCommandBuffer();
+    auto range = vk::ImageSubresourceRange()
+        .setAspectMask(aspectMask)
+        .setLevelCount(levelCount)
+        .setLayerCount(1);
+
+    // The old contents are overwritten, so there's nothing to wait for
+    auto barrier = vk::ImageMemoryBarrier()
+        .setOldLayout(vk::ImageLayout::eUndefined)
+        .setNewLayout(vk::ImageLayout::eTransferDstOptimal)
+        .setDstAccessMask(vk::AccessFlagBits::eTransferWrite)
+        .setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+        .setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+        .setImage(dst)
+        .setSubresourceRange(range);
+    commandBuffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eTopOfPipe,
+        vk::PipelineStageFlagBits::eTransfer,
+        vk::DependencyFlags(),
+        nullptr,
+        nullptr,
+        barrier
+    );
+
+    commandBuffer.copyBufferToImage(src, dst, vk::ImageLayout::eTransferDstOptimal, regions);
+
+    // Move to the final layout, as part of the ownership transfer if there is one
+    barrier
+        .setOldLayout(vk::ImageLayout::eTransferDstOptimal)
+        .setNewLayout(finalState.layout)
+        .setSrcAccessMask(vk::AccessFlagBits::eTransferWrite);
+
+    if (!NeedsOwnershipTransfer())
+    {
+        barrier.setDstAccessMask(finalState.access);
+        commandBuffer.pipelineBarrier(
+            vk::PipelineStageFlagBits::eTransfer,
+            finalState.stages,
+            vk::DependencyFlags(),
+            nullptr,
+            nullptr,
+            barrier
+        );
+        return;
+    }
+
+    barrier
+        .setDstAccessMask(vk::AccessFlags())
+        .setSrcQueueFamilyIndex(queueFamily)
+        .setDstQueueFamilyIndex(ownerFamily);
+    recording->releaseImages.push_back(barrier);
+
+    barrier
+        .setSrcAccessMask(vk::AccessFlags())
+        .setDstAccessMask(finalState.access);
+    recording->acquire.imageBarriers.push_back(barrier);
+    recording->acquire.imageStates.push_back(finalState);
+    recording->acquire.dstStages |= finalState.stages;
+}
+
+UploadTicket UploadContext::Flush()
+{
+    if (!recording)
+        return nextTicket - 1;
+
+    auto batch = std::move(recording);
+
+    // Buffer copies are made visible in one barrier, it covers whatever is
+    // submitted to the queue after this batch
+    if (!batch->visibleBuffers.empty())
+    {
+        batch->cmdBuffer.pipelineBarrier(
+            vk::PipelineStageFlagBits::eTransfer,
+            batch->visibleStages,
+            vk::DependencyFlags(),
+            nullptr,
+            batch->visibleBuffers,
+            nullptr
+        );
+    }
+
+    // All ownership releases go out in one barrier at the end of the batch
+    if (!batch->releaseBuffers.empty() || !batch->releaseImages.empty())
+    {
+        batch->cmdBuffer.pipelineBarrier(
+            vk::PipelineStageFlagBits::eTransfer,
+            vk::PipelineStageFlagBits::eBottomOfPipe,
+            vk::DependencyFlags(),
+            nullptr,
+            batch->releaseBuffers,
+            batch->releaseImages
+        );
+    }
+    batch->cmdBuffer.end();
+
+    auto submitInfo = vk::SubmitInfo()
+        .setCommandBufferCount(1)
+        .setPCommandBuffers(&batch->cmdBuffer);
+
+    // The owning queue waits on a semaphore before acquiring
+    auto &acquire = batch->acquire;
+    bool crossQueue = !acquire.bufferBarriers.empty() || !acquire.imageBarriers.empty();
+    if (crossQueue)
+    {
+        vk::Semaphore semaphore;
+        if (!freeSemaphores.empty())
+        {
+            semaphore = freeSemaphores.back();
+            freeSemaphores.pop_back();
+        }
+        else
+        {
+            semaphore = device.createSemaphore(vk::SemaphoreCreateInfo());
+        }
+
+        acquire.semaphores.push_back(semaphore);
+        submitInfo
+            .setSignalSemaphoreCount(1)
+            .setPSignalSemaphores(&acquire.semaphores.back());
+    }
+
+    queue.submit(submitInfo, batch->fence);
+
+    if (crossQueue)
+    {
+        readyAcquires.push_back(std::move(acquire));
+        acquire = QueueAcquire();
+    }
+    batch->releaseBuffers.clear();
+    batch->releaseImages.clear();
+    batch->visibleBuffers.clear();
+    batch->visibleStages = vk::PipelineStageFlags();
+
+    auto ticket = batch->ticket;
+    inFlight.push_back(std::move(batch));
+    return ticket;
+}
+
+bool UploadContext::IsComplete(UploadTicket ticket)
+{
+    if (ticket <= completedTicket)
+        return true;
+
+    Retire();
+    return ticket <= completedTicket;
+}
+
+void UploadContext::Wait(UploadTicket ticket)
+{
+    if (ticket <= completedTicket)
+        return;
+
+    // Waiting on work that hasn't been submitted yet would never finish
+    if (recording && ticket >= recording->ticket)
+        Flush();
+
+    for (auto &batch : inFlight)
+    {
+        if (batch->ticket >= ticket)
+        {
+            device.waitForFences(batch->fence, true, UINT64_MAX);
+            break;
+        }
+    }
+
+    Retire();
+}
+
+void UploadContext::Retire()
+{
+    // A single queue completes batches in order, so stop at the first busy one
+    while (!inFlight.empty())
+    {
+        auto &batch = inFlight.front();
+        if (device.getFenceStatus(batch->fence) != vk::Result::eSuccess)
+            break;
+
+        completedTicket = batch->ticket;
+        RecycleBatch(std::move(batch));
+        inFlight.pop_front();
+    }
+}
+
+void UploadContext::TakeAcquires(QueueAcquire &acquire)
+{
+    for (auto &ready : readyAcquires)
+    {
+        acquire.semaphores.insert(acquire.semaphores.end(), ready.semaphores.begin(), ready.semaphores.end());
+        acquire.dstStages |= ready.dstStages;
+        acquire.bufferBarriers.insert(acquire.bufferBarriers.end(), ready.bufferBarriers.begin(), ready.bufferBarriers.end());
+        acquire.imageBarriers.insert(acquire.imageBarriers.end(), ready.imageBarriers.begin(), ready.imageBarriers.end());
+        acquire.imageStates.insert(acquire.imageStates.end(), ready.imageStates.begin(), ready.imageStates.end());
+    }
+    readyAcquires.clear();
+}
+
+void UploadContext::RecycleSemaphore(vk::Semaphore semaphore)
+{
+    freeSemaphores.push_back(semaphore);
+}
+
+UploadContext::Batch *UploadContext::BeginBatch()
+{
+    if (recording)
+        return recording.get();
+
+    Retire();
+
+    if (!freeBatches.empty())
+    {
+        recording = std::move(freeBatches.back());
+        freeBatches.pop_back();
+        device.resetFences(recording->fence);
+    }
+    else
+    {
+        recording = std::make_unique<Batch>();
+
+        auto allocateInfo = vk::CommandBufferAllocateInfo()
+            .setCommandPool(commandPool)
+            .setLevel(vk::CommandBufferLevel::ePrimary)
+            .setCommandBufferCount(1);
+        recording->cmdBuffer = device.allocateCommandBuffers(allocateInfo)[0];
+        recording->fence = device.createFence(vk::FenceCreateInfo());
+    }
+
+    recording->ticket = nextTicket++;
+    recording->cmdBuffer.begin(vk::CommandBufferBeginInfo()
+        .setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+    return recording.get();
+}
+
+UploadContext::StagingChunk UploadContext::CreateChunk(vk::DeviceSize size)
+{
+    auto bufferInfo = vk::BufferCreateInfo()
+        .setSize(size)
+        .setUsage(vk::BufferUsageFlagBits::eTransferSrc)
+        .setSharingMode(vk::SharingMode::eExclusive);
+
+    StagingChunk chunk;
+    chunk.buffer = device.createBuffer(bufferInfo);
+    chunk.mem = allocator->AllocateBuffer(
+        chunk.buffer,
+        vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent
+    );
+    chunk.size = size;
+    chunk.head = 0;
+    return chunk;
+}
+
+bool UploadContext::NeedsOwnershipTransfer() const
+{
+    return ownerFamily != VK_QUEUE_FAMILY_IGNORED && ownerFamily != queueFamily;
+}
+
+void UploadContext::RecycleBatch(std::unique_ptr<Batch> batch)
+{
+    // Hang on to one default sized chunk, oversized and overflow chunks are released
+    while (!batch->chunks.empty())
+    {
+        auto &chunk = batch->chunks.back();
+        if (batch->chunks.size() == 1 && chunk.size == stagingChunkSize)
+        {
+            chunk.head = 0;
+            break;
+        }
+
+        device.destroyBuffer(chunk.buffer);
+        allocator->Free(chunk.mem);
+        batch->chunks.pop_back();
+    }
+
+    freeBatches.push_back(std::move(batch));
+}
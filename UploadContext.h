@@ -0,0 +1,155 @@
+#pragma once
+
+#include "LayoutTracker.h"
+#include "MemoryAllocator.h"
+#include <vulkan/vk_cpp.h>
+#include <deque>
+#include <memory>
+#include <vector>
+
+// Identifies a batch of setup work, tickets increase in submission order
+typedef uint64_t UploadTicket;
+
+struct StagingSpan
+{
+    vk::Buffer buffer;
+    vk::DeviceSize offset;
+    uint8_t *mapped;
+};
+
+// Barriers the owning queue has to record to take over resources uploaded on
+// another queue family, and the semaphores it has to wait on first
+struct QueueAcquire
+{
+    std::vector<vk::Semaphore> semaphores;
+    vk::PipelineStageFlags dstStages;
+    std::vector<vk::BufferMemoryBarrier> bufferBarriers;
+    std::vector<vk::ImageMemoryBarrier> imageBarriers;
+    // State each image is in once acquired, parallel to imageBarriers
+    std::vector<ImageState> imageStates;
+};
+
+class UploadContext
+{
+public:
+    UploadContext();
+    ~UploadContext();
+
+    // Resources are used on ownerFamily afterwards. If that differs from
+    // queueFamily, ownership is released after the copies and the matching
+    // acquires are handed out through TakeAcquires.
+    void Init(
+        vk::Device device,
+        vk::Queue queue,
+        uint32_t queueFamily,
+        MemoryAllocator *allocator,
+        uint32_t ownerFamily = VK_QUEUE_FAMILY_IGNORED,
+        vk::DeviceSize stagingChunkSize = 16 * 1024 * 1024
+    );
+    void Destroy();
+
+    // Command buffer for the current batch, begun on first use
+    vk::CommandBuffer GetCommandBuffer();
+    // Ticket the current batch will get when it's flushed
+    UploadTicket GetPendingTicket();
+
+    // Reserve host visible staging memory that lives until the batch completes
+    StagingSpan Stage(vk::DeviceSize size, vk::DeviceSize alignment = 16);
+    // Stage the data and record a copy into the buffer, dstStages and dstAccess
+    // describe how the owning queue will use it
+    void UploadBuffer(
+        vk::Buffer dst,
+        vk::DeviceSize dstOffset,
+        const void *data,
+        vk::DeviceSize size,
+        vk::PipelineStageFlags dstStages = vk::PipelineStageFlagBits::eAllCommands,
+        vk::AccessFlags dstAccess = vk::AccessFlagBits::eMemoryRead
+    );
+    // Stage the data and copy it into the first mip and layer, discarding the old
+    // contents. The image is left in finalState.
+    void UploadImage(
+        vk::Image dst,
+        vk::ImageAspectFlags aspectMask,
+        vk::Extent3D extent,
+        const void *data,
+        vk::DeviceSize size,
+        const ImageState &finalState
+    );
+    // Record copies out of staging memory the caller keeps alive until the
+    // batch completes, ownership is handed over the same way as above
+    void CopyBuffer(
+        vk::Buffer src,
+        vk::DeviceSize srcOffset,
+        vk::Buffer dst,
+        vk::DeviceSize dstOffset,
+        vk::DeviceSize size,
+        vk::PipelineStageFlags dstStages = vk::PipelineStageFlagBits::eAllCommands,
+        vk::AccessFlags dstAccess = vk::AccessFlagBits::eMemoryRead
+    );
+    // The first levelCount mips are discarded, filled from the regions and left in finalState
+    void CopyImage(
+        vk::Buffer src,
+        vk::Image dst,
+        vk::ImageAspectFlags aspectMask,
+        uint32_t levelCount,
+        const std::vector<vk::BufferImageCopy> &regions,
+        const ImageState &finalState
+    );
+
+    // Submit the current batch without waiting for it. Returns the batch's ticket,
+    // or the last submitted ticket if nothing was recorded.
+    UploadTicket Flush();
+    bool IsComplete(UploadTicket ticket);
+    void Wait(UploadTicket ticket);
+    // Recycle batches the GPU has finished with
+    void Retire();
+
+    // Move the acquires for everything flushed so far into acquire
+    void TakeAcquires(QueueAcquire &acquire);
+    // Hand back a semaphore from TakeAcquires once the wait on it has completed
+    void RecycleSemaphore(vk::Semaphore semaphore);
+
+private:
+    struct StagingChunk
+    {
+        vk::Buffer buffer;
+        Allocation mem;
+        vk::DeviceSize size;
+        vk::DeviceSize head;
+    };
+
+    struct Batch
+    {
+        vk::CommandBuffer cmdBuffer;
+        vk::Fence fence;
+        UploadTicket ticket;
+        std::vector<StagingChunk> chunks;
+        std::vector<vk::BufferMemoryBarrier> releaseBuffers;
+        std::vector<vk::ImageMemoryBarrier> releaseImages;
+        // Copies the same queue family reads, made visible to it at the end of the batch
+        std::vector<vk::BufferMemoryBarrier> visibleBuffers;
+        vk::PipelineStageFlags visibleStages;
+        QueueAcquire acquire;
+    };
+
+    Batch *BeginBatch();
+    StagingChunk CreateChunk(vk::DeviceSize size);
+    bool NeedsOwnershipTransfer() const;
+    void RecycleBatch(std::unique_ptr<Batch> batch);
+
+    vk::Device device;
+    vk::Queue queue;
+    uint32_t queueFamily;
+    uint32_t ownerFamily;
+    MemoryAllocator *allocator;
+    vk::CommandPool commandPool;
+    vk::DeviceSize stagingChunkSize;
+
+    std::unique_ptr<Batch> recording;
+    std::deque<std::unique_ptr<Batch>> inFlight;
+    std::vector<std::unique_ptr<Batch>> freeBatches;
+    std::vector<QueueAcquire> readyAcquires;
+    std::vector<vk::Semaphore> freeSemaphores;
+    UploadTicket nextTicket;
+    UploadTicket completedTicket;
+};
@@ -1,579 +1,1434 @@
-#include "VkApp.h"
-#include "Window.h"
-
-VkApp::VkApp()
-{
-    InitInstance();
-    InitDevice();
-    InitWindow();
-    InitCommandPool();
-    InitSetupCmd();
-    InitSwapChain();
-    InitCommandBuffers();
-    InitDepthStencil();
-    InitRenderPass();
-    InitPipelineCache();
-    InitFrameBuffer();
-    FlushSetupCmd();
-}
-
-VkApp::~VkApp()
-{
-    FreeFramebuffers();
-
-    if (device && renderPass)
-        device.destroyRenderPass(renderPass);
-
-    FreeDepthStencil();
-    FreeCommandBuffers();
-
-    // Free swap chain
-    if (device && swapChain)
-    {
-        for (auto &buffer : swapBuffers)
-        {
-            device.destroyImageView(buffer.view);
-        }
-        device.destroySwapchainKHR(swapChain);
-    }
-
-    FlushSetupCmd();
-
-    // Free command pool
-    if (device && commandPool)
-        device.destroyCommandPool(commandPool);
-    // Free surface
-    if (instance && surface)
-        instance.destroySurfaceKHR(surface);
-    // Free window
-    if (window)
-        window.reset();
-    // Free device
-    if (device)
-        device.destroy();
-    // Free instance
-    if (instance)
-        instance.destroy();
-}
-
-Window *VkApp::GetWindow()
-{
-    return window.get();
-}
-
-void VkApp::InitInstance()
-{
-    // Set up our app info
-    auto appInfo = vk::ApplicationInfo()
-        .setPApplicationName("Cnnr's Vulkan Renderer")
-        .setEngineVersion(1)
-        .setApiVersion(VK_API_VERSION_1_0);
-
-    // Extensions we need
-    const char *extensions[] =
-    {
-        VK_KHR_SURFACE_EXTENSION_NAME,
-        VK_KHR_WIN32_SURFACE_EXTENSION_NAME,
-    };
-
-    // Tell the instance about the extensions
-    auto instInfo = vk::InstanceCreateInfo()
-        .setPApplicationInfo(&appInfo)
-        .setEnabledExtensionCount(ARRAYSIZE(extensions))
-        .setPpEnabledExtensionNames(extensions);
-
-    // Create the vulkan instance
-    instance = vk::createInstance(instInfo);
-}
-
-void VkApp::InitDevice()
-{
-    // Get the first device
-    physicalDevice = instance.enumeratePhysicalDevices()[0];
-
-    // Set up the queue info
-    float queuePriorities[] = { 1.0f };
-    auto devQueueInfo = vk::DeviceQueueCreateInfo()
-        .setQueueCount(1)
-        .setPQueuePriorities(queuePriorities);
-
-    // Set up the device info
-    auto devInfo = vk::DeviceCreateInfo()
-        .setQueueCreateInfoCount(1)
-        .setPQueueCreateInfos(&devQueueInfo);
-
-    // Create the device
-    device = physicalDevice.createDevice(devInfo);
-
-    // Find a good queue to use
-    queueIndex = FindQueue();
-    queue = device.getQueue(queueIndex, 0);
-}
-
-void VkApp::InitWindow()
-{
-    window = std::make_unique<Window>();
-
-#ifdef _WIN32
-    auto hwnd = window->GetHandle();
-    auto surfaceInfo = vk::Win32SurfaceCreateInfoKHR()
-        .setHinstance(window->GetHInst())
-        .setHwnd(hwnd);
-
-    window->SetHandler(WM_SIZE, [this](HWND hwnd, UINT msg, WPARAM wp, LPARAM lp) -> LRESULT
-    {
-        return DefWindowProcW(hwnd, msg, wp, lp);
-    });
-
-    // Get the window rectangle
-    RECT rect;
-    GetClientRect(hwnd, &rect);
-    clientWidth = rect.right - rect.left;
-    clientHeight = rect.bottom - rect.top;
-
-    // Create a surface for the window
-    surface = instance.createWin32SurfaceKHR(surfaceInfo);
-#else
-#error "Non-windows not yet supported"
-#endif
-
-    // Get the color format to use
-    auto surfaceFormats = physicalDevice.getSurfaceFormatsKHR(surface);
-    if (surfaceFormats.size() == 1 && surfaceFormats[0].format == vk::Format::eUndefined)
-        colorFormat = vk::Format::eB8G8R8A8Unorm;
-    else
-        colorFormat = surfaceFormats[0].format;
-    colorSpace = surfaceFormats[0].colorSpace;
-}
-
-void VkApp::InitCommandPool()
-{
-    auto poolInfo = vk::CommandPoolCreateInfo()
-        .setQueueFamilyIndex(queueIndex)
-        .setFlags(vk::CommandPoolCreateFlagBits::eResetCommandBuffer);
-
-    commandPool = device.createCommandPool(poolInfo);
-}
-
-void VkApp::InitSwapChain()
-{
-    auto oldSwap = swapChain;
-    auto surfaceCaps = physicalDevice.getSurfaceCapabilitiesKHR(surface).value;
-    auto presentModes = physicalDevice.getSurfacePresentModesKHR(surface);
-
-    // Figure out the extent of the surface to use
-    vk::Extent2D swapExtent;
-    if (surfaceCaps.currentExtent.width == -1)
-    {
-        swapExtent.width = clientWidth;
-        swapExtent.height = clientHeight;
-    }
-    else
-    {
-        clientWidth = swapExtent.width = surfaceCaps.currentExtent.width;
-        clientHeight = swapExtent.height = surfaceCaps.currentExtent.height;
-    }
-
-    // Prefer Mailbox -> FifoRelaxed -> Fifo
-    vk::PresentModeKHR swapchainPresentMode = vk::PresentModeKHR::eFifo;
-    for (auto mode : presentModes)
-    {
-        if (mode == vk::PresentModeKHR::eMailbox)
-        {
-            swapchainPresentMode = vk::PresentModeKHR::eMailbox;
-            break;
-        }
-        else if (mode == vk::PresentModeKHR::eFifoRelaxed)
-        {
-            swapchainPresentMode = vk::PresentModeKHR::eFifoRelaxed;
-        }
-    }
-
-    uint32_t desiredImages = surfaceCaps.minImageCount + 1;
-    if (surfaceCaps.maxImageCount > 0 && desiredImages > surfaceCaps.maxImageCount)
-        desiredImages = surfaceCaps.maxImageCount;
-
-    auto preTransform = surfaceCaps.currentTransform;
-    if (surfaceCaps.supportedTransforms & vk::SurfaceTransformFlagBitsKHR::eIdentity)
-        preTransform = vk::SurfaceTransformFlagBitsKHR::eIdentity;
-
-    auto swapInfo = vk::SwapchainCreateInfoKHR()
-        .setSurface(surface)
-        .setMinImageCount(desiredImages)
-        .setImageFormat(colorFormat)
-        .setImageColorSpace(colorSpace)
-        .setImageExtent(swapExtent)
-        .setImageUsage(vk::ImageUsageFlagBits::eColorAttachment)
-        .setPreTransform(preTransform)
-        .setImageArrayLayers(1)
-        .setImageSharingMode(vk::SharingMode::eExclusive)
-        .setPresentMode(swapchainPresentMode)
-        .setOldSwapchain(oldSwap)
-        .setClipped(true)
-        .setCompositeAlpha(vk::CompositeAlphaFlagBitsKHR::eOpaque);
-
-    swapChain = device.createSwapchainKHR(swapInfo);
-
-    if (oldSwap)
-    {
-        for (auto &buffer : swapBuffers)
-        {
-            device.destroyImageView(buffer.view);
-            buffer.view = nullptr;
-        }
-        device.destroySwapchainKHR(oldSwap);
-    }
-
-    auto images = device.getSwapchainImagesKHR(swapChain);
-
-    swapBuffers.resize(images.size());
-    for (uint32_t i = 0; i < images.size(); ++i)
-    {
-        auto image = images[i];
-        auto viewInfo = vk::ImageViewCreateInfo()
-            .setFormat(colorFormat)
-            .setComponents({
-                vk::ComponentSwizzle::eR,
-                vk::ComponentSwizzle::eG,
-                vk::ComponentSwizzle::eB,
-                vk::ComponentSwizzle::eA,
-        })
-        .setSubresourceRange(vk::ImageSubresourceRange()
-            .setAspectMask(vk::ImageAspectFlagBits::eColor)
-            .setLevelCount(1)
-            .setLayerCount(1))
-        .setViewType(vk::ImageViewType::e2D)
-        .setImage(image);
-
-        SetImageLayout(
-            setupCmdBuffer,
-            image,
-            vk::ImageAspectFlagBits::eColor,
-            vk::ImageLayout::eUndefined,
-            vk::ImageLayout::ePresentSrcKHR
-        );
-
-        swapBuffers[i].image = image;
-        swapBuffers[i].view = device.createImageView(viewInfo);
-    }
-}
-
-void VkApp::InitCommandBuffers()
-{
-    // Allocate per-buffer command buffers
-    auto bufferCount = (uint32_t)swapBuffers.size();
-    auto allocateInfo = vk::CommandBufferAllocateInfo()
-        .setCommandPool(commandPool)
-        .setLevel(vk::CommandBufferLevel::ePrimary)
-        .setCommandBufferCount(bufferCount);
-    drawCmdBuffers = device.allocateCommandBuffers(allocateInfo);
-
-    // Allocate present barrier buffers
-    allocateInfo.setCommandBufferCount(1);
-    prePresentCmdBuffer = device.allocateCommandBuffers(allocateInfo)[0];
-    postPresentCmdBuffer = device.allocateCommandBuffers(allocateInfo)[0];
-}
-
-void VkApp::InitDepthStencil()
-{
-    // Create the image
-    depthFormat = GetDepthFormat();
-    auto imageInfo = vk::ImageCreateInfo()
-        .setImageType(vk::ImageType::e2D)
-        .setFormat(depthFormat)
-        .setExtent({ (uint32_t)clientWidth, (uint32_t)clientHeight, 1 })
-        .setMipLevels(1)
-        .setArrayLayers(1)
-        .setSamples(vk::SampleCountFlagBits::e1)
-        .setTiling(vk::ImageTiling::eOptimal)
-        .setUsage(vk::ImageUsageFlagBits::eDepthStencilAttachment | vk::ImageUsageFlagBits::eTransferSrc);
-    depthStencil.image = device.createImage(imageInfo);
-
-    // Allocate the memory
-    auto memReqs = device.getImageMemoryRequirements(depthStencil.image);
-    auto allocateInfo = vk::MemoryAllocateInfo()
-        .setAllocationSize(memReqs.size)
-        .setMemoryTypeIndex(GetMemoryType(memReqs.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal));
-    depthStencil.mem = device.allocateMemory(allocateInfo);
-    device.bindImageMemory(depthStencil.image, depthStencil.mem, 0);
-
-    // Setup the image layout
-    SetImageLayout(
-        setupCmdBuffer,
-        depthStencil.image,
-        vk::ImageAspectFlagBits::eDepth | vk::ImageAspectFlagBits::eStencil,
-        vk::ImageLayout::eUndefined,
-        vk::ImageLayout::eDepthStencilAttachmentOptimal
-    );
-
-    // Create the view
-    auto viewInfo = vk::ImageViewCreateInfo()
-        .setViewType(vk::ImageViewType::e2D)
-        .setFormat(depthFormat)
-        .setSubresourceRange(vk::ImageSubresourceRange()
-            .setAspectMask(vk::ImageAspectFlagBits::eDepth | vk::ImageAspectFlagBits::eStencil)
-            .setLevelCount(1)
-            .setLayerCount(1))
-        .setImage(depthStencil.image);
-    depthStencil.view = device.createImageView(viewInfo);
-}
-
-void VkApp::InitRenderPass()
-{
-    vk::AttachmentDescription attachments[2] =
-    {
-        // Color attachment
-        vk::AttachmentDescription
-        {
-            vk::AttachmentDescriptionFlags(),
-            colorFormat,
-            vk::SampleCountFlagBits::e1,
-            vk::AttachmentLoadOp::eClear,
-            vk::AttachmentStoreOp::eStore,
-            vk::AttachmentLoadOp::eDontCare,
-            vk::AttachmentStoreOp::eDontCare,
-            vk::ImageLayout::eColorAttachmentOptimal,
-            vk::ImageLayout::eColorAttachmentOptimal,
-        },
-        // Depth attachment
-        vk::AttachmentDescription
-        {
-            vk::AttachmentDescriptionFlags(),
-            depthFormat,
-            vk::SampleCountFlagBits::e1,
-            vk::AttachmentLoadOp::eClear,
-            vk::AttachmentStoreOp::eStore,
-            vk::AttachmentLoadOp::eDontCare,
-            vk::AttachmentStoreOp::eDontCare,
-            vk::ImageLayout::eDepthStencilAttachmentOptimal,
-            vk::ImageLayout::eDepthStencilAttachmentOptimal,
-        },
-    };
-
-    auto colorReference = vk::AttachmentReference()
-        .setAttachment(0)
-        .setLayout(vk::ImageLayout::eColorAttachmentOptimal);
-    auto depthReference = vk::AttachmentReference()
-        .setAttachment(1)
-        .setLayout(vk::ImageLayout::eDepthStencilAttachmentOptimal);
-
-    auto subpass = vk::SubpassDescription()
-        .setPipelineBindPoint(vk::PipelineBindPoint::eGraphics)
-        .setColorAttachmentCount(1)
-        .setPColorAttachments(&colorReference)
-        .setPDepthStencilAttachment(&depthReference);
-
-    auto renderPassInfo = vk::RenderPassCreateInfo()
-        .setAttachmentCount(2)
-        .setPAttachments(attachments)
-        .setSubpassCount(1)
-        .setPSubpasses(&subpass);
-
-    renderPass = device.createRenderPass(renderPassInfo);
-}
-
-void VkApp::InitPipelineCache()
-{
-    pipelineCache = device.createPipelineCache(vk::PipelineCacheCreateInfo());
-}
-
-void VkApp::InitFrameBuffer()
-{
-    vk::ImageView attachments[2];
-    attachments[1] = depthStencil.view;
-
-    auto fbInfo = vk::FramebufferCreateInfo()
-        .setRenderPass(renderPass)
-        .setAttachmentCount(2)
-        .setPAttachments(attachments)
-        .setWidth(clientWidth)
-        .setHeight(clientHeight)
-        .setLayers(1);
-
-    FreeFramebuffers();
-    frameBuffers.resize(swapBuffers.size());
-    for (uint32_t i = 0; i < frameBuffers.size(); ++i)
-    {
-        attachments[0] = swapBuffers[i].view;
-        device.createFramebuffer(fbInfo);
-    }
-}
-
-void VkApp::FreeCommandBuffers()
-{
-    device.freeCommandBuffers(commandPool, drawCmdBuffers);
-    device.freeCommandBuffers(commandPool, prePresentCmdBuffer);
-    device.freeCommandBuffers(commandPool, postPresentCmdBuffer);
-}
-
-void VkApp::FreeDepthStencil()
-{
-    if (!device || !depthStencil.view)
-        return;
-
-    device.destroyImageView(depthStencil.view);
-    device.freeMemory(depthStencil.mem);
-    device.destroyImage(depthStencil.image);
-}
-
-void VkApp::FreeFramebuffers()
-{
-    if (!device)
-        return;
-
-    for (auto &buffer : frameBuffers)
-    {
-        if (buffer)
-        {
-            device.destroyFramebuffer(buffer);
-            buffer = nullptr;
-        }
-    }
-}
-
-uint32_t VkApp::FindQueue()
-{
-    // Find the first queue that supports graphics and presenting.
-    auto queueProperties = physicalDevice.getQueueFamilyProperties();
-    for (uint32_t i = 0; i < queueProperties.size(); ++i)
-    {
-        if (queueProperties[i].queueFlags & vk::QueueFlagBits::eGraphics)
-        {
-            if (physicalDevice.getSurfaceSupportKHR(i, surface))
-            {
-                return i;
-            }
-        }
-    }
-
-    throw std::runtime_error{ "Device does not support graphics and presenting in any queues" };
-}
-
-vk::Format VkApp::GetDepthFormat()
-{
-    const vk::Format depthFormats[] =
-    {
-        vk::Format::eD32SfloatS8Uint,
-        //vk::Format::eD32Sfloat,
-        vk::Format::eD24UnormS8Uint,
-        vk::Format::eD16UnormS8Uint,
-        //vk::Format::eD16Unorm,
-    };
-
-    for (auto &format : depthFormats)
-    {
-        auto formatProps = physicalDevice.getFormatProperties(format);
-        if (formatProps.optimalTilingFeatures & vk::FormatFeatureFlagBits::eDepthStencilAttachment)
-        {
-            return format;
-        }
-    }
-
-    throw std::runtime_error{ "Device doesn't support any acceptable depth-stencil formats" };
-}
-
-uint32_t VkApp::GetMemoryType(uint32_t typeBits, vk::MemoryPropertyFlags flags)
-{
-    auto memProps = physicalDevice.getMemoryProperties();
-    for (int i = 0; i < 32; ++i)
-    {
-        if (typeBits & (1 << i))
-        {
-            if ((memProps.memoryTypes[i].propertyFlags & flags) == flags)
-            {
-                return i;
-            }
-        }
-    }
-    throw std::runtime_error{ "No suitable memory types" };
-}
-
-void VkApp::SetImageLayout(
-    vk::CommandBuffer commandBuffer,
-    vk::Image image,
-    vk::ImageAspectFlags aspectMask,
-    vk::ImageLayout oldLayout,
-    vk::ImageLayout newLayout)
-{
-    auto memBarrier = vk::ImageMemoryBarrier()
-        .setOldLayout(oldLayout)
-        .setNewLayout(newLayout)
-        .setImage(image)
-        .setSubresourceRange(
-            vk::ImageSubresourceRange()
-            .setAspectMask(aspectMask)
-            .setLevelCount(1)
-            .setLayerCount(1));
-
-    // Determine flags on the old layout
-    if (oldLayout == vk::ImageLayout::eUndefined)
-        memBarrier.setSrcAccessMask(vk::AccessFlagBits::eHostWrite | vk::AccessFlagBits::eTransferWrite);
-    else if (oldLayout == vk::ImageLayout::eColorAttachmentOptimal)
-        memBarrier.setSrcAccessMask(vk::AccessFlagBits::eColorAttachmentWrite);
-    else if (oldLayout == vk::ImageLayout::eTransferSrcOptimal)
-        memBarrier.setSrcAccessMask(vk::AccessFlagBits::eTransferRead);
-
-    // Determine flags on the new layout
-    if (newLayout == vk::ImageLayout::eTransferDstOptimal)
-        memBarrier.setDstAccessMask(vk::AccessFlagBits::eTransferWrite);
-    else if (newLayout == vk::ImageLayout::eTransferSrcOptimal)
-        memBarrier
-        .setSrcAccessMask(memBarrier.srcAccessMask | vk::AccessFlagBits::eTransferRead)
-        .setDstAccessMask(vk::AccessFlagBits::eTransferRead);
-    else if (newLayout == vk::ImageLayout::eColorAttachmentOptimal)
-        memBarrier
-        .setDstAccessMask(vk::AccessFlagBits::eColorAttachmentWrite)
-        .setSrcAccessMask(vk::AccessFlagBits::eTransferRead);
-    else if (newLayout == vk::ImageLayout::eDepthStencilAttachmentOptimal)
-        memBarrier.setDstAccessMask(vk::AccessFlagBits::eDepthStencilAttachmentWrite);
-    else if (newLayout == vk::ImageLayout::eShaderReadOnlyOptimal)
-        memBarrier
-        .setSrcAccessMask(vk::AccessFlagBits::eHostWrite | vk::AccessFlagBits::eTransferWrite)
-        .setDstAccessMask(vk::AccessFlagBits::eShaderRead);
-
-    commandBuffer.pipelineBarrier(
-        vk::PipelineStageFlagBits::eTopOfPipe,
-        vk::PipelineStageFlagBits::eTopOfPipe,
-        vk::DependencyFlags(),
-        nullptr,
-        nullptr,
-        memBarrier
-    );
-}
-
-void VkApp::InitSetupCmd()
-{
-    FlushSetupCmd();
-
-    auto allocateInfo = vk::CommandBufferAllocateInfo()
-        .setCommandPool(commandPool)
-        .setLevel(vk::CommandBufferLevel::ePrimary)
-        .setCommandBufferCount(1);
-
-    vk::createResultValue(
-        device.allocateCommandBuffers(&allocateInfo, &setupCmdBuffer),
-        "vk::Device::allocateCommandBuffers"
-    );
-
-    setupCmdBuffer.begin(vk::CommandBufferBeginInfo{});
-}
-
-void VkApp::FlushSetupCmd()
-{
-    if (!setupCmdBuffer)
-        return;
-
-    setupCmdBuffer.end();
-
-    auto submitInfo = vk::SubmitInfo()
-        .setCommandBufferCount(1)
-        .setPCommandBuffers(&setupCmdBuffer);
-
-    queue.submit(submitInfo, nullptr);
-    queue.waitIdle();
-
-    device.freeCommandBuffers(commandPool, setupCmdBuffer);
-    setupCmdBuffer = nullptr;
-}
-
-
+#include "VkApp.h"
+#include "DeviceSelector.h"
+#include "FileUtil.h"
+#include "HeadlessWindow.h"
+#include "Win32Window.h"
+#include "Log.h"
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+VkApp::VkApp(const VkAppConfig &config)
+    : config(config), pipelineCacheTask(0), depthSampled(false), swapTransferSrc(false), setupTicket(0), setupScope(GpuProfiler::InvalidScope), setupResolvePending(false), drawChunkCount(0), hasProperties2(false), resizePending(false), stopRendering(false), frameIndex(0), frameCount(0)
+{
+    startup.Time("jobs", [this]() { jobs = std::make_unique<JobSystem>(this->config.workerThreads); });
+
+    // Each stage runs as soon as what it needs is ready. The constructor returns
+    // once everything needed to render a frame exists, loading the pipeline
+    // cache carries on in the background unless something compiled at startup
+    // needs it.
+    auto &tasks = startupTasks;
+    auto instanceTask = tasks.Add("instance", [this]() { InitInstance(); });
+    auto windowTask = tasks.Add("window", [this]() { InitWindow(); }, {}, TaskKind::MainThread);
+    auto surfaceTask = tasks.Add("surface", [this]() { InitSurface(); }, { instanceTask, windowTask });
+    auto deviceTask = tasks.Add("device", [this]() { InitDevice(); }, { surfaceTask });
+    auto commandPoolTask = tasks.Add("command pool", [this]() { InitCommandPool(); }, { deviceTask });
+    tasks.Add("worker commands", [this]() { InitWorkerCommands(); }, { deviceTask });
+    auto setupCmdTask = tasks.Add("setup cmd", [this]() { InitSetupCmd(); }, { commandPoolTask });
+    auto swapChainTask = tasks.Add("swapchain", [this]() { InitSwapChain(); }, { deviceTask });
+    tasks.Add("command buffers", [this]() { InitCommandBuffers(); }, { commandPoolTask });
+    auto depthFormatTask = tasks.Add("depth format", [this]() { depthFormat = GetDepthFormat(); }, { deviceTask });
+    pipelineCacheTask = tasks.Add("pipeline cache", [this]() { InitPipelineCache(); }, { deviceTask }, TaskKind::Background);
+    auto shaderLibraryTask = tasks.Add("shader library", [this]() { InitShaderLibrary(); }, { deviceTask });
+    // Compiled against the cache, reading it is cheaper than compiling cold
+    auto cullingTask = tasks.Add("gpu culling", [this]()
+    {
+        auto shader = shaders.Contains("cull.comp") ? shaders.GetModule("cull.comp") : vk::ShaderModule();
+        culling.Init(device, physicalDevice, allocator, shader, pipelineCache, cullingFeatures, this->config.framesInFlight);
+    }, { shaderLibraryTask, pipelineCacheTask });
+    // The depth buffer matches the swap chain, which may have picked a different size.
+    // Its Hi-Z pyramid is only built when culling can use it, which also means the
+    // pipeline cache has loaded.
+    tasks.Add("render graph", [this]() { InitRenderGraph(); }, { depthFormatTask, swapChainTask, cullingTask });
+    // Streams through the transfer queue's upload context
+    tasks.Add("asset streamer", [this]() { InitAssetStreamer(); }, { commandPoolTask });
+    tasks.Add("frame data", [this]()
+    {
+        frameData.Init(device, allocator, physicalDevice.getProperties().limits, this->config.framesInFlight, this->config.frameDataSize);
+    }, { deviceTask });
+    tasks.Add("descriptors", [this]()
+    {
+        descriptors.Init(device, descriptorLimits, this->config.framesInFlight, this->config.descriptorTextures, this->config.descriptorBuffers);
+    }, { deviceTask });
+    tasks.Add("draw queue", [this]() { drawQueue.Reserve(this->config.maxDrawItems); });
+    tasks.Add("scene", [this]() { scene.Reserve(this->config.sceneNodes); });
+    tasks.Add("frame capture", [this]()
+    {
+        auto atomSize = physicalDevice.getProperties().limits.nonCoherentAtomSize;
+        capture.Init(device, allocator, atomSize, this->config.captureBuffers, this->config.capturePath, this->config.captureFormat);
+        capture.Request(this->config.captureFrames);
+    }, { deviceTask });
+    tasks.Add("frame sync", [this]() { InitFrameSync(); }, { swapChainTask });
+    // Records the layout transitions queued by the swap chain
+    tasks.Add("setup flush", [this]() { FlushSetupCmd(); }, { setupCmdTask, swapChainTask });
+    tasks.Run(*jobs, &startup);
+
+    Log("startup " + startup.ToJson());
+}
+
+VkApp::~VkApp()
+{
+    // Let the frames in flight finish before tearing anything down
+    JoinRenderThread();
+    startupTasks.WaitAll();
+    if (device)
+        device.waitIdle();
+
+    FreeFrameSync();
+    renderGraph.reset();
+    hiz.reset();
+    ReleaseRetired(true);
+
+    pipelines.Destroy();
+    shaders.Destroy();
+    frameData.Destroy();
+    descriptors.Destroy();
+    assets.Destroy();
+    culling.Destroy();
+    // Writes out whatever was still waiting
+    capture.Destroy();
+
+    // Keep the compiled pipelines around for the next run
+    if (device && pipelineCache)
+    {
+        SavePipelineCache();
+        device.destroyPipelineCache(pipelineCache);
+    }
+
+    FreeCommandBuffers();
+    FreeWorkerCommands();
+    FreeSwapBuffers();
+
+    // Free swap chain
+    if (device && swapChain)
+        device.destroySwapchainKHR(swapChain);
+
+    // Free setup and upload batches
+    uploads.Destroy();
+    transfers.Destroy();
+
+    // Free command pool
+    if (device && commandPool)
+        device.destroyCommandPool(commandPool);
+    // Free surface
+    if (instance && surface)
+        instance.destroySurfaceKHR(surface);
+    // Free window
+    if (window)
+        window.reset();
+    // Free queries
+    profiler.Destroy();
+    // Free device memory
+    allocator.Destroy();
+    // Free device
+    if (device)
+        device.destroy();
+    // Free instance
+    if (instance)
+        instance.destroy();
+}
+
+Window *VkApp::GetWindow()
+{
+    return window.get();
+}
+
+void VkApp::RenderFrame()
+{
+    HandleWindowEvents();
+    if (frameHandler)
+        frameHandler(frameCount);
+
+    uint32_t imageIndex;
+    if (!BeginFrame(imageIndex))
+    {
+        // Nothing gets drawn, the handler fills it again for the next attempt
+        drawQueue.Clear();
+        return;
+    }
+    RecordFrame(drawCmdBuffers[frameIndex], imageIndex);
+    EndFrame(imageIndex);
+}
+
+void VkApp::StartRendering()
+{
+    if (renderThread.joinable())
+        throw std::runtime_error{ "Already rendering" };
+
+    stopRendering = false;
+    renderError = nullptr;
+    renderThread = std::thread{ &VkApp::RenderThreadMain, this };
+}
+
+void VkApp::StopRendering()
+{
+    JoinRenderThread();
+    if (renderError)
+        std::rethrow_exception(renderError);
+}
+
+void VkApp::SetEventHandler(EventHandler handler)
+{
+    eventHandler = std::move(handler);
+}
+
+void VkApp::SetFrameHandler(FrameHandler handler)
+{
+    frameHandler = std::move(handler);
+}
+
+uint64_t VkApp::GetFrameCount()
+{
+    return frameCount;
+}
+
+AllocationStats VkApp::GetMemoryStats()
+{
+    return allocator.GetStats();
+}
+
+JobSystem &VkApp::GetJobs()
+{
+    return *jobs;
+}
+
+DeviceQueue VkApp::GetGraphicsQueue()
+{
+    return DeviceQueue{ queue, queueIndex };
+}
+
+DeviceQueue VkApp::GetComputeQueue()
+{
+    return DeviceQueue{ computeQueue, computeQueueIndex };
+}
+
+DeviceQueue VkApp::GetTransferQueue()
+{
+    return DeviceQueue{ transferQueue, transferQueueIndex };
+}
+
+UploadContext &VkApp::GetTransfers()
+{
+    return transfers;
+}
+
+GpuProfiler &VkApp::GetProfiler()
+{
+    return profiler;
+}
+
+const StageTimer &VkApp::GetStartupTimer()
+{
+    return startup;
+}
+
+vk::PipelineCache VkApp::GetPipelineCache()
+{
+    startupTasks.Wait(pipelineCacheTask);
+    return pipelineCache;
+}
+
+PipelineCompiler &VkApp::GetPipelines()
+{
+    startupTasks.Wait(pipelineCacheTask);
+    return pipelines;
+}
+
+vk::RenderPass VkApp::GetRenderPass()
+{
+    return renderGraph->GetRenderPass(mainPass);
+}
+
+uint32_t VkApp::GetSubpass()
+{
+    return renderGraph->GetSubpass(mainPass);
+}
+
+ShaderLibrary &VkApp::GetShaders()
+{
+    return shaders;
+}
+
+FrameRingBuffer &VkApp::GetFrameData()
+{
+    return frameData;
+}
+
+DescriptorHeap &VkApp::GetDescriptors()
+{
+    return descriptors;
+}
+
+AssetStreamer &VkApp::GetAssets()
+{
+    return assets;
+}
+
+GpuCulling &VkApp::GetCulling()
+{
+    return culling;
+}
+
+DrawQueue &VkApp::GetDrawQueue()
+{
+    return drawQueue;
+}
+
+Scene &VkApp::GetScene()
+{
+    return scene;
+}
+
+FrameCapture &VkApp::GetCapture()
+{
+    return capture;
+}
+
+void VkApp::WaitForStartup()
+{
+    startupTasks.WaitAll();
+}
+
+void VkApp::SetDrawRecorder(uint32_t chunkCount, DrawRecorder recorder)
+{
+    drawChunkCount = recorder ? chunkCount : 0;
+    drawRecorder = std::move(recorder);
+}
+
+void VkApp::InitInstance()
+{
+    // Set up our app info
+    auto appInfo = vk::ApplicationInfo()
+        .setPApplicationName("Cnnr's Vulkan Renderer")
+        .setEngineVersion(1)
+        .setApiVersion(VK_API_VERSION_1_0);
+
+    // Extensions we need, offscreen rendering doesn't need any surface support
+    std::vector<const char *> extensions;
+    if (!config.headless)
+    {
+        extensions.push_back(VK_KHR_SURFACE_EXTENSION_NAME);
+#ifdef _WIN32
+        extensions.push_back(VK_KHR_WIN32_SURFACE_EXTENSION_NAME);
+#endif
+    }
+
+    // Querying descriptor indexing support goes through the properties2 entry points
+    if (config.bindless)
+    {
+        uint32_t count = 0;
+        vkEnumerateInstanceExtensionProperties(nullptr, &count, nullptr);
+        std::vector<VkExtensionProperties> available(count);
+        vkEnumerateInstanceExtensionProperties(nullptr, &count, available.data());
+        for (auto &extension : available)
+            hasProperties2 = hasProperties2 || strcmp(extension.extensionName, VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME) == 0;
+        if (hasProperties2)
+            extensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+    }
+
+    // Tell the instance about the extensions
+    auto instInfo = vk::InstanceCreateInfo()
+        .setPApplicationInfo(&appInfo)
+        .setEnabledExtensionCount((uint32_t)extensions.size())
+        .setPpEnabledExtensionNames(extensions.data());
+
+    // Create the vulkan instance
+    instance = vk::createInstance(instInfo);
+}
+
+void VkApp::InitDevice()
+{
+    // Pick the best device, this logs what every device can do and why one was chosen
+    DeviceSelector selector{ instance, surface };
+    physicalDevice = selector.Select(config.deviceOverride);
+
+    // Find good queues to use, this has to happen before the device is created.
+    // Compute and transfer get their own families when the device has them so
+    // their work can overlap graphics.
+    queueIndex = FindQueue();
+    computeQueueIndex = FindDedicatedQueue(vk::QueueFlagBits::eCompute, vk::QueueFlagBits::eGraphics);
+    transferQueueIndex = FindDedicatedQueue(
+        vk::QueueFlagBits::eTransfer,
+        vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute
+    );
+    if (transferQueueIndex == queueIndex)
+        transferQueueIndex = computeQueueIndex;
+
+    // One queue per family, but compute and transfer get separate queues if they share a family
+    auto queueProperties = physicalDevice.getQueueFamilyProperties();
+    float queuePriorities[] = { 1.0f, 1.0f };
+    std::vector<vk::DeviceQueueCreateInfo> devQueueInfos;
+    for (auto family : { queueIndex, computeQueueIndex, transferQueueIndex })
+    {
+        bool exists = false;
+        for (auto &info : devQueueInfos)
+            exists = exists || info.queueFamilyIndex == family;
+        if (exists)
+            continue;
+
+        uint32_t count = 1;
+        if (family != queueIndex && computeQueueIndex == transferQueueIndex)
+            count = std::min(2u, queueProperties[family].queueCount);
+
+        devQueueInfos.push_back(vk::DeviceQueueCreateInfo()
+            .setQueueFamilyIndex(family)
+            .setQueueCount(count)
+            .setPQueuePriorities(queuePriorities));
+    }
+
+    // Presenting needs the swap chain extension
+    std::vector<const char *> extensions;
+    if (!config.headless)
+        extensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+
+    auto deviceExtensions = physicalDevice.enumerateDeviceExtensionProperties();
+    auto hasExtension = [&deviceExtensions](const char *name)
+    {
+        for (auto &extension : deviceExtensions)
+        {
+            if (strcmp(extension.extensionName, name) == 0)
+                return true;
+        }
+        return false;
+    };
+
+    // Culled instances are drawn indirectly, with their index passed as the first instance
+    auto supportedFeatures = physicalDevice.getFeatures();
+    auto enabledFeatures = vk::PhysicalDeviceFeatures()
+        .setMultiDrawIndirect(supportedFeatures.multiDrawIndirect)
+        .setDrawIndirectFirstInstance(supportedFeatures.drawIndirectFirstInstance);
+    cullingFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect != 0;
+    cullingFeatures.drawIndirectFirstInstance = supportedFeatures.drawIndirectFirstInstance != 0;
+    cullingFeatures.drawIndirectCount = false;
+#ifdef VK_KHR_draw_indirect_count
+    if (hasExtension(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME))
+    {
+        cullingFeatures.drawIndirectCount = true;
+        extensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+    }
+#endif
+
+    // Classic descriptor sets are limited by the per-stage counts
+    auto limits = physicalDevice.getProperties().limits;
+    descriptorLimits.updateAfterBind = false;
+    descriptorLimits.maxTextures = std::min(limits.maxPerStageDescriptorSampledImages, limits.maxDescriptorSetSampledImages);
+    descriptorLimits.maxBuffers = std::min(limits.maxPerStageDescriptorStorageBuffers, limits.maxDescriptorSetStorageBuffers);
+
+#ifdef VK_EXT_descriptor_indexing
+    // Bindless needs runtime sized, partially bound arrays that can be written while bound
+    VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexingFeatures = {};
+    indexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+    if (config.bindless && hasProperties2 && hasExtension(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME))
+    {
+        auto getFeatures2 = (PFN_vkGetPhysicalDeviceFeatures2KHR)vkGetInstanceProcAddr((VkInstance)instance, "vkGetPhysicalDeviceFeatures2KHR");
+        auto getProperties2 = (PFN_vkGetPhysicalDeviceProperties2KHR)vkGetInstanceProcAddr((VkInstance)instance, "vkGetPhysicalDeviceProperties2KHR");
+
+        VkPhysicalDeviceFeatures2KHR features2 = {};
+        features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+        features2.pNext = &indexingFeatures;
+        if (getFeatures2 && getProperties2)
+            getFeatures2((VkPhysicalDevice)physicalDevice, &features2);
+
+        if (indexingFeatures.runtimeDescriptorArray &&
+            indexingFeatures.descriptorBindingPartiallyBound &&
+            indexingFeatures.descriptorBindingSampledImageUpdateAfterBind &&
+            indexingFeatures.descriptorBindingStorageBufferUpdateAfterBind &&
+            indexingFeatures.shaderSampledImageArrayNonUniformIndexing)
+        {
+            VkPhysicalDeviceDescriptorIndexingPropertiesEXT indexingProperties = {};
+            indexingProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT;
+            VkPhysicalDeviceProperties2KHR properties2 = {};
+            properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR;
+            properties2.pNext = &indexingProperties;
+            getProperties2((VkPhysicalDevice)physicalDevice, &properties2);
+
+            descriptorLimits.updateAfterBind = true;
+            descriptorLimits.maxTextures = std::min(
+                indexingProperties.maxPerStageDescriptorUpdateAfterBindSampledImages,
+                indexingProperties.maxDescriptorSetUpdateAfterBindSampledImages
+            );
+            descriptorLimits.maxBuffers = std::min(
+                indexingProperties.maxPerStageDescriptorUpdateAfterBindStorageBuffers,
+                indexingProperties.maxDescriptorSetUpdateAfterBindStorageBuffers
+            );
+            extensions.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+        }
+    }
+#endif
+    Log(std::string{ "Descriptors use " } + (descriptorLimits.updateAfterBind ? "one bindless set" : "classic sets per frame"));
+
+    // Set up the device info
+    auto devInfo = vk::DeviceCreateInfo()
+        .setQueueCreateInfoCount((uint32_t)devQueueInfos.size())
+        .setPQueueCreateInfos(devQueueInfos.data())
+        .setEnabledExtensionCount((uint32_t)extensions.size())
+        .setPpEnabledExtensionNames(extensions.data())
+        .setPEnabledFeatures(&enabledFeatures);
+#ifdef VK_EXT_descriptor_indexing
+    // Every supported indexing feature is turned on, shaders may use more than the heap needs
+    if (descriptorLimits.updateAfterBind)
+        devInfo.setPNext(&indexingFeatures);
+#endif
+
+    // Create the device
+    device = physicalDevice.createDevice(devInfo);
+    queue = device.getQueue(queueIndex, 0);
+    computeQueue = device.getQueue(computeQueueIndex, 0);
+    transferQueue = transferQueueIndex != computeQueueIndex || computeQueueIndex == queueIndex
+        ? device.getQueue(transferQueueIndex, 0)
+        : device.getQueue(transferQueueIndex, std::min(1u, queueProperties[transferQueueIndex].queueCount - 1));
+    allocator.Init(physicalDevice, device);
+
+    if (config.gpuProfiling)
+    {
+        profiler.Init(
+            device,
+            physicalDevice.getProperties().limits.timestampPeriod,
+            queueProperties[queueIndex].timestampValidBits,
+            config.framesInFlight + 1
+        );
+    }
+
+    // Get the color format to use
+    if (config.headless)
+    {
+        colorFormat = vk::Format::eB8G8R8A8Unorm;
+        colorSpace = vk::ColorSpaceKHR::eSrgbNonlinear;
+        presentState = ImageState::TransferSrc();
+    }
+    else
+    {
+        auto surfaceFormats = physicalDevice.getSurfaceFormatsKHR(surface);
+        if (surfaceFormats.size() == 1 && surfaceFormats[0].format == vk::Format::eUndefined)
+            colorFormat = vk::Format::eB8G8R8A8Unorm;
+        else
+            colorFormat = surfaceFormats[0].format;
+        colorSpace = surfaceFormats[0].colorSpace;
+        presentState = ImageState::Present();
+    }
+}
+
+void VkApp::InitWindow()
+{
+    if (config.headless)
+    {
+        // Still a window, so events can be injected the same way the OS sends them
+        window = std::make_unique<HeadlessWindow>(config.width, config.height);
+    }
+    else
+    {
+#ifdef _WIN32
+        // Messages go to the thread that made the window, so this runs on the main thread
+        window = std::make_unique<Win32Window>();
+#else
+        throw std::runtime_error{ "Windowed mode is only supported on Windows, use headless mode" };
+#endif
+    }
+
+    uint32_t width, height;
+    window->GetClientSize(width, height);
+    clientWidth = (int32_t)width;
+    clientHeight = (int32_t)height;
+}
+
+void VkApp::InitSurface()
+{
+    if (config.headless)
+        return;
+
+#ifdef _WIN32
+    auto win32 = static_cast<Win32Window *>(window.get());
+    auto surfaceInfo = vk::Win32SurfaceCreateInfoKHR()
+        .setHinstance(win32->GetHInst())
+        .setHwnd(win32->GetHandle());
+
+    // Create a surface for the window
+    surface = instance.createWin32SurfaceKHR(surfaceInfo);
+#endif
+}
+
+void VkApp::InitCommandPool()
+{
+    auto poolInfo = vk::CommandPoolCreateInfo()
+        .setQueueFamilyIndex(queueIndex)
+        .setFlags(vk::CommandPoolCreateFlagBits::eResetCommandBuffer);
+
+    commandPool = device.createCommandPool(poolInfo);
+
+    uploads.Init(device, queue, queueIndex, &allocator);
+    transfers.Init(device, transferQueue, transferQueueIndex, &allocator, queueIndex);
+}
+
+void VkApp::InitWorkerCommands()
+{
+    // Command pools aren't thread safe, so every thread gets its own for each
+    // frame in flight. They are reset as a whole once the frame's fence signals.
+    auto poolInfo = vk::CommandPoolCreateInfo()
+        .setQueueFamilyIndex(queueIndex)
+        .setFlags(vk::CommandPoolCreateFlagBits::eTransient);
+
+    workerCommands.resize(config.framesInFlight);
+    for (auto &frame : workerCommands)
+    {
+        frame.resize(jobs->GetThreadCount());
+        for (auto &commands : frame)
+        {
+            commands.pool = device.createCommandPool(poolInfo);
+            commands.used = 0;
+        }
+    }
+}
+
+void VkApp::InitSwapChain()
+{
+    if (config.headless)
+    {
+        InitOffscreenTargets();
+        swapTransferSrc = true;
+        return;
+    }
+
+    auto oldSwap = swapChain;
+    auto surfaceCaps = physicalDevice.getSurfaceCapabilitiesKHR(surface).value;
+    auto presentModes = physicalDevice.getSurfacePresentModesKHR(surface);
+
+    // Figure out the extent of the surface to use
+    vk::Extent2D swapExtent;
+    if (surfaceCaps.currentExtent.width == -1)
+    {
+        swapExtent.width = clientWidth;
+        swapExtent.height = clientHeight;
+    }
+    else
+    {
+        clientWidth = swapExtent.width = surfaceCaps.currentExtent.width;
+        clientHeight = swapExtent.height = surfaceCaps.currentExtent.height;
+    }
+
+    // Prefer Mailbox -> FifoRelaxed -> Fifo
+    vk::PresentModeKHR swapchainPresentMode = vk::PresentModeKHR::eFifo;
+    for (auto mode : presentModes)
+    {
+        if (mode == vk::PresentModeKHR::eMailbox)
+        {
+            swapchainPresentMode = vk::PresentModeKHR::eMailbox;
+            break;
+        }
+        else if (mode == vk::PresentModeKHR::eFifoRelaxed)
+        {
+            swapchainPresentMode = vk::PresentModeKHR::eFifoRelaxed;
+        }
+    }
+
+    uint32_t desiredImages = surfaceCaps.minImageCount + 1;
+    if (surfaceCaps.maxImageCount > 0 && desiredImages > surfaceCaps.maxImageCount)
+        desiredImages = surfaceCaps.maxImageCount;
+
+    auto preTransform = surfaceCaps.currentTransform;
+    if (surfaceCaps.supportedTransforms & vk::SurfaceTransformFlagBitsKHR::eIdentity)
+        preTransform = vk::SurfaceTransformFlagBitsKHR::eIdentity;
+
+    // Copying out of the images is only needed for capturing, so it's optional
+    vk::ImageUsageFlags usage = vk::ImageUsageFlagBits::eColorAttachment;
+    swapTransferSrc = (bool)(surfaceCaps.supportedUsageFlags & vk::ImageUsageFlagBits::eTransferSrc);
+    if (swapTransferSrc)
+        usage |= vk::ImageUsageFlagBits::eTransferSrc;
+
+    auto swapInfo = vk::SwapchainCreateInfoKHR()
+        .setSurface(surface)
+        .setMinImageCount(desiredImages)
+        .setImageFormat(colorFormat)
+        .setImageColorSpace(colorSpace)
+        .setImageExtent(swapExtent)
+        .setImageUsage(usage)
+        .setPreTransform(preTransform)
+        .setImageArrayLayers(1)
+        .setImageSharingMode(vk::SharingMode::eExclusive)
+        .setPresentMode(swapchainPresentMode)
+        .setOldSwapchain(oldSwap)
+        .setClipped(true)
+        .setCompositeAlpha(vk::CompositeAlphaFlagBitsKHR::eOpaque);
+
+    swapChain = device.createSwapchainKHR(swapInfo);
+
+    // The old swap chain is retired rather than destroyed, frames in flight may still use its views
+    if (oldSwap)
+    {
+        RetiredResources old;
+        old.frame = frameCount;
+        old.swapChain = oldSwap;
+        for (auto &buffer : swapBuffers)
+        {
+            layouts.Unregister(buffer.image);
+            old.views.push_back(buffer.view);
+            buffer.view = nullptr;
+        }
+        retired.push_back(std::move(old));
+    }
+
+    auto images = device.getSwapchainImagesKHR(swapChain);
+
+    swapBuffers.resize(images.size());
+    for (uint32_t i = 0; i < images.size(); ++i)
+    {
+        auto image = images[i];
+        auto viewInfo = vk::ImageViewCreateInfo()
+            .setFormat(colorFormat)
+            .setComponents({
+                vk::ComponentSwizzle::eR,
+                vk::ComponentSwizzle::eG,
+                vk::ComponentSwizzle::eB,
+                vk::ComponentSwizzle::eA,
+        })
+        .setSubresourceRange(vk::ImageSubresourceRange()
+            .setAspectMask(vk::ImageAspectFlagBits::eColor)
+            .setLevelCount(1)
+            .setLayerCount(1))
+        .setViewType(vk::ImageViewType::e2D)
+        .setImage(image);
+
+        // Swap chain images can't be touched before they're acquired, so the first
+        // frame transitions them. Starting at color output chains the barrier to
+        // the acquire semaphore wait.
+        layouts.Register(
+            image,
+            vk::ImageAspectFlagBits::eColor,
+            ImageState(vk::ImageLayout::eUndefined, vk::AccessFlags(), vk::PipelineStageFlagBits::eColorAttachmentOutput)
+        );
+
+        swapBuffers[i].image = image;
+        swapBuffers[i].view = device.createImageView(viewInfo);
+    }
+}
+
+void VkApp::InitOffscreenTargets()
+{
+    // Offscreen images stand in for the swap chain, they are read back instead of presented
+    auto imageInfo = vk::ImageCreateInfo()
+        .setImageType(vk::ImageType::e2D)
+        .setFormat(colorFormat)
+        .setExtent({ (uint32_t)clientWidth, (uint32_t)clientHeight, 1 })
+        .setMipLevels(1)
+        .setArrayLayers(1)
+        .setSamples(vk::SampleCountFlagBits::e1)
+        .setTiling(vk::ImageTiling::eOptimal)
+        .setUsage(vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferSrc);
+
+    // On a resize frames in flight may still render to or read back the old
+    // images, so they're retired like an old swap chain
+    bool replacing = !swapBuffers.empty();
+    if (replacing)
+    {
+        RetiredResources old;
+        old.frame = frameCount;
+        for (auto &buffer : swapBuffers)
+            layouts.Unregister(buffer.image);
+        old.offscreenBuffers = std::move(swapBuffers);
+        retired.push_back(std::move(old));
+    }
+
+    swapBuffers.clear();
+    swapBuffers.resize(config.imageCount);
+    for (auto &buffer : swapBuffers)
+    {
+        buffer.image = device.createImage(imageInfo);
+        buffer.mem = allocator.AllocateImage(buffer.image, vk::MemoryPropertyFlagBits::eDeviceLocal);
+
+        // At startup the setup commands move them to where a presented image would be.
+        // New ones mid-run are left undefined for the graph's clear to take them from.
+        layouts.Register(buffer.image, vk::ImageAspectFlagBits::eColor);
+        if (!replacing)
+            layouts.Transition(buffer.image, presentState);
+
+        // Create the view
+        auto viewInfo = vk::ImageViewCreateInfo()
+            .setViewType(vk::ImageViewType::e2D)
+            .setFormat(colorFormat)
+            .setSubresourceRange(vk::ImageSubresourceRange()
+                .setAspectMask(vk::ImageAspectFlagBits::eColor)
+                .setLevelCount(1)
+                .setLayerCount(1))
+            .setImage(buffer.image);
+        buffer.view = device.createImageView(viewInfo);
+    }
+}
+
+void VkApp::InitCommandBuffers()
+{
+    // Allocate per-frame command buffers, the present barriers are recorded into them
+    auto allocateInfo = vk::CommandBufferAllocateInfo()
+        .setCommandPool(commandPool)
+        .setLevel(vk::CommandBufferLevel::ePrimary)
+        .setCommandBufferCount(config.framesInFlight);
+    drawCmdBuffers = device.allocateCommandBuffers(allocateInfo);
+}
+
+void VkApp::InitPipelineCache()
+{
+    // Seed the cache with the last run's data if it came from this exact device and driver
+    std::vector<uint8_t> data;
+    if (config.pipelineCachePath.empty() ||
+        !ReadFileBytes(config.pipelineCachePath, data) ||
+        !IsPipelineCacheCompatible(data))
+    {
+        data.clear();
+    }
+
+    auto cacheInfo = vk::PipelineCacheCreateInfo()
+        .setInitialDataSize(data.size())
+        .setPInitialData(data.data());
+
+    pipelineCache = device.createPipelineCache(cacheInfo);
+    pipelineCacheSavedSize = data.size();
+    pipelineCacheSaveTime = std::chrono::steady_clock::now();
+
+    pipelines.Init(device, pipelineCache, *jobs);
+}
+
+void VkApp::InitShaderLibrary()
+{
+    // Only the index is touched here, modules are made when pipelines ask for them
+    if (!config.shaderLibraryPath.empty() && shaders.Open(device, config.shaderLibraryPath))
+        Log("Shader library has " + std::to_string(shaders.GetShaderCount()) + " shaders");
+}
+
+void VkApp::InitAssetStreamer()
+{
+    assets.Init(
+        device,
+        &allocator,
+        &transfers,
+        config.streamingStagingSize,
+        config.streamingFrameBudget,
+        config.streamingThreads
+    );
+    if (!config.assetPackPath.empty() && assets.Open(config.assetPackPath))
+        Log("Asset pack has " + std::to_string(assets.GetAssetCount()) + " assets");
+}
+
+void VkApp::InitRenderGraph(RenderGraph *previousGraph, HiZBuffer *previousHiZ)
+{
+    std::vector<vk::Image> images;
+    std::vector<vk::ImageView> views;
+    for (auto &buffer : swapBuffers)
+    {
+        images.push_back(buffer.image);
+        views.push_back(buffer.view);
+    }
+
+    // Without occlusion culling depth is only needed inside the main pass, so the
+    // graph keeps it in lazily allocated memory and never stores it
+    auto extent = vk::Extent2D((uint32_t)clientWidth, (uint32_t)clientHeight);
+    renderGraph = std::make_unique<RenderGraph>(device, allocator, layouts, extent, previousGraph);
+    auto backBuffer = renderGraph->ImportImage("back buffer", colorFormat, images, views);
+    auto depth = renderGraph->CreateAttachment("depth", depthFormat);
+
+    // Without a shader this is a single far texel that never occludes anything
+    bool buildHiZ = config.occlusionCulling && depthSampled && culling.IsEnabled() && shaders.Contains("hiz.comp");
+    hiz = std::make_unique<HiZBuffer>(device, allocator, extent, buildHiZ ? shaders.GetModule("hiz.comp") : vk::ShaderModule(), pipelineCache, previousHiZ);
+
+    // Writes the indirect draws the main pass uses, so it has to come first
+    cullPass = renderGraph->AddPass("cull", [this](vk::CommandBuffer commandBuffer, const RenderPassContext &)
+    {
+        hiz->Prepare(commandBuffer);
+        culling.Cull(commandBuffer, frameIndex, frameData, descriptors, *hiz);
+    });
+
+    mainPass = renderGraph->AddPass("main pass", [this](vk::CommandBuffer commandBuffer, const RenderPassContext &context)
+    {
+        // Record the draw chunks in parallel, each into a secondary buffer from its thread's pool
+        std::vector<vk::CommandBuffer> secondaries(drawChunkCount);
+        auto inheritance = vk::CommandBufferInheritanceInfo()
+            .setRenderPass(context.renderPass)
+            .setSubpass(context.subpass)
+            .setFramebuffer(context.framebuffer);
+        jobs->ParallelFor(drawChunkCount, [&](uint32_t chunk, uint32_t thread)
+        {
+            auto secondary = GetSecondaryCmdBuffer(thread);
+            secondary.begin(vk::CommandBufferBeginInfo()
+                .setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit | vk::CommandBufferUsageFlagBits::eRenderPassContinue)
+                .setPInheritanceInfo(&inheritance));
+            drawRecorder(secondary, chunk);
+            secondary.end();
+            secondaries[chunk] = secondary;
+        });
+
+        // Then stitch them together in chunk order
+        if (!secondaries.empty())
+            commandBuffer.executeCommands(secondaries);
+    }, vk::SubpassContents::eSecondaryCommandBuffers);
+    renderGraph->WriteColor(mainPass, backBuffer, vk::ClearColorValue(std::array<float, 4>{ 0.0f, 0.0f, 0.0f, 1.0f }));
+    renderGraph->WriteDepth(mainPass, depth, vk::ClearDepthStencilValue(1.0f, 0));
+
+    // Reduce this frame's depth for the next frame's culling
+    if (hiz->IsEnabled())
+    {
+        hizPass = renderGraph->AddPass("hi-z", [this, depth](vk::CommandBuffer commandBuffer, const RenderPassContext &)
+        {
+            hiz->Build(commandBuffer, renderGraph->GetSampledView(depth), descriptors);
+        });
+        renderGraph->ReadTexture(hizPass, depth, vk::PipelineStageFlagBits::eComputeShader);
+    }
+
+    renderGraph->Compile();
+}
+
+void VkApp::InitFrameSync()
+{
+    // Fences start signaled so the first wait on each frame returns immediately
+    auto fenceInfo = vk::FenceCreateInfo()
+        .setFlags(vk::FenceCreateFlagBits::eSignaled);
+
+    frameSync.resize(config.framesInFlight);
+    for (auto &sync : frameSync)
+    {
+        sync.fence = device.createFence(fenceInfo);
+        sync.acquireSemaphore = device.createSemaphore(vk::SemaphoreCreateInfo());
+        sync.renderSemaphore = device.createSemaphore(vk::SemaphoreCreateInfo());
+    }
+
+    imageFences.assign(swapBuffers.size(), vk::Fence());
+}
+
+void VkApp::FreeSwapBuffers()
+{
+    if (!device)
+        return;
+
+    for (auto &buffer : swapBuffers)
+    {
+        if (buffer.view)
+            device.destroyImageView(buffer.view);
+
+        layouts.Unregister(buffer.image);
+
+        // Offscreen images are ours to destroy
+        if (buffer.mem.memory)
+        {
+            device.destroyImage(buffer.image);
+            allocator.Free(buffer.mem);
+        }
+    }
+    swapBuffers.clear();
+}
+
+void VkApp::FreeCommandBuffers()
+{
+    device.freeCommandBuffers(commandPool, drawCmdBuffers);
+}
+
+void VkApp::FreeWorkerCommands()
+{
+    if (!device)
+        return;
+
+    // Command buffers go away with their pools
+    for (auto &frame : workerCommands)
+    {
+        for (auto &commands : frame)
+            device.destroyCommandPool(commands.pool);
+    }
+    workerCommands.clear();
+}
+
+void VkApp::FreeFrameSync()
+{
+    if (!device)
+        return;
+
+    for (auto &sync : frameSync)
+    {
+        device.destroyFence(sync.fence);
+        device.destroySemaphore(sync.acquireSemaphore);
+        device.destroySemaphore(sync.renderSemaphore);
+        // Still owned by the transfer context, which destroys them with the rest
+        for (auto semaphore : sync.uploadSemaphores)
+            transfers.RecycleSemaphore(semaphore);
+    }
+    frameSync.clear();
+    imageFences.clear();
+}
+
+bool VkApp::Resize()
+{
+    resizePending = false;
+
+    // Nothing to render to while minimized. Offscreen images follow the size
+    // the window reports, the swap chain picks its own.
+    uint32_t width, height;
+    if (config.headless)
+    {
+        window->GetClientSize(width, height);
+    }
+    else
+    {
+        auto surfaceCaps = physicalDevice.getSurfaceCapabilitiesKHR(surface).value;
+        width = surfaceCaps.currentExtent.width;
+        height = surfaceCaps.currentExtent.height;
+    }
+    if (width == 0 || height == 0)
+    {
+        resizePending = true;
+        return false;
+    }
+    if (config.headless)
+    {
+        clientWidth = (int32_t)width;
+        clientHeight = (int32_t)height;
+    }
+
+    // Swap the size dependent resources out without waiting for the device,
+    // the old ones are destroyed once the frames using them complete. The new
+    // graph and pyramid take over their memory wherever it still fits, and the
+    // pyramid keeps its pipeline.
+    InitSwapChain();
+
+    auto &old = retired.back();
+    old.renderGraph = std::move(renderGraph);
+    old.hiz = std::move(hiz);
+    InitRenderGraph(old.renderGraph.get(), old.hiz.get());
+    imageFences.assign(swapBuffers.size(), vk::Fence());
+    return true;
+}
+
+void VkApp::ReleaseRetired(bool all)
+{
+    // After waiting on this slot's fence, every frame up to this one minus the
+    // frames in flight has completed
+    auto it = retired.begin();
+    while (it != retired.end())
+    {
+        if (!all && it->frame + config.framesInFlight > frameCount)
+        {
+            ++it;
+            continue;
+        }
+
+        // The graph's framebuffers use the old views, so it goes first
+        it->renderGraph.reset();
+        it->hiz.reset();
+        for (auto view : it->views)
+            device.destroyImageView(view);
+        for (auto &buffer : it->offscreenBuffers)
+        {
+            device.destroyImageView(buffer.view);
+            device.destroyImage(buffer.image);
+            allocator.Free(buffer.mem);
+        }
+        if (it->swapChain)
+            device.destroySwapchainKHR(it->swapChain);
+
+        it = retired.erase(it);
+    }
+}
+
+void VkApp::RenderThreadMain()
+{
+    // ParallelFor from this thread needs the owner's queue
+    jobs->TakeOwnership();
+
+    try
+    {
+        while (!stopRendering && !window->Closed())
+        {
+            uint64_t lastFrame = frameCount;
+            RenderFrame();
+
+            // Nothing to render to while minimized, don't spin on it
+            if (frameCount == lastFrame)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    catch (...)
+    {
+        Log("Render thread stopped on an error");
+        renderError = std::current_exception();
+    }
+}
+
+void VkApp::JoinRenderThread()
+{
+    if (!renderThread.joinable())
+        return;
+
+    stopRendering = true;
+    renderThread.join();
+    jobs->TakeOwnership();
+}
+
+void VkApp::HandleWindowEvents()
+{
+    WindowEvent event;
+    while (window->PollEvent(event))
+    {
+        if (eventHandler)
+            eventHandler(event);
+    }
+
+    // Only noted, a drag sends lots of resizes and they're all handled as one
+    // at the next frame boundary. The flag survives the event queue overflowing.
+    if (window->TakeResize())
+        resizePending = true;
+}
+
+bool VkApp::BeginFrame(uint32_t &imageIndex)
+{
+    auto &sync = frameSync[frameIndex];
+
+    // Only CPU data, so it overlaps with the GPU finishing the frame waited on below
+    scene.Update(*jobs);
+    scene.Cull(*jobs);
+
+    // Wait for the GPU to be done with the last frame that used this slot
+    device.waitForFences(sync.fence, true, UINT64_MAX);
+    // Readbacks recorded into that frame have landed
+    capture.FrameComplete(frameIndex);
+    ReleaseRetired(false);
+
+    // Setup timings only come back once, when its batch has finished on the GPU
+    if (setupResolvePending && uploads.IsComplete(setupTicket))
+    {
+        profiler.Resolve(config.framesInFlight);
+        setupResolvePending = false;
+    }
+
+    // Resizes are deferred to here so a burst of them only rebuilds once
+    if (resizePending && !Resize())
+        return false;
+
+    // Its waits on transfer uploads are done, so the semaphores can be signaled again
+    for (auto semaphore : sync.uploadSemaphores)
+        transfers.RecycleSemaphore(semaphore);
+    sync.uploadSemaphores.clear();
+    sync.uploadWaitStages = vk::PipelineStageFlags();
+
+    // The last frame to use this slot's region of the ring is done as well
+    frameData.BeginFrame(frameIndex);
+    descriptors.BeginFrame(frameIndex);
+
+    // Record copies for assets that finished reading and start reading more
+    assets.Update();
+
+    // Send off this frame's uploads so the graphics queue can acquire them below
+    transfers.Flush();
+    transfers.Retire();
+
+    // Get the next image to render to, rebuilding once if the swap chain went out of date
+    if (swapChain)
+    {
+        auto result = device.acquireNextImageKHR(swapChain, UINT64_MAX, sync.acquireSemaphore, nullptr, &imageIndex);
+        if (result == vk::Result::eErrorOutOfDateKHR)
+        {
+            if (!Resize())
+                return false;
+            result = device.acquireNextImageKHR(swapChain, UINT64_MAX, sync.acquireSemaphore, nullptr, &imageIndex);
+        }
+        if (result == vk::Result::eSuboptimalKHR)
+            resizePending = true;
+        else if (result != vk::Result::eSuccess)
+            return false;
+    }
+    else
+    {
+        imageIndex = (uint32_t)(frameCount % swapBuffers.size());
+    }
+
+    // There can be more images than frames in flight, so an older frame may still be using it
+    auto &imageFence = imageFences[imageIndex];
+    if (imageFence && imageFence != sync.fence)
+        device.waitForFences(imageFence, true, UINT64_MAX);
+    imageFence = sync.fence;
+
+    device.resetFences(sync.fence);
+
+    // Everything recorded on the workers for this slot is done too
+    for (auto &commands : workerCommands[frameIndex])
+    {
+        if (commands.used > 0)
+        {
+            device.resetCommandPool(commands.pool, vk::CommandPoolResetFlags());
+            commands.used = 0;
+        }
+    }
+
+    return true;
+}
+
+void VkApp::RecordFrame(vk::CommandBuffer commandBuffer, uint32_t imageIndex)
+{
+    auto image = swapBuffers[imageIndex].image;
+
+    commandBuffer.begin(vk::CommandBufferBeginInfo()
+        .setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+
+    // The slot's previous frame has passed its fence, so its timings can be read back
+    profiler.BeginSlot(commandBuffer, frameIndex, frameCount, "frame");
+    auto frameScope = profiler.BeginScope(commandBuffer, frameIndex, "frame");
+
+    // Take ownership of whatever the transfer queue finished uploading
+    QueueAcquire acquire;
+    transfers.TakeAcquires(acquire);
+    if (!acquire.bufferBarriers.empty() || !acquire.imageBarriers.empty())
+    {
+        commandBuffer.pipelineBarrier(
+            vk::PipelineStageFlagBits::eTopOfPipe,
+            acquire.dstStages,
+            vk::DependencyFlags(),
+            nullptr,
+            acquire.bufferBarriers,
+            acquire.imageBarriers
+        );
+
+        for (size_t i = 0; i < acquire.imageBarriers.size(); ++i)
+        {
+            auto &barrier = acquire.imageBarriers[i];
+            layouts.Register(barrier.image, barrier.subresourceRange.aspectMask, acquire.imageStates[i]);
+        }
+
+        auto &sync = frameSync[frameIndex];
+        sync.uploadSemaphores = std::move(acquire.semaphores);
+        sync.uploadWaitStages = acquire.dstStages;
+    }
+
+    // Batches have to be ready before the main pass hands out chunks of them
+    drawQueue.Sort(*jobs);
+
+    // The graph takes the image back from the presentation engine and runs the passes
+    renderGraph->Execute(commandBuffer, imageIndex, &profiler, frameIndex);
+    drawQueue.Clear();
+
+    // Copied out before the image goes back to the presentation engine. This is
+    // part of the frame's own submission, so nothing waits on it.
+    if (capture.IsRequested())
+    {
+        if (swapTransferSrc)
+            capture.Record(commandBuffer, layouts, image, colorFormat, { (uint32_t)clientWidth, (uint32_t)clientHeight }, frameIndex, frameCount);
+        else
+            capture.Skip("the swap chain images can't be copied from");
+    }
+
+    // Hand the image over for presenting
+    layouts.Transition(image, presentState);
+    layouts.Flush(commandBuffer);
+
+    profiler.EndScope(commandBuffer, frameIndex, frameScope);
+    commandBuffer.end();
+}
+
+void VkApp::EndFrame(uint32_t imageIndex)
+{
+    auto &sync = frameSync[frameIndex];
+
+    // The first barrier on the image starts at color output, so that's where we wait for it.
+    // Uploads only need to be waited on where they're first used.
+    std::vector<vk::Semaphore> waitSemaphores;
+    std::vector<vk::PipelineStageFlags> waitStages;
+    if (swapChain)
+    {
+        waitSemaphores.push_back(sync.acquireSemaphore);
+        waitStages.push_back(vk::PipelineStageFlagBits::eColorAttachmentOutput);
+    }
+    for (auto semaphore : sync.uploadSemaphores)
+    {
+        waitSemaphores.push_back(semaphore);
+        waitStages.push_back(sync.uploadWaitStages);
+    }
+
+    auto submitInfo = vk::SubmitInfo()
+        .setWaitSemaphoreCount((uint32_t)waitSemaphores.size())
+        .setPWaitSemaphores(waitSemaphores.data())
+        .setPWaitDstStageMask(waitStages.data())
+        .setCommandBufferCount(1)
+        .setPCommandBuffers(&drawCmdBuffers[frameIndex]);
+    if (swapChain)
+    {
+        submitInfo
+            .setSignalSemaphoreCount(1)
+            .setPSignalSemaphores(&sync.renderSemaphore);
+    }
+
+    // Whatever was written to the ring this frame has to be visible before the GPU reads it
+    frameData.Flush();
+
+    // The fence is only waited on when this slot comes around again
+    queue.submit(submitInfo, sync.fence);
+
+    if (swapChain)
+    {
+        auto presentInfo = vk::PresentInfoKHR()
+            .setWaitSemaphoreCount(1)
+            .setPWaitSemaphores(&sync.renderSemaphore)
+            .setSwapchainCount(1)
+            .setPSwapchains(&swapChain)
+            .setPImageIndices(&imageIndex);
+        auto result = queue.presentKHR(&presentInfo);
+        if (result == vk::Result::eErrorOutOfDateKHR || result == vk::Result::eSuboptimalKHR)
+            resizePending = true;
+    }
+
+    frameIndex = (frameIndex + 1) % config.framesInFlight;
+    ++frameCount;
+
+    // Recycle finished setup batches, this never waits
+    uploads.Retire();
+
+    // Save the pipeline cache every now and then so a crash doesn't lose it all
+    if (config.pipelineCacheSaveInterval > 0 && startupTasks.IsComplete(pipelineCacheTask))
+    {
+        std::chrono::duration<double> sinceSave = std::chrono::steady_clock::now() - pipelineCacheSaveTime;
+        if (sinceSave.count() >= config.pipelineCacheSaveInterval)
+            SavePipelineCache();
+    }
+}
+
+vk::CommandBuffer VkApp::GetSecondaryCmdBuffer(uint32_t thread)
+{
+    // Secondaries are kept across frames and reused after their pool is reset
+    auto &commands = workerCommands[frameIndex][thread];
+    if (commands.used == commands.secondaries.size())
+    {
+        auto allocateInfo = vk::CommandBufferAllocateInfo()
+            .setCommandPool(commands.pool)
+            .setLevel(vk::CommandBufferLevel::eSecondary)
+            .setCommandBufferCount(1);
+        commands.secondaries.push_back(device.allocateCommandBuffers(allocateInfo)[0]);
+    }
+    return commands.secondaries[commands.used++];
+}
+
+uint32_t VkApp::FindDedicatedQueue(vk::QueueFlags wanted, vk::QueueFlags unwanted)
+{
+    // Falls back to the graphics queue, which can do everything
+    auto queueProperties = physicalDevice.getQueueFamilyProperties();
+    for (uint32_t i = 0; i < queueProperties.size(); ++i)
+    {
+        auto flags = queueProperties[i].queueFlags;
+        if ((flags & wanted) == wanted && !(flags & unwanted))
+            return i;
+    }
+    return queueIndex;
+}
+
+uint32_t VkApp::FindQueue()
+{
+    // Find the first queue that supports graphics and presenting.
+    // Without a surface there is nothing to present to, so any graphics queue will do.
+    auto queueProperties = physicalDevice.getQueueFamilyProperties();
+    for (uint32_t i = 0; i < queueProperties.size(); ++i)
+    {
+        if (queueProperties[i].queueFlags & vk::QueueFlagBits::eGraphics)
+        {
+            if (!surface || physicalDevice.getSurfaceSupportKHR(i, surface))
+            {
+                return i;
+            }
+        }
+    }
+
+    throw std::runtime_error{ "Device does not support graphics and presenting in any queues" };
+}
+
+vk::Format VkApp::GetDepthFormat()
+{
+    // Prefer a format the Hi-Z pass can sample
+    auto sampledFeatures = vk::FormatFeatureFlagBits::eDepthStencilAttachment | vk::FormatFeatureFlagBits::eSampledImage;
+    for (auto format : DeviceSelector::GetDepthFormats())
+    {
+        auto formatProps = physicalDevice.getFormatProperties(format);
+        if ((formatProps.optimalTilingFeatures & sampledFeatures) == sampledFeatures)
+        {
+            depthSampled = true;
+            return format;
+        }
+    }
+
+    for (auto format : DeviceSelector::GetDepthFormats())
+    {
+        auto formatProps = physicalDevice.getFormatProperties(format);
+        if (formatProps.optimalTilingFeatures & vk::FormatFeatureFlagBits::eDepthStencilAttachment)
+        {
+            return format;
+        }
+    }
+
+    throw std::runtime_error{ "Device doesn't support any acceptable depth-stencil formats" };
+}
+
+uint32_t VkApp::GetMemoryType(uint32_t typeBits, vk::MemoryPropertyFlags flags)
+{
+    return allocator.GetMemoryType(typeBits, flags);
+}
+
+void VkApp::InitSetupCmd()
+{
+    FlushSetupCmd();
+    setupCmdBuffer = uploads.GetCommandBuffer();
+
+    // The setup slot can only be reused once the previous setup batch is done
+    auto setupSlot = config.framesInFlight;
+    setupScope = GpuProfiler::InvalidScope;
+    if (uploads.IsComplete(setupTicket))
+    {
+        profiler.BeginSlot(setupCmdBuffer, setupSlot, frameCount, "setup");
+        setupScope = profiler.BeginScope(setupCmdBuffer, setupSlot, "setup");
+    }
+}
+
+void VkApp::FlushSetupCmd()
+{
+    if (!setupCmdBuffer)
+        return;
+
+    // All transitions queued during setup go out as one barrier
+    layouts.Flush(setupCmdBuffer);
+    profiler.EndScope(setupCmdBuffer, config.framesInFlight, setupScope);
+
+    // Frames are submitted to the same queue afterwards, and the barriers that end
+    // the batch make its writes visible to them without anyone waiting on the CPU
+    setupTicket = uploads.Flush();
+    setupCmdBuffer = nullptr;
+    if (setupScope != GpuProfiler::InvalidScope)
+        setupResolvePending = true;
+}
+
+bool VkApp::IsPipelineCacheCompatible(const std::vector<uint8_t> &data)
+{
+    // Layout of VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+    struct CacheHeader
+    {
+        uint32_t length;
+        uint32_t version;
+        uint32_t vendorID;
+        uint32_t deviceID;
+        uint8_t uuid[VK_UUID_SIZE];
+    };
+
+    CacheHeader header;
+    if (data.size() < sizeof(header))
+        return false;
+    memcpy(&header, data.data(), sizeof(header));
+
+    auto props = physicalDevice.getProperties();
+    return header.length >= sizeof(header) &&
+        header.version == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+        header.vendorID == props.vendorID &&
+        header.deviceID == props.deviceID &&
+        memcmp(header.uuid, &props.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+void VkApp::SavePipelineCache()
+{
+    pipelineCacheSaveTime = std::chrono::steady_clock::now();
+    if (config.pipelineCachePath.empty())
+        return;
+
+    // The cache only grows, so an unchanged size means nothing new was compiled
+    auto data = device.getPipelineCacheData(pipelineCache);
+    if (data.size() == pipelineCacheSavedSize)
+        return;
+
+    if (WriteFileAtomic(config.pipelineCachePath, data.data(), data.size()))
+        pipelineCacheSavedSize = data.size();
+}
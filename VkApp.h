@@ -1,93 +1,348 @@
-#pragma once
-
-#ifdef _WIN32
-#define VK_USE_PLATFORM_WIN32_KHR
-#else
-// TODO: Non-windows
-#endif
-
-#include <vulkan/vk_cpp.h>
-#include <memory>
-#include <vector>
-
-class Window;
-
-struct SwapChainBuffer
-{
-    vk::Image image;
-    vk::ImageView view;
-};
-
-struct DepthStencilBuffer
-{
-    vk::Image image;
-    vk::ImageView view;
-    vk::DeviceMemory mem;
-};
-
-class VkApp
-{
-public:
-    VkApp();
-    ~VkApp();
-
-    Window *GetWindow();
-
-private:
-    // Init routines
-    void InitInstance();
-    void InitDevice();
-    void InitWindow();
-    void InitCommandPool();
-    void InitSwapChain();
-    void InitCommandBuffers();
-    void InitDepthStencil();
-    void InitRenderPass();
-    void InitPipelineCache();
-    void InitFrameBuffer();
-
-    // Free helpers
-    void FreeCommandBuffers();
-    void FreeDepthStencil();
-    void FreeFramebuffers();
-
-    // Helpers
-    uint32_t FindQueue();
-    vk::Format GetDepthFormat();
-    uint32_t GetMemoryType(uint32_t typeBits, vk::MemoryPropertyFlags flags);
-    void SetImageLayout(
-        vk::CommandBuffer commandBuffer,
-        vk::Image image,
-        vk::ImageAspectFlags aspectMask,
-        vk::ImageLayout oldLayout,
-        vk::ImageLayout newLayout
-    );
-    void InitSetupCmd();
-    void FlushSetupCmd();
-
-    std::unique_ptr<Window> window;
-    vk::Instance instance;
-    vk::PhysicalDevice physicalDevice;
-    vk::Device device;
-    vk::Queue queue;
-    vk::SurfaceKHR surface;
-    vk::Format colorFormat;
-    vk::ColorSpaceKHR colorSpace;
-    vk::Format depthFormat;
-    uint32_t queueIndex;
-
-    vk::CommandPool commandPool;
-    vk::CommandBuffer setupCmdBuffer;
-    vk::CommandBuffer prePresentCmdBuffer;
-    vk::CommandBuffer postPresentCmdBuffer;
-    std::vector<vk::CommandBuffer> drawCmdBuffers;
-    vk::PipelineCache pipelineCache;
-
-    vk::SwapchainKHR swapChain;
-    std::vector<SwapChainBuffer> swapBuffers;
-    DepthStencilBuffer depthStencil;
-    vk::RenderPass renderPass;
-    std::vector<vk::Framebuffer> frameBuffers;
-
-    int32_t clientWidth, clientHeight;
-};
+#pragma once
+
+#ifdef _WIN32
+#define VK_USE_PLATFORM_WIN32_KHR
+#else
+// TODO: Non-windows
+#endif
+
+#include "AssetStreamer.h"
+#include "DescriptorHeap.h"
+#include "DrawQueue.h"
+#include "FrameCapture.h"
+#include "FrameRingBuffer.h"
+#include "GpuCulling.h"
+#include "GpuProfiler.h"
+#include "HiZBuffer.h"
+#include "JobSystem.h"
+#include "LayoutTracker.h"
+#include "MemoryAllocator.h"
+#include "PipelineCompiler.h"
+#include "RenderGraph.h"
+#include "Scene.h"
+#include "ShaderLibrary.h"
+#include "StageTimer.h"
+#include "TaskGraph.h"
+#include "UploadContext.h"
+#include "Window.h"
+#include <vulkan/vk_cpp.h>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct VkAppConfig
+{
+    // Render into a ring of offscreen images instead of a window surface
+    bool headless = false;
+    // Size of the offscreen images (windowed mode uses the client area)
+    uint32_t width = 1280;
+    uint32_t height = 720;
+    // Number of offscreen images in the ring
+    uint32_t imageCount = 3;
+    // Device index or part of its name, empty to pick the best one. VKAPP_DEVICE overrides this.
+    std::string deviceOverride;
+    // Number of frames the CPU may record ahead of the GPU
+    uint32_t framesInFlight = 2;
+    // Time passes on the GPU with timestamp queries
+    bool gpuProfiling = true;
+    // Threads recording command buffers besides the main thread, 0 for one per core
+    uint32_t workerThreads = 0;
+    // Where the pipeline cache is kept between runs, empty to disable
+    std::string pipelineCachePath = "pipeline-cache.bin";
+    // Seconds between pipeline cache saves while running, 0 to only save on shutdown
+    double pipelineCacheSaveInterval = 300.0;
+    // Packed SPIR-V library, see ShaderLibrary::Pack. Empty or missing means no shaders.
+    std::string shaderLibraryPath = "shaders.bin";
+    // Bytes of mapped per-frame data (constants, dynamic vertices) each frame in flight gets
+    uint32_t frameDataSize = 4 * 1024 * 1024;
+    // One update-after-bind descriptor set for everything when the device supports it
+    bool bindless = true;
+    // Slots in the descriptor heap, clamped to what the device allows
+    uint32_t descriptorTextures = 16384;
+    uint32_t descriptorBuffers = 4096;
+    // Packed meshes and textures streamed in while rendering, empty or missing means none
+    std::string assetPackPath = "assets.bin";
+    // Fixed staging memory assets are read into before the transfer queue copies them
+    uint32_t streamingStagingSize = 32 * 1024 * 1024;
+    // Bytes of assets started per frame, at least one asset always starts
+    uint32_t streamingFrameBudget = 8 * 1024 * 1024;
+    uint32_t streamingThreads = 1;
+    // Test instances against a depth pyramid of the last frame before drawing them
+    bool occlusionCulling = true;
+    // Draw items the draw queue holds per frame
+    uint32_t maxDrawItems = 256 * 1024;
+    // Scene nodes to make room for up front
+    uint32_t sceneNodes = 64 * 1024;
+    // Frames captured from the start, more can be requested through GetCapture
+    uint32_t captureFrames = 0;
+    // Readback buffers, a frame is skipped when all of them are waiting to be written
+    uint32_t captureBuffers = 3;
+    // Captured files are named from this and the frame number
+    std::string capturePath = "capture-";
+    CaptureFormat captureFormat = CaptureFormat::Png;
+};
+
+struct SwapChainBuffer
+{
+    vk::Image image;
+    vk::ImageView view;
+    // Only set for offscreen images, swap chain images are owned by the swap chain
+    Allocation mem;
+};
+
+struct DeviceQueue
+{
+    vk::Queue queue;
+    uint32_t family;
+};
+
+struct FrameSync
+{
+    // Signaled when the GPU has finished with this frame's command buffer
+    vk::Fence fence;
+    vk::Semaphore acquireSemaphore;
+    vk::Semaphore renderSemaphore;
+    // Transfer queue uploads this frame waited on before acquiring them
+    std::vector<vk::Semaphore> uploadSemaphores;
+    vk::PipelineStageFlags uploadWaitStages;
+};
+
+struct WorkerCommands
+{
+    // Transient pool owned by one thread for one frame in flight
+    vk::CommandPool pool;
+    std::vector<vk::CommandBuffer> secondaries;
+    uint32_t used;
+};
+
+// Resources replaced by a resize that in-flight frames may still be using
+struct RetiredResources
+{
+    // First frame that no longer uses them
+    uint64_t frame;
+    vk::SwapchainKHR swapChain;
+    std::vector<vk::ImageView> views;
+    // Offscreen images replaced by a headless resize, with their views and memory
+    std::vector<SwapChainBuffer> offscreenBuffers;
+    std::unique_ptr<RenderGraph> renderGraph;
+    std::unique_ptr<HiZBuffer> hiz;
+};
+
+class VkApp
+{
+public:
+    // Records one chunk of the frame's draws into a secondary command buffer
+    // that continues the main render pass. Called on worker threads.
+    typedef std::function<void(vk::CommandBuffer commandBuffer, uint32_t chunk)> DrawRecorder;
+    // Called for every window event on the thread rendering frames
+    typedef std::function<void(const WindowEvent &event)> EventHandler;
+    // Called on the thread rendering frames at the start of every frame, after
+    // its window events and before the scene, draw queue and culling are used.
+    // This is where those get filled, nothing else may touch them while rendering.
+    typedef std::function<void(uint64_t frame)> FrameHandler;
+
+    VkApp(const VkAppConfig &config = VkAppConfig());
+    ~VkApp();
+
+    Window *GetWindow();
+
+    // Handle the window's events and run the frame handler, then record and
+    // submit the next frame. Only blocks when all frames are in flight.
+    void RenderFrame();
+    // Render frames on a thread of their own until the window closes, leaving
+    // the calling thread to pump the window's events
+    void StartRendering();
+    // Rethrows whatever stopped the render thread early
+    void StopRendering();
+    // Set these before rendering starts
+    void SetEventHandler(EventHandler handler);
+    void SetFrameHandler(FrameHandler handler);
+    // Frames submitted so far, safe to read from any thread
+    uint64_t GetFrameCount();
+    AllocationStats GetMemoryStats();
+    JobSystem &GetJobs();
+
+    // Compute and transfer fall back to the graphics queue without dedicated families
+    DeviceQueue GetGraphicsQueue();
+    DeviceQueue GetComputeQueue();
+    DeviceQueue GetTransferQueue();
+    // Uploads on the transfer queue, handed over to the graphics queue at the next frame
+    UploadContext &GetTransfers();
+    GpuProfiler &GetProfiler();
+    // CPU time spent in each stage of startup, background stages show up once they finish
+    const StageTimer &GetStartupTimer();
+    // Startup returns before the pipeline cache has loaded, this waits for it
+    vk::PipelineCache GetPipelineCache();
+    // Compiles against the pipeline cache, so this waits for it the same way
+    PipelineCompiler &GetPipelines();
+    // Where the draw recorder runs, a resize swaps in a compatible render pass
+    vk::RenderPass GetRenderPass();
+    uint32_t GetSubpass();
+    ShaderLibrary &GetShaders();
+    // Scratch memory for the frame being recorded, valid until the frame completes
+    FrameRingBuffer &GetFrameData();
+    // Textures and buffers shaders index by handle
+    DescriptorHeap &GetDescriptors();
+    AssetStreamer &GetAssets();
+    // Culled on the GPU before the main pass, draw groups with it from the draw recorder.
+    // Change instances from the frame handler.
+    GpuCulling &GetCulling();
+    // Fill it from the frame handler, it is sorted into batches before the frame
+    // is recorded and emptied afterwards. Record its batches from the draw recorder.
+    DrawQueue &GetDrawQueue();
+    // Updated and culled right after the frame handler, the draw recorder draws
+    // its visible list
+    Scene &GetScene();
+    // Rendered images are read back without stalling and written on a thread of its own
+    FrameCapture &GetCapture();
+    // Wait for the startup work that continues in the background
+    void WaitForStartup();
+
+    // Draws are split into chunks that are recorded in parallel every frame
+    void SetDrawRecorder(uint32_t chunkCount, DrawRecorder recorder);
+
+private:
+    // Init routines
+    void InitInstance();
+    void InitDevice();
+    void InitWindow();
+    void InitSurface();
+    void InitCommandPool();
+    void InitWorkerCommands();
+    void InitSwapChain();
+    void InitOffscreenTargets();
+    void InitCommandBuffers();
+    void InitPipelineCache();
+    void InitShaderLibrary();
+    void InitAssetStreamer();
+    // When resizing, the graph and pyramid being replaced hand over their memory
+    void InitRenderGraph(RenderGraph *previousGraph = nullptr, HiZBuffer *previousHiZ = nullptr);
+    void InitFrameSync();
+
+    // Free helpers
+    void FreeSwapBuffers();
+    void FreeCommandBuffers();
+    void FreeWorkerCommands();
+    void FreeFrameSync();
+
+    // Resizing
+    bool Resize();
+    void ReleaseRetired(bool all);
+
+    // Frame loop
+    void RenderThreadMain();
+    void JoinRenderThread();
+    void HandleWindowEvents();
+    bool BeginFrame(uint32_t &imageIndex);
+    void RecordFrame(vk::CommandBuffer commandBuffer, uint32_t imageIndex);
+    void EndFrame(uint32_t imageIndex);
+
+    // Helpers
+    vk::CommandBuffer GetSecondaryCmdBuffer(uint32_t thread);
+    uint32_t FindQueue();
+    uint32_t FindDedicatedQueue(vk::QueueFlags wanted, vk::QueueFlags unwanted);
+    vk::Format GetDepthFormat();
+    uint32_t GetMemoryType(uint32_t typeBits, vk::MemoryPropertyFlags flags);
+    void InitSetupCmd();
+    void FlushSetupCmd();
+    bool IsPipelineCacheCompatible(const std::vector<uint8_t> &data);
+    void SavePipelineCache();
+
+    VkAppConfig config;
+    StageTimer startup;
+    std::unique_ptr<JobSystem> jobs;
+    // Destroyed before the job system, background tasks may still be running on it
+    TaskGraph startupTasks;
+    TaskId pipelineCacheTask;
+    std::unique_ptr<Window> window;
+    vk::Instance instance;
+    vk::PhysicalDevice physicalDevice;
+    vk::Device device;
+    MemoryAllocator allocator;
+    vk::Queue queue;
+    vk::Queue computeQueue;
+    vk::Queue transferQueue;
+    vk::SurfaceKHR surface;
+    vk::Format colorFormat;
+    vk::ColorSpaceKHR colorSpace;
+    vk::Format depthFormat;
+    // The depth format can be sampled, which building the Hi-Z pyramid needs
+    bool depthSampled;
+    // Swap chain images can be copied from, which capturing them needs
+    bool swapTransferSrc;
+    // Where images are left at the end of a frame
+    ImageState presentState;
+    uint32_t queueIndex;
+    uint32_t computeQueueIndex;
+    uint32_t transferQueueIndex;
+
+    vk::CommandPool commandPool;
+    // Setup work is batched in the upload context and submitted without stalling the queue
+    UploadContext uploads;
+    vk::CommandBuffer setupCmdBuffer;
+    UploadTicket setupTicket;
+    UploadContext transfers;
+    LayoutTracker layouts;
+    // One profiler slot per frame in flight plus one for setup work
+    GpuProfiler profiler;
+    uint32_t setupScope;
+    // The setup slot isn't reused every frame, so frames resolve it once its batch completes
+    std::atomic<bool> setupResolvePending;
+    // One per frame in flight, re-recorded every frame
+    std::vector<vk::CommandBuffer> drawCmdBuffers;
+    // Per frame in flight, per thread
+    std::vector<std::vector<WorkerCommands>> workerCommands;
+    uint32_t drawChunkCount;
+    DrawRecorder drawRecorder;
+    vk::PipelineCache pipelineCache;
+    PipelineCompiler pipelines;
+    ShaderLibrary shaders;
+    FrameRingBuffer frameData;
+    // Filled in when the device is created
+    DescriptorHeapLimits descriptorLimits;
+    DescriptorHeap descriptors;
+    AssetStreamer assets;
+    // Filled in when the device is created
+    GpuCullingFeatures cullingFeatures;
+    GpuCulling culling;
+    DrawQueue drawQueue;
+    Scene scene;
+    FrameCapture capture;
+    // VK_KHR_get_physical_device_properties2, needed to query descriptor indexing
+    bool hasProperties2;
+    size_t pipelineCacheSavedSize;
+    std::chrono::steady_clock::time_point pipelineCacheSaveTime;
+
+    vk::SwapchainKHR swapChain;
+    std::vector<SwapChainBuffer> swapBuffers;
+    // Rebuilt on resize, everything is sized to the swap chain
+    std::unique_ptr<RenderGraph> renderGraph;
+    // Built from the graph's depth, so it's replaced along with the graph
+    std::unique_ptr<HiZBuffer> hiz;
+    RenderPassId cullPass;
+    RenderPassId mainPass;
+    RenderPassId hizPass;
+    std::vector<RetiredResources> retired;
+    // Set by resize events, handled once at the start of the next frame
+    bool resizePending;
+
+    std::thread renderThread;
+    std::atomic<bool> stopRendering;
+    std::exception_ptr renderError;
+    EventHandler eventHandler;
+    FrameHandler frameHandler;
+
+    std::vector<FrameSync> frameSync;
+    // Fence of the frame that last rendered to each swap buffer
+    std::vector<vk::Fence> imageFences;
+    uint32_t frameIndex;
+    // Only the rendering thread writes it
+    std::atomic<uint64_t> frameCount;
+
+    int32_t clientWidth, clientHeight;
+};
@@ -0,0 +1,170 @@
+#include "Win32Window.h"
+
+#ifdef _WIN32
+
+#define WINDOW_CLASS (L"CnnrsVulkanRendererWindow")
+
+Win32Window::Win32Window()
+{
+    hinst = (HINSTANCE)GetModuleHandleW(nullptr);
+
+    WNDCLASSEXW wndc = { sizeof(wndc) };
+    wndc.lpszClassName = WINDOW_CLASS;
+    wndc.cbWndExtra = sizeof(Win32Window *);
+    wndc.lpfnWndProc = WinProc;
+    RegisterClassExW(&wndc);
+
+    hwnd = CreateWindowExW(
+        0U, WINDOW_CLASS, L"Cnnr's Vulkan Renderer", WS_OVERLAPPEDWINDOW,
+        CW_USEDEFAULT, CW_USEDEFAULT, CW_USEDEFAULT, CW_USEDEFAULT,
+        nullptr, nullptr, hinst, this
+    );
+
+    ShowWindow(hwnd, SW_SHOW);
+}
+
+Win32Window::~Win32Window()
+{
+    DestroyWindow(hwnd);
+    UnregisterClassW(WINDOW_CLASS, hinst);
+}
+
+bool Win32Window::PumpEvents(bool wait)
+{
+    // Every window on the thread, a filter on our handle would leave WM_QUIT and
+    // thread messages queued forever
+    MSG msg;
+    if (wait)
+    {
+        if (GetMessageW(&msg, nullptr, 0, 0) <= 0)
+            return false;
+        TranslateMessage(&msg);
+        DispatchMessageW(&msg);
+    }
+
+    while (PeekMessageW(&msg, nullptr, 0, 0, PM_REMOVE))
+    {
+        if (msg.message == WM_QUIT)
+            return false;
+        TranslateMessage(&msg);
+        DispatchMessageW(&msg);
+    }
+
+    return !Closed();
+}
+
+void Win32Window::GetClientSize(uint32_t &width, uint32_t &height) const
+{
+    RECT rect;
+    GetClientRect(hwnd, &rect);
+    width = (uint32_t)(rect.right - rect.left);
+    height = (uint32_t)(rect.bottom - rect.top);
+}
+
+HWND Win32Window::GetHandle()
+{
+    return hwnd;
+}
+
+HINSTANCE Win32Window::GetHInst()
+{
+    return hinst;
+}
+
+void Win32Window::Translate(UINT msg, WPARAM wp, LPARAM lp)
+{
+    WindowEvent event = {};
+    // Client coordinates are signed, they go negative while the mouse is captured
+    event.x = (int16_t)LOWORD(lp);
+    event.y = (int16_t)HIWORD(lp);
+
+    switch (msg)
+    {
+        case WM_CLOSE:
+            event = { WindowEventType::Close };
+            break;
+
+        // A drag sends lots of these, the render thread only acts on the last one
+        case WM_SIZE:
+            event.type = WindowEventType::Resize;
+            event.x = LOWORD(lp);
+            event.y = HIWORD(lp);
+            break;
+
+        case WM_KEYDOWN:
+        case WM_SYSKEYDOWN:
+            event = { WindowEventType::KeyDown, (int32_t)wp };
+            break;
+
+        case WM_KEYUP:
+        case WM_SYSKEYUP:
+            event = { WindowEventType::KeyUp, (int32_t)wp };
+            break;
+
+        case WM_MOUSEMOVE:
+            event.type = WindowEventType::MouseMove;
+            break;
+
+        case WM_LBUTTONDOWN:
+        case WM_RBUTTONDOWN:
+        case WM_MBUTTONDOWN:
+            event.type = WindowEventType::MouseDown;
+            event.code = msg == WM_LBUTTONDOWN ? 0 : msg == WM_RBUTTONDOWN ? 1 : 2;
+            break;
+
+        case WM_LBUTTONUP:
+        case WM_RBUTTONUP:
+        case WM_MBUTTONUP:
+            event.type = WindowEventType::MouseUp;
+            event.code = msg == WM_LBUTTONUP ? 0 : msg == WM_RBUTTONUP ? 1 : 2;
+            break;
+
+        case WM_MOUSEWHEEL:
+        {
+            // The wheel reports screen coordinates
+            POINT point = { event.x, event.y };
+            ScreenToClient(hwnd, &point);
+            event = { WindowEventType::MouseWheel, GET_WHEEL_DELTA_WPARAM(wp), (int32_t)point.x, (int32_t)point.y };
+            break;
+        }
+
+        case WM_SETFOCUS:
+        case WM_KILLFOCUS:
+            event = { WindowEventType::Focus, msg == WM_SETFOCUS ? 1 : 0 };
+            break;
+
+        default:
+            return;
+    }
+
+    PushEvent(event);
+}
+
+LRESULT WINAPI Win32Window::WinProc(HWND hwnd, UINT msg, WPARAM wp, LPARAM lp)
+{
+    if (msg == WM_CREATE)
+    {
+        auto createInfo = (CREATESTRUCTW *)lp;
+        SetWindowLongPtrW(hwnd, GWLP_USERDATA, (LONG_PTR)createInfo->lpCreateParams);
+        return 0;
+    }
+
+    auto window = (Win32Window *)GetWindowLongPtrW(hwnd, GWLP_USERDATA);
+    if (!window)
+        return DefWindowProcW(hwnd, msg, wp, lp);
+
+    window->Translate(msg, wp, lp);
+
+    // The window stays up until its owner is done rendering to it, closing only
+    // ends the message loop
+    if (msg == WM_CLOSE)
+    {
+        window->closed.store(true, std::memory_order_release);
+        PostQuitMessage(0);
+        return 0;
+    }
+
+    return DefWindowProcW(hwnd, msg, wp, lp);
+}
+
+#endif
@@ -0,0 +1,29 @@
+#pragma once
+
+#ifdef _WIN32
+
+#include "Window.h"
+#include <Windows.h>
+
+class Win32Window : public Window
+{
+public:
+    Win32Window();
+    ~Win32Window();
+
+    bool PumpEvents(bool wait) override;
+    void GetClientSize(uint32_t &width, uint32_t &height) const override;
+
+    HWND GetHandle();
+    HINSTANCE GetHInst();
+
+private:
+    static LRESULT WINAPI WinProc(HWND hwnd, UINT msg, WPARAM wp, LPARAM lp);
+    // Queue an event for the messages the render thread cares about
+    void Translate(UINT msg, WPARAM wp, LPARAM lp);
+
+    HINSTANCE hinst;
+    HWND hwnd;
+};
+
+#endif
@@ -1,29 +1,64 @@
-#pragma once
-
-#include <Windows.h>
-#include <functional>
-#include <unordered_map>
-
-typedef LRESULT (WndCallback)(HWND hwnd, UINT msg, WPARAM wp, LPARAM lp);
-
-class Window
-{
-public:
-    Window();
-    ~Window();
-
-    HWND GetHandle();
-    HINSTANCE GetHInst();
-    bool Closed();
-
-    void SetHandler(UINT msg, std::function<WndCallback> &&callback);
-
-private:
-    static LRESULT WINAPI WinProc(HWND hwnd, UINT msg, WPARAM wp, LPARAM lp);
-
-    HINSTANCE hinst;
-    HWND hwnd;
-    bool closed;
-
-    std::unordered_map<UINT, std::function<WndCallback>> callbacks;
-};
+#pragma once
+
+#include "SpscQueue.h"
+#include <atomic>
+#include <cstdint>
+
+enum class WindowEventType : uint32_t
+{
+    Close,
+    Resize,
+    KeyDown,
+    KeyUp,
+    MouseMove,
+    MouseDown,
+    MouseUp,
+    MouseWheel,
+    Focus,
+};
+
+// What an OS message boils down to, copied through the event queue as is
+struct WindowEvent
+{
+    WindowEventType type;
+    // Virtual key code, mouse button, wheel delta or whether focus was gained
+    int32_t code;
+    // Client size for resizes, cursor position in the client area for mouse events
+    int32_t x;
+    int32_t y;
+};
+
+// Platform independent window. The thread that made it pumps its OS messages,
+// which are turned into WindowEvents and queued for one other thread, usually
+// the render thread, to poll. Neither side waits on the other.
+class Window
+{
+public:
+    Window();
+    virtual ~Window();
+
+    // Handle the OS messages that are waiting, on the thread that made the window.
+    // With wait set it sleeps until there is one. False once the window has closed.
+    virtual bool PumpEvents(bool wait) = 0;
+    virtual void GetClientSize(uint32_t &width, uint32_t &height) const = 0;
+    bool Closed() const;
+
+    // The consumer side, only one thread may poll
+    bool PollEvent(WindowEvent &event);
+    // True once after any number of resizes, even ones whose events were lost
+    // to a full queue. Checked by the consumer every frame.
+    bool TakeResize();
+    // Events lost to a full queue
+    uint32_t GetDroppedEvents() const;
+
+protected:
+    // Called by the pumping thread, drops the event when the queue is full
+    void PushEvent(const WindowEvent &event);
+
+    std::atomic<bool> closed;
+
+private:
+    SpscQueue<WindowEvent> events;
+    std::atomic<bool> resized;
+    std::atomic<uint32_t> droppedEvents;
+};